@@ -0,0 +1,55 @@
+#pragma once
+
+#include <plugin.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+
+extern PLH::PolyHookPlugin g_polyHookPlugin;
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define BENCH_NOINLINE __declspec(noinline)
+#define BENCH_PAD() do { __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); \
+                         __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); } while (0)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#define BENCH_PAD() __asm__ __volatile__(".rept 16\n\tnop\n\t.endr")
+#endif
+
+namespace bench {
+	using namespace PLH;
+
+	// Every target starts with BENCH_PAD() so the detour always has enough relocatable bytes to overwrite,
+	// the padding is executed in all modes and does not skew the comparison.
+	inline volatile int64_t g_sink = 0;
+
+	template<int N>
+	ReturnAction Handler(Callback*, const Callback::Parameters* params, int32_t count, const Callback::Return* ret, CallbackType) {
+		benchmark::DoNotOptimize(params);
+		benchmark::DoNotOptimize(count);
+		benchmark::DoNotOptimize(ret);
+		return ReturnAction::Ignored;
+	}
+
+	inline constexpr std::array<Callback::CallbackHandler, 4> kHandlers = {
+		&Handler<0>, &Handler<1>, &Handler<2>, &Handler<3>
+	};
+
+	inline void AddHandlers(Callback* callback, int count, bool post) {
+		for (int i = 0; i < count; ++i) {
+			callback->addCallback(CallbackType::Pre, kHandlers[static_cast<size_t>(i)]);
+			if (post) {
+				callback->addCallback(CallbackType::Post, kHandlers[static_cast<size_t>(i)]);
+			}
+		}
+	}
+
+	// Keeps the plugin alive for the duration of a benchmark binary
+	struct PluginScope {
+		PluginScope() { g_polyHookPlugin.OnPluginStart(); }
+		~PluginScope() { g_polyHookPlugin.OnPluginEnd(); }
+	};
+}
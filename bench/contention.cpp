@@ -0,0 +1,126 @@
+#include "bench.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Many threads calling the same hooked function while handlers or strings churn.
+//
+// Exercises the Callback::m_mutex shared_lock taken on every dispatch and the unique_lock taken by
+// AddCallback/RemoveCallback, and the storage mutex taken by store()/cleanup(). Reports throughput and
+// the p99 latency over the samples of all threads per thread count.
+
+using namespace bench;
+
+namespace {
+	enum class Churn : int64_t {
+		None,     ///< callers only
+		Handlers, ///< a background thread keeps adding and removing a handler
+		Strings,  ///< every Pre handler call replaces an argument string (SetArgumentString path)
+	};
+
+	BENCH_NOINLINE int32_t Contended(int32_t a, const char* b) {
+		BENCH_PAD();
+		g_sink = a + (b ? b[0] : 0);
+		return static_cast<int32_t>(g_sink);
+	}
+
+	int32_t (*volatile g_contended)(int32_t, const char*) = &Contended;
+
+	ReturnAction StringHandler(Callback* callback, const Callback::Parameters* params, int32_t, const Callback::Return*, CallbackType) {
+		params->setArg(1, callback->store("replaced").c_str());
+		return ReturnAction::Ignored;
+	}
+
+	Callback* g_callback = nullptr;
+	std::jthread g_churn;
+
+	// every thread adds its samples after the timed loop, thread 0 waits for all of them to take the p99
+	std::mutex g_samplesMutex;
+	std::vector<int64_t> g_samples;
+	std::atomic<int> g_reported = 0;
+
+	// Latency is sampled every kSampleEvery calls to keep the clock reads out of the throughput numbers
+	constexpr size_t kSampleEvery = 16;
+
+	void BM_Contention(benchmark::State& state) {
+		const auto churn = static_cast<Churn>(state.range(0));
+
+		if (state.thread_index() == 0) {
+			g_samples.clear();
+			g_reported = 0;
+
+			using enum DataType;
+			g_callback = g_polyHookPlugin.hookDetour(reinterpret_cast<void*>(&Contended), Int32, std::vector{Int32, String}, 0xFF);
+			if (!g_callback) {
+				state.SkipWithError("failed to install hook");
+			} else {
+				g_callback->addCallback(CallbackType::Pre, churn == Churn::Strings ? &StringHandler : kHandlers[0]);
+				g_callback->addCallback(CallbackType::Post, kHandlers[1]);
+
+				if (churn == Churn::Handlers) {
+					g_churn = std::jthread([callback = g_callback](std::stop_token token) {
+						while (!token.stop_requested()) {
+							callback->addCallback(CallbackType::Pre, kHandlers[2]);
+							callback->removeCallback(CallbackType::Pre, kHandlers[2]);
+						}
+					});
+				}
+			}
+		}
+
+		std::vector<int64_t> samples;
+		samples.reserve(1 << 16);
+
+		size_t i = 0;
+		for (auto _ : state) {
+			if (++i % kSampleEvery == 0) {
+				auto start = std::chrono::steady_clock::now();
+				benchmark::DoNotOptimize(g_contended(1, "original"));
+				auto end = std::chrono::steady_clock::now();
+				samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+			} else {
+				benchmark::DoNotOptimize(g_contended(1, "original"));
+			}
+		}
+
+		{
+			std::lock_guard lock(g_samplesMutex);
+			g_samples.insert(g_samples.end(), samples.begin(), samples.end());
+		}
+		g_reported.fetch_add(1);
+
+		if (state.thread_index() == 0) {
+			while (g_reported.load() != state.threads()) {
+				std::this_thread::yield();
+			}
+			if (!g_samples.empty()) {
+				auto p99 = g_samples.begin() + static_cast<ptrdiff_t>(g_samples.size() * 99 / 100);
+				std::nth_element(g_samples.begin(), p99, g_samples.end());
+				state.counters["p99_ns"] = static_cast<double>(*p99);
+			}
+		}
+		state.counters["calls"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+		state.SetItemsProcessed(state.iterations());
+
+		if (state.thread_index() == 0) {
+			if (g_churn.joinable()) {
+				g_churn.request_stop();
+				g_churn.join();
+			}
+			g_polyHookPlugin.unhookDetour(reinterpret_cast<void*>(&Contended));
+			g_callback = nullptr;
+		}
+	}
+}
+
+BENCHMARK(BM_Contention)
+	->ArgName("churn")
+	->Arg(static_cast<int64_t>(Churn::None))
+	->Arg(static_cast<int64_t>(Churn::Handlers))
+	->Arg(static_cast<int64_t>(Churn::Strings))
+	->ThreadRange(1, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+	->UseRealTime();
@@ -0,0 +1,326 @@
+#include "bench.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+// Install/uninstall throughput and memory growth of hookDetour, hookVirtual, unhookVirtual and unhookAll
+// at 1k, 10k and 100k hooks. Every benchmark runs a single iteration over freshly generated targets and
+// reports per-op time, JIT bytes, RSS growth and how long the delayed removal queue takes to drain.
+//
+//   polyhook_bench_install --benchmark_out=install.json --benchmark_out_format=json
+
+using namespace bench;
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	// Synthetic target: enough nops for the detour to relocate, then 'xor eax, eax; ret'
+	constexpr size_t kFunctionStride = 32;
+	constexpr uint8_t kFunctionTemplate[kFunctionStride] = {
+		0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90,
+		0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90,
+		0x31, 0xC0, 0xC3, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC,
+		0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC,
+	};
+
+	/**
+	 * Block of generated functions in its own runtime, so the plugin JIT statistics only count stubs.
+	 */
+	class SyntheticFunctions {
+	public:
+		explicit SyntheticFunctions(size_t count) : m_count(count) {
+			asmjit::CodeHolder code;
+			code.init(m_runtime.environment(), m_runtime.cpuFeatures());
+			asmjit::x86::Assembler a(&code);
+			for (size_t i = 0; i < count; ++i) {
+				a.embed(kFunctionTemplate, sizeof(kFunctionTemplate));
+			}
+			if (m_runtime.add(&m_base, &code) != asmjit::kErrorOk) {
+				m_base = nullptr;
+			}
+		}
+
+		~SyntheticFunctions() {
+			if (m_base) {
+				m_runtime.release(m_base);
+			}
+		}
+
+		bool valid() const noexcept { return m_base != nullptr; }
+		size_t size() const noexcept { return m_count; }
+		void* operator[](size_t index) const noexcept { return static_cast<uint8_t*>(m_base) + index * kFunctionStride; }
+
+	private:
+		asmjit::JitRuntime m_runtime;
+		void* m_base = nullptr;
+		size_t m_count;
+	};
+
+	/**
+	 * Objects whose vtables point into a block of synthetic functions. Tables are nullptr terminated
+	 * so VTableSwapHook stops counting slots at the end.
+	 */
+	class SyntheticClasses {
+	public:
+		struct Object {
+			void** vptr;
+		};
+
+		SyntheticClasses(const SyntheticFunctions& functions, size_t count, size_t slots) : m_tables(count), m_objects(count) {
+			for (size_t i = 0; i < count; ++i) {
+				auto& table = m_tables[i];
+				table.resize(slots + 1);
+				for (size_t j = 0; j < slots; ++j) {
+					table[j] = functions[(i * slots + j) % functions.size()];
+				}
+				table[slots] = nullptr;
+				m_objects[i] = std::make_unique<Object>(table.data());
+			}
+		}
+
+		size_t size() const noexcept { return m_objects.size(); }
+		void* operator[](size_t index) const noexcept { return m_objects[index].get(); }
+
+	private:
+		std::vector<std::vector<void*>> m_tables;
+		std::vector<std::unique_ptr<Object>> m_objects;
+	};
+
+	size_t GetResidentBytes() {
+#if defined(__linux__)
+		FILE* file = std::fopen("/proc/self/statm", "r");
+		if (!file)
+			return 0;
+		unsigned long size = 0, resident = 0;
+		int n = std::fscanf(file, "%lu %lu", &size, &resident);
+		std::fclose(file);
+		return n == 2 ? resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+#else
+		return 0;
+#endif
+	}
+
+	double Since(Clock::time_point start) {
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	// Calls OnPluginUpdate back to back until every delayed removal is released. This is not a frame
+	// loop, drain_ms is the wall time including the one second grace period of the newest removal.
+	void DrainRemovals(benchmark::State& state) {
+		auto start = Clock::now();
+		while (g_polyHookPlugin.getPendingRemovals() != 0) {
+			g_polyHookPlugin.OnPluginUpdate(0.0f);
+		}
+		state.counters["drain_ms"] = Since(start) * 1e3;
+	}
+
+	struct Snapshot {
+		size_t jitUsed;
+		size_t jitReserved;
+		size_t resident;
+		size_t slab;
+
+		static Snapshot take() {
+			auto stats = g_polyHookPlugin.getJitStatistics();
+			return {stats.usedSize, stats.reservedSize, GetResidentBytes(), Callback::getSlabReservedBytes()};
+		}
+	};
+
+	void ReportGrowth(benchmark::State& state, const Snapshot& before, const Snapshot& after, size_t hooks) {
+		state.counters["jit_bytes"] = static_cast<double>(after.jitUsed - before.jitUsed);
+		state.counters["jit_reserved"] = static_cast<double>(after.jitReserved - before.jitReserved);
+		const size_t resident = after.resident > before.resident ? after.resident - before.resident : 0;
+		state.counters["rss_bytes"] = static_cast<double>(resident);
+		state.counters["rss_per_hook"] = static_cast<double>(resident) / static_cast<double>(hooks);
+		state.counters["slab_bytes"] = static_cast<double>(after.slab - before.slab);
+	}
+
+	const std::vector<DataType> kArguments = {DataType::Int32, DataType::Int32};
+	const std::vector<DataType> kThisArguments = {DataType::Pointer, DataType::Int32, DataType::Int32};
+	constexpr uint8_t kNoVarArgs = 0xFF;
+
+	void BM_HookDetour(benchmark::State& state) {
+		const auto count = static_cast<size_t>(state.range(0));
+
+		for (auto _ : state) {
+			SyntheticFunctions functions(count);
+			if (!functions.valid()) {
+				state.SkipWithError("failed to generate targets");
+				return;
+			}
+
+			auto before = Snapshot::take();
+
+			auto start = Clock::now();
+			for (size_t i = 0; i < count; ++i) {
+				if (!g_polyHookPlugin.hookDetour(functions[i], DataType::Int32, kArguments, kNoVarArgs)) {
+					state.SkipWithError("failed to install hook");
+					g_polyHookPlugin.unhookAll();
+					return;
+				}
+			}
+			double install = Since(start);
+
+			ReportGrowth(state, before, Snapshot::take(), count);
+
+			start = Clock::now();
+			for (size_t i = 0; i < count; ++i) {
+				g_polyHookPlugin.unhookDetour(functions[i]);
+			}
+			double uninstall = Since(start);
+
+			DrainRemovals(state);
+
+			state.SetIterationTime(install);
+			state.counters["install_ns"] = install * 1e9 / static_cast<double>(count);
+			state.counters["uninstall_ns"] = uninstall * 1e9 / static_cast<double>(count);
+		}
+	}
+
+	// Many classes with a few hooked slots each, the common case for game object hooks
+	void BM_HookVirtual(benchmark::State& state) {
+		const auto count = static_cast<size_t>(state.range(0));
+		constexpr size_t kSlots = 4;
+
+		for (auto _ : state) {
+			SyntheticFunctions functions(count);
+			if (!functions.valid()) {
+				state.SkipWithError("failed to generate targets");
+				return;
+			}
+			SyntheticClasses classes(functions, count / kSlots, kSlots);
+
+			auto before = Snapshot::take();
+
+			auto start = Clock::now();
+			for (size_t i = 0; i < classes.size(); ++i) {
+				for (size_t j = 0; j < kSlots; ++j) {
+					if (!g_polyHookPlugin.hookVirtual(classes[i], static_cast<int>(j), DataType::Int32, kThisArguments, kNoVarArgs)) {
+						state.SkipWithError("failed to install hook");
+						g_polyHookPlugin.unhookAll();
+						return;
+					}
+				}
+			}
+			double install = Since(start);
+
+			ReportGrowth(state, before, Snapshot::take(), count);
+
+			start = Clock::now();
+			for (size_t i = 0; i < classes.size(); ++i) {
+				for (size_t j = 0; j < kSlots; ++j) {
+					g_polyHookPlugin.unhookVirtual(classes[i], static_cast<int>(j));
+				}
+			}
+			double uninstall = Since(start);
+
+			DrainRemovals(state);
+
+			state.SetIterationTime(install);
+			state.counters["install_ns"] = install * 1e9 / static_cast<double>(count);
+			state.counters["uninstall_ns"] = uninstall * 1e9 / static_cast<double>(count);
+		}
+	}
+
+	// All hooks on one class. Every hookVirtual/unhookVirtual tears down and rebuilds the VTableSwapHook
+	// with the full redirect map, so per-op time grows with the number of slots already hooked.
+	void BM_HookVirtualWide(benchmark::State& state) {
+		const auto slots = static_cast<size_t>(state.range(0));
+
+		for (auto _ : state) {
+			SyntheticFunctions functions(slots);
+			if (!functions.valid()) {
+				state.SkipWithError("failed to generate targets");
+				return;
+			}
+			SyntheticClasses classes(functions, 1, slots);
+
+			auto before = Snapshot::take();
+
+			auto start = Clock::now();
+			for (size_t j = 0; j < slots; ++j) {
+				if (!g_polyHookPlugin.hookVirtual(classes[0], static_cast<int>(j), DataType::Int32, kThisArguments, kNoVarArgs)) {
+					state.SkipWithError("failed to install hook");
+					g_polyHookPlugin.unhookAll();
+					return;
+				}
+			}
+			double install = Since(start);
+
+			ReportGrowth(state, before, Snapshot::take(), slots);
+
+			start = Clock::now();
+			for (size_t j = 0; j < slots; ++j) {
+				g_polyHookPlugin.unhookVirtual(classes[0], static_cast<int>(j));
+			}
+			double uninstall = Since(start);
+
+			DrainRemovals(state);
+
+			state.SetIterationTime(install);
+			state.counters["install_ns"] = install * 1e9 / static_cast<double>(slots);
+			state.counters["uninstall_ns"] = uninstall * 1e9 / static_cast<double>(slots);
+		}
+	}
+
+	// Bulk teardown of a mixed detour/virtual population
+	void BM_UnhookAll(benchmark::State& state) {
+		const auto count = static_cast<size_t>(state.range(0));
+		constexpr size_t kSlots = 4;
+
+		for (auto _ : state) {
+			SyntheticFunctions functions(count);
+			SyntheticFunctions virtuals(count / 2);
+			if (!functions.valid() || !virtuals.valid()) {
+				state.SkipWithError("failed to generate targets");
+				return;
+			}
+			SyntheticClasses classes(virtuals, count / 2 / kSlots, kSlots);
+
+			auto before = Snapshot::take();
+
+			for (size_t i = 0; i < count / 2; ++i) {
+				g_polyHookPlugin.hookDetour(functions[i], DataType::Int32, kArguments, kNoVarArgs);
+			}
+			for (size_t i = 0; i < classes.size(); ++i) {
+				for (size_t j = 0; j < kSlots; ++j) {
+					g_polyHookPlugin.hookVirtual(classes[i], static_cast<int>(j), DataType::Int32, kThisArguments, kNoVarArgs);
+				}
+			}
+
+			ReportGrowth(state, before, Snapshot::take(), count);
+
+			auto start = Clock::now();
+			g_polyHookPlugin.unhookAll();
+			double uninstall = Since(start);
+
+			DrainRemovals(state);
+
+			state.SetIterationTime(uninstall);
+			state.counters["uninstall_ns"] = uninstall * 1e9 / static_cast<double>(count);
+		}
+	}
+}
+
+BENCHMARK(BM_HookDetour)->Arg(1000)->Arg(10000)->Arg(100000)->Iterations(1)->UseManualTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_HookVirtual)->Arg(1000)->Arg(10000)->Arg(100000)->Iterations(1)->UseManualTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_HookVirtualWide)->Arg(1000)->Arg(2000)->Arg(4000)->Arg(8000)->Iterations(1)->UseManualTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_UnhookAll)->Arg(1000)->Arg(10000)->Arg(100000)->Iterations(1)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv) {
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+
+	PluginScope plugin;
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
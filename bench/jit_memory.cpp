@@ -0,0 +1,89 @@
+#include "bench.hpp"
+
+#include <arena.hpp>
+#include <thunk.hpp>
+
+#include <memory>
+#include <vector>
+
+// Cost of emitting, releasing and patching JIT code on the plain asmjit runtime and on the arena with a single
+// read/write/execute mapping or dual memfd mappings. No plugin instance is needed, every benchmark owns its runtime.
+//
+//   polyhook_bench_jit --benchmark_out=jit.json --benchmark_out_format=json
+//
+// End to end install numbers for the dual mapping come from polyhook_bench_install with POLYHOOK_JIT_DUAL_MAP=1.
+
+using namespace bench;
+
+namespace {
+	enum Backend : int64_t {
+		kAsmjit,
+		kSingle,
+		kDual
+	};
+
+	std::shared_ptr<asmjit::JitRuntime> MakeRuntime(int64_t backend) {
+		switch (backend) {
+			case kSingle: return std::make_shared<JitArena>(JitArena::Mapping::Single);
+			case kDual: return std::make_shared<JitArena>(JitArena::Mapping::Dual);
+			default: return std::make_shared<asmjit::JitRuntime>();
+		}
+	}
+
+	const char* GetBackendName(int64_t backend) {
+		switch (backend) {
+			case kSingle: return "arena_rwx";
+			case kDual: return "arena_dual";
+			default: return "asmjit";
+		}
+	}
+
+	// Stub sized blob which is added and released again, what every hook install and hot relayout does
+	void BM_EmitRelease(benchmark::State& state) {
+		auto rt = MakeRuntime(state.range(0));
+		std::vector<uint8_t> body(static_cast<size_t>(state.range(1)), 0xCC);
+		body.back() = 0xC3;
+
+		for (auto _ : state) {
+			asmjit::CodeHolder code;
+			code.init(rt->environment(), rt->cpuFeatures());
+			asmjit::x86::Assembler a(&code);
+			a.embed(body.data(), body.size());
+
+			void* function = nullptr;
+			if (rt->add(&function, &code) != asmjit::kErrorOk) {
+				state.SkipWithError("JitRuntime::add failed");
+				break;
+			}
+			benchmark::DoNotOptimize(function);
+			rt->release(function);
+		}
+
+		state.SetItemsProcessed(state.iterations());
+		state.SetLabel(GetBackendName(state.range(0)));
+	}
+
+	// Two in-place slot writes per iteration, the patching tiering and thunk reuse depend on
+	void BM_ThunkPatch(benchmark::State& state) {
+		auto rt = MakeRuntime(state.range(0));
+		ThunkPool pool(rt);
+
+		// keeps the first block alive, so the loop never grows the pool
+		uint64_t pinned = pool.acquire(&state);
+
+		for (auto _ : state) {
+			uint64_t thunk = pool.acquire(&state);
+			benchmark::DoNotOptimize(thunk);
+			pool.release(thunk);
+		}
+
+		pool.release(pinned);
+		state.SetItemsProcessed(state.iterations() * 2);
+		state.SetLabel(GetBackendName(state.range(0)));
+	}
+}
+
+BENCHMARK(BM_EmitRelease)->ArgsProduct({{kAsmjit, kSingle, kDual}, {64, 512}})->ArgNames({"backend", "bytes"});
+BENCHMARK(BM_ThunkPatch)->Arg(kAsmjit)->Arg(kSingle)->Arg(kDual)->ArgName("backend");
+
+BENCHMARK_MAIN();
@@ -0,0 +1,230 @@
+#include "bench.hpp"
+
+#include <cstdarg>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Per-call overhead of a hooked function compared to the plain call.
+//
+// Results are machine readable with the standard Google Benchmark flags, e.g.
+//   polyhook_bench --benchmark_out=stub_overhead.json --benchmark_out_format=json
+// and can be compared between revisions with benchmark's tools/compare.py.
+
+using namespace bench;
+
+namespace {
+	BENCH_NOINLINE void Void0() {
+		BENCH_PAD();
+		g_sink = g_sink + 1;
+	}
+
+	BENCH_NOINLINE int32_t Int6(int32_t a, int32_t b, int32_t c, int32_t d, int32_t e, int32_t f) {
+		BENCH_PAD();
+		g_sink = a + b - c + d - e + f;
+		return static_cast<int32_t>(g_sink);
+	}
+
+	BENCH_NOINLINE double MixedXmm(int32_t a, double b, float c, int64_t d, double e, float f) {
+		BENCH_PAD();
+		g_sink = a + d;
+		return b * e + static_cast<double>(c - f);
+	}
+
+	BENCH_NOINLINE int64_t Spill12(int64_t a0, int64_t a1, int64_t a2, int64_t a3, int64_t a4, int64_t a5,
+								   int64_t a6, int64_t a7, int64_t a8, int64_t a9, int64_t a10, int64_t a11) {
+		BENCH_PAD();
+		g_sink = a0 + a1 + a2 + a3 + a4 + a5 + a6 + a7 + a8 + a9 + a10 + a11;
+		return g_sink;
+	}
+
+	BENCH_NOINLINE int32_t Variadic(int32_t count, ...) {
+		BENCH_PAD();
+		va_list va;
+		va_start(va, count);
+		int32_t sum = 0;
+		for (int32_t i = 0; i < count; ++i) {
+			sum += va_arg(va, int32_t);
+		}
+		va_end(va);
+		g_sink = sum;
+		return sum;
+	}
+
+	// Virtual counterparts, slots are hooked by index in declaration order
+	struct BenchClass {
+		BENCH_NOINLINE virtual void Void0() {
+			BENCH_PAD();
+			g_sink = g_sink + 1;
+		}
+
+		BENCH_NOINLINE virtual int32_t Int6(int32_t a, int32_t b, int32_t c, int32_t d, int32_t e, int32_t f) {
+			BENCH_PAD();
+			g_sink = a + b - c + d - e + f;
+			return static_cast<int32_t>(g_sink);
+		}
+
+		BENCH_NOINLINE virtual double MixedXmm(int32_t a, double b, float c, int64_t d, double e, float f) {
+			BENCH_PAD();
+			g_sink = a + d;
+			return b * e + static_cast<double>(c - f);
+		}
+
+		BENCH_NOINLINE virtual int64_t Spill12(int64_t a0, int64_t a1, int64_t a2, int64_t a3, int64_t a4, int64_t a5,
+											   int64_t a6, int64_t a7, int64_t a8, int64_t a9, int64_t a10, int64_t a11) {
+			BENCH_PAD();
+			g_sink = a0 + a1 + a2 + a3 + a4 + a5 + a6 + a7 + a8 + a9 + a10 + a11;
+			return g_sink;
+		}
+	};
+
+	BenchClass g_object;
+
+	void (*volatile g_void0)() = &Void0;
+	int32_t (*volatile g_int6)(int32_t, int32_t, int32_t, int32_t, int32_t, int32_t) = &Int6;
+	double (*volatile g_mixedXmm)(int32_t, double, float, int64_t, double, float) = &MixedXmm;
+	int64_t (*volatile g_spill12)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t) = &Spill12;
+	int32_t (*volatile g_variadic)(int32_t, ...) = &Variadic;
+
+	struct SignatureCase {
+		const char* name;
+		void* function;
+		int index; ///< vtable slot, -1 if there is no virtual counterpart
+		DataType returnType;
+		std::vector<DataType> arguments;
+		uint8_t vaIndex;
+		std::function<void()> call;
+		std::function<void(BenchClass*)> callVirtual;
+	};
+
+	std::vector<SignatureCase> GetCases() {
+		using enum DataType;
+		constexpr uint8_t kNoVarArgs = 0xFF;
+		return {
+			{"Void0", reinterpret_cast<void*>(&Void0), 0, Void, {}, kNoVarArgs,
+			 [] { g_void0(); },
+			 [](BenchClass* obj) { obj->Void0(); }},
+			{"Int6", reinterpret_cast<void*>(&Int6), 1, Int32, {Int32, Int32, Int32, Int32, Int32, Int32}, kNoVarArgs,
+			 [] { benchmark::DoNotOptimize(g_int6(1, 2, 3, 4, 5, 6)); },
+			 [](BenchClass* obj) { benchmark::DoNotOptimize(obj->Int6(1, 2, 3, 4, 5, 6)); }},
+			{"MixedXmm", reinterpret_cast<void*>(&MixedXmm), 2, Double, {Int32, Double, Float, Int64, Double, Float}, kNoVarArgs,
+			 [] { benchmark::DoNotOptimize(g_mixedXmm(1, 2.0, 3.0f, 4, 5.0, 6.0f)); },
+			 [](BenchClass* obj) { benchmark::DoNotOptimize(obj->MixedXmm(1, 2.0, 3.0f, 4, 5.0, 6.0f)); }},
+			{"Spill12", reinterpret_cast<void*>(&Spill12), 3, Int64, std::vector<DataType>(12, Int64), kNoVarArgs,
+			 [] { benchmark::DoNotOptimize(g_spill12(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12)); },
+			 [](BenchClass* obj) { benchmark::DoNotOptimize(obj->Spill12(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12)); }},
+			{"Variadic", reinterpret_cast<void*>(&Variadic), -1, Int32, {Int32, Int32, Int32, Int32}, 1,
+			 [] { benchmark::DoNotOptimize(g_variadic(3, 1, 2, 3)); },
+			 nullptr},
+		};
+	}
+
+	enum class Mode {
+		Direct,  ///< plain call through a function pointer
+		Detour,  ///< same call with the target detoured
+		Virtual, ///< plain virtual call
+		VTable,  ///< same virtual call with the slot hooked
+	};
+
+	constexpr const char* GetModeName(Mode mode) {
+		switch (mode) {
+			case Mode::Direct: return "Direct";
+			case Mode::Detour: return "Detour";
+			case Mode::Virtual: return "Virtual";
+			case Mode::VTable: return "VTable";
+		}
+		return "";
+	}
+
+	void RunCase(benchmark::State& state, const SignatureCase& sig, Mode mode, int handlers, bool post) {
+		Callback* callback = nullptr;
+
+		switch (mode) {
+			case Mode::Detour:
+				callback = g_polyHookPlugin.hookDetour(sig.function, sig.returnType, sig.arguments, sig.vaIndex);
+				break;
+			case Mode::VTable: {
+				std::vector<DataType> arguments{DataType::Pointer};
+				arguments.insert(arguments.end(), sig.arguments.begin(), sig.arguments.end());
+				callback = g_polyHookPlugin.hookVirtual(&g_object, sig.index, sig.returnType, arguments, sig.vaIndex);
+				break;
+			}
+			default:
+				break;
+		}
+
+		if ((mode == Mode::Detour || mode == Mode::VTable) && !callback) {
+			state.SkipWithError("failed to install hook");
+			return;
+		}
+
+		if (callback) {
+			AddHandlers(callback, handlers, post);
+		}
+
+		BenchClass* object = &g_object;
+		benchmark::DoNotOptimize(object);
+
+		if (mode == Mode::Virtual || mode == Mode::VTable) {
+			for (auto _ : state) {
+				sig.callVirtual(object);
+			}
+		} else {
+			for (auto _ : state) {
+				sig.call();
+			}
+		}
+
+		state.counters["handlers"] = handlers;
+		state.counters["post"] = post;
+
+		if (mode == Mode::Detour) {
+			g_polyHookPlugin.unhookDetour(sig.function);
+		} else if (mode == Mode::VTable) {
+			g_polyHookPlugin.unhookVirtual(&g_object, sig.index);
+		}
+	}
+
+	void RegisterCases() {
+		static const std::vector<SignatureCase> cases = GetCases();
+
+		for (const auto& sig : cases) {
+			for (Mode mode : {Mode::Direct, Mode::Detour, Mode::Virtual, Mode::VTable}) {
+				const bool hooked = mode == Mode::Detour || mode == Mode::VTable;
+				const bool isVirtual = mode == Mode::Virtual || mode == Mode::VTable;
+				if (isVirtual && sig.index == -1)
+					continue;
+
+				if (!hooked) {
+					std::string name = std::string(GetModeName(mode)) + "/" + sig.name;
+					benchmark::RegisterBenchmark(name.c_str(), [&sig, mode](benchmark::State& state) {
+						RunCase(state, sig, mode, 0, false);
+					});
+					continue;
+				}
+
+				for (int handlers : {0, 1, 4}) {
+					for (bool post : {false, true}) {
+						std::string name = std::string(GetModeName(mode)) + "/" + sig.name + "/handlers:" + std::to_string(handlers) + (post ? "/PrePost" : "/Pre");
+						benchmark::RegisterBenchmark(name.c_str(), [&sig, mode, handlers, post](benchmark::State& state) {
+							RunCase(state, sig, mode, handlers, post);
+						});
+					}
+				}
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+
+	PluginScope plugin;
+	RegisterCases();
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
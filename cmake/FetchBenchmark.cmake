@@ -0,0 +1,16 @@
+include(FetchContent)
+
+message(STATUS "Pulling and configuring Google Benchmark")
+
+FetchContent_Declare(
+        benchmark
+        GIT_REPOSITORY https://github.com/google/benchmark.git
+        GIT_TAG v1.8.3
+)
+
+set(BENCHMARK_ENABLE_TESTING OFF CACHE INTERNAL "Enable testing of the benchmark library.")
+set(BENCHMARK_ENABLE_GTEST_TESTS OFF CACHE INTERNAL "Enable building the unit tests which depend on gtest.")
+set(BENCHMARK_ENABLE_INSTALL OFF CACHE INTERNAL "Enable installation of benchmark.")
+set(BENCHMARK_ENABLE_WERROR OFF CACHE INTERNAL "Build Release candidates with -Werror.")
+
+FetchContent_MakeAvailable(benchmark)
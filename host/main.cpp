@@ -0,0 +1,340 @@
+// Minimal in-process host for the polyhook plugin.
+//
+// Loads the plugin library directly, hands it stub implementations of the plg:: API,
+// runs OnPluginStart/OnPluginUpdate/OnPluginEnd and drives the exported C API.
+// Meant for running perf, benchmarks and sanitizers without a plugify installation.
+
+#include <plugify/cpp_plugin.hpp>
+#include <plugify/vector.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#ifndef POLYHOOK_PLUGIN_PATH
+#define POLYHOOK_PLUGIN_PATH ""
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define HOST_NOINLINE __declspec(noinline)
+#define HOST_PAD() do { __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); \
+                        __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); __nop(); } while (0)
+#else
+#define HOST_NOINLINE __attribute__((noinline))
+#define HOST_PAD() __asm__ __volatile__(".rept 16\n\tnop\n\t.endr")
+#endif
+
+namespace {
+	// Mirrors of the plugin ABI, kept local so the host does not depend on asmjit or PolyHook headers
+	enum class DataType : uint8_t { Void, Bool, Int8, UInt8, Int16, UInt16, Int32, UInt32, Int64, UInt64, Float, Double, Pointer, String };
+	enum class CallbackType : uint8_t { Pre, Post };
+	enum class ReturnAction : int32_t { Ignored, Handled, Override, Supercede };
+
+	using CallbackHandler = ReturnAction (*)(void* callback, const void* params, int32_t count, const void* ret, CallbackType type);
+
+	using InitFn = int (*)(void**, int, void*);
+	using StartFn = void (*)();
+	using UpdateFn = void (*)(float);
+	using EndFn = void (*)();
+	using HookDetourFn = void* (*)(void*, DataType, const plg::vector<DataType>&, int);
+	using UnhookDetourFn = bool (*)(void*);
+	using AddCallbackFn = bool (*)(void*, CallbackType, CallbackHandler);
+	using GetArgumentInt32Fn = int32_t (*)(const void*, size_t);
+	using SetArgumentInt32Fn = void (*)(const void*, size_t, int32_t);
+	using GetReturnInt32Fn = int32_t (*)(const void*);
+	using StartRecordingFn = bool (*)(void*, const plg::string&, uint64_t);
+	using StopRecordingFn = bool (*)(void*);
+	using ReplayRecordingFn = plg::string (*)(const plg::string&, void*, int, int);
+
+	struct Library {
+		void* handle{};
+
+		explicit Library(const std::string& path) {
+#if defined(_WIN32)
+			handle = LoadLibraryA(path.c_str());
+#else
+			handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+		}
+
+		~Library() {
+			if (!handle)
+				return;
+#if defined(_WIN32)
+			FreeLibrary(static_cast<HMODULE>(handle));
+#else
+			dlclose(handle);
+#endif
+		}
+
+		template<typename T>
+		T get(const char* name) const {
+#if defined(_WIN32)
+			auto addr = reinterpret_cast<void*>(GetProcAddress(static_cast<HMODULE>(handle), name));
+#else
+			void* addr = dlsym(handle, name);
+#endif
+			if (!addr) {
+				std::fprintf(stderr, "missing export: %s\n", name);
+				std::exit(EXIT_FAILURE);
+			}
+			return reinterpret_cast<T>(addr);
+		}
+	};
+
+	//
+	// Stub plg:: API
+	//
+
+	struct HostPaths {
+		std::filesystem::path::string_type base;
+		std::filesystem::path::string_type configs;
+		std::filesystem::path::string_type data;
+		std::filesystem::path::string_type logs;
+	} g_paths;
+
+	void InitPaths(const std::filesystem::path& root) {
+		std::filesystem::create_directories(root / "configs");
+		std::filesystem::create_directories(root / "data");
+		std::filesystem::create_directories(root / "logs");
+		g_paths.base = root.native();
+		g_paths.configs = (root / "configs").native();
+		g_paths.data = (root / "data").native();
+		g_paths.logs = (root / "logs").native();
+	}
+
+	void* GetMethodPtr(std::string_view) { return nullptr; }
+	void GetMethodPtr2(std::string_view, void** out) { *out = nullptr; }
+	bool IsModuleLoaded(std::string_view, std::optional<plg::version>, bool) { return false; }
+	bool IsPluginLoaded(std::string_view, std::optional<plg::version>, bool) { return false; }
+
+	std::ptrdiff_t GetId(void*) { return 0; }
+	std::string_view GetName(void*) { return "polyhook"; }
+	std::string_view GetFullName(void*) { return "PolyHook API"; }
+	std::string_view GetDescription(void*) { return "polyhook standalone host"; }
+	std::string_view GetVersion(void*) { return "0.0.0"; }
+	std::string_view GetAuthor(void*) { return "host"; }
+	std::string_view GetWebsite(void*) { return ""; }
+	std::filesystem::path_view GetPluginBaseDir(void*) { return g_paths.base; }
+	std::filesystem::path_view GetConfigsDir(void*) { return g_paths.configs; }
+	std::filesystem::path_view GetDataDir(void*) { return g_paths.data; }
+	std::filesystem::path_view GetLogsDir(void*) { return g_paths.logs; }
+	std::vector<std::string_view> GetDependencies(void*) { return {}; }
+	std::optional<std::filesystem::path_view> FindResource(void*, std::filesystem::path_view) { return std::nullopt; }
+
+	// Order must match Plugify_Init in plugify/cpp_plugin.hpp
+	void* g_api[] = {
+		reinterpret_cast<void*>(&GetMethodPtr),
+		reinterpret_cast<void*>(&GetMethodPtr2),
+		reinterpret_cast<void*>(&IsModuleLoaded),
+		reinterpret_cast<void*>(&IsPluginLoaded),
+		reinterpret_cast<void*>(&GetId),
+		reinterpret_cast<void*>(&GetName),
+		reinterpret_cast<void*>(&GetFullName),
+		reinterpret_cast<void*>(&GetDescription),
+		reinterpret_cast<void*>(&GetVersion),
+		reinterpret_cast<void*>(&GetAuthor),
+		reinterpret_cast<void*>(&GetWebsite),
+		reinterpret_cast<void*>(&GetPluginBaseDir),
+		reinterpret_cast<void*>(&GetConfigsDir),
+		reinterpret_cast<void*>(&GetDataDir),
+		reinterpret_cast<void*>(&GetLogsDir),
+		reinterpret_cast<void*>(&GetDependencies),
+		reinterpret_cast<void*>(&FindResource),
+	};
+
+	//
+	// Scenario
+	//
+
+	volatile int32_t g_sink = 0;
+
+	HOST_NOINLINE int32_t HostTarget(int32_t a, int32_t b) {
+		HOST_PAD();
+		g_sink = a * b;
+		return a + b;
+	}
+
+	int32_t (*volatile g_target)(int32_t, int32_t) = &HostTarget;
+
+	struct Api {
+		SetArgumentInt32Fn setArgumentInt32;
+		GetReturnInt32Fn getReturnInt32;
+	} g_exports;
+
+	std::atomic<int64_t> g_preCalls = 0;
+	std::atomic<int64_t> g_postCalls = 0;
+
+	ReturnAction PreHandler(void*, const void* params, int32_t, const void*, CallbackType) {
+		g_preCalls.fetch_add(1, std::memory_order_relaxed);
+		g_exports.setArgumentInt32(params, 1, 10);
+		return ReturnAction::Ignored;
+	}
+
+	ReturnAction PostHandler(void*, const void*, int32_t, const void* ret, CallbackType) {
+		g_postCalls.fetch_add(1, std::memory_order_relaxed);
+		if (g_exports.getReturnInt32(ret) != 11) {
+			std::fprintf(stderr, "unexpected return value %d\n", g_exports.getReturnInt32(ret));
+			std::exit(EXIT_FAILURE);
+		}
+		return ReturnAction::Ignored;
+	}
+
+	void Usage(const char* self) {
+		std::printf("usage: %s [--plugin <path>] [--dir <path>] [--iterations <n>] [--threads <n>]\n"
+					"          [--record <file>] [--replay <file>] [--target <module>:<symbol>]\n", self);
+	}
+}
+
+int main(int argc, char** argv) {
+	std::string pluginPath = POLYHOOK_PLUGIN_PATH;
+	std::filesystem::path root = std::filesystem::current_path() / "polyhook_host";
+	int64_t iterations = 1000000;
+	int threads = 1;
+	std::string recordPath;
+	std::string replayPath;
+	std::string target;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string_view arg = argv[i];
+		if (arg == "--plugin" && i + 1 < argc) {
+			pluginPath = argv[++i];
+		} else if (arg == "--dir" && i + 1 < argc) {
+			root = argv[++i];
+		} else if (arg == "--iterations" && i + 1 < argc) {
+			iterations = std::strtoll(argv[++i], nullptr, 10);
+		} else if (arg == "--threads" && i + 1 < argc) {
+			threads = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--record" && i + 1 < argc) {
+			recordPath = argv[++i];
+		} else if (arg == "--replay" && i + 1 < argc) {
+			replayPath = argv[++i];
+		} else if (arg == "--target" && i + 1 < argc) {
+			target = argv[++i];
+		} else {
+			Usage(argv[0]);
+			return arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	InitPaths(root);
+
+	Library plugin(pluginPath);
+	if (!plugin.handle) {
+		std::fprintf(stderr, "failed to load plugin: %s\n", pluginPath.c_str());
+		return EXIT_FAILURE;
+	}
+
+	auto init = plugin.get<InitFn>("Plugify_Init");
+	auto start = plugin.get<StartFn>("Plugify_PluginStart");
+	auto update = plugin.get<UpdateFn>("Plugify_PluginUpdate");
+	auto end = plugin.get<EndFn>("Plugify_PluginEnd");
+	auto hookDetour = plugin.get<HookDetourFn>("HookDetour");
+	auto unhookDetour = plugin.get<UnhookDetourFn>("UnhookDetour");
+	auto addCallback = plugin.get<AddCallbackFn>("AddCallback");
+	g_exports.setArgumentInt32 = plugin.get<SetArgumentInt32Fn>("SetArgumentInt32");
+	g_exports.getReturnInt32 = plugin.get<GetReturnInt32Fn>("GetReturnInt32");
+	auto startRecording = plugin.get<StartRecordingFn>("StartRecording");
+	auto stopRecording = plugin.get<StopRecordingFn>("StopRecording");
+	auto replayRecording = plugin.get<ReplayRecordingFn>("ReplayRecording");
+
+	if (int version = init(g_api, plg::kApiVersion, nullptr); version != 0) {
+		std::fprintf(stderr, "plugin requires api version %d\n", version);
+		return EXIT_FAILURE;
+	}
+
+	start();
+
+	plg::vector<DataType> arguments = { DataType::Int32, DataType::Int32 };
+	void* callback = hookDetour(reinterpret_cast<void*>(&HostTarget), DataType::Int32, arguments, -1);
+	if (!callback) {
+		std::fprintf(stderr, "HookDetour failed\n");
+		return EXIT_FAILURE;
+	}
+	addCallback(callback, CallbackType::Pre, &PreHandler);
+	addCallback(callback, CallbackType::Post, &PostHandler);
+	if (!recordPath.empty() && !startRecording(callback, plg::string(recordPath), 0)) {
+		std::fprintf(stderr, "StartRecording failed\n");
+		return EXIT_FAILURE;
+	}
+
+	auto begin = std::chrono::steady_clock::now();
+	{
+		std::vector<std::jthread> workers;
+		for (int t = 0; t < threads; ++t) {
+			workers.emplace_back([iterations] {
+				for (int64_t i = 0; i < iterations; ++i) {
+					if (g_target(1, 2) != 11) {
+						std::fprintf(stderr, "hook did not modify the argument\n");
+						std::exit(EXIT_FAILURE);
+					}
+				}
+			});
+		}
+	}
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	const int64_t expected = iterations * threads;
+	if (g_preCalls != expected || g_postCalls != expected) {
+		std::fprintf(stderr, "handler call mismatch: pre %lld post %lld expected %lld\n",
+					 static_cast<long long>(g_preCalls.load()), static_cast<long long>(g_postCalls.load()), static_cast<long long>(expected));
+		return EXIT_FAILURE;
+	}
+
+	std::printf("%lld hooked calls on %d thread(s) in %.3f s (%.1f ns/call)\n",
+				static_cast<long long>(expected), threads, elapsed, elapsed * 1e9 / static_cast<double>(expected));
+
+	if (!recordPath.empty()) {
+		stopRecording(callback);
+	}
+
+	unhookDetour(reinterpret_cast<void*>(&HostTarget));
+	if (g_target(1, 2) != 3) {
+		std::fprintf(stderr, "original function not restored\n");
+		return EXIT_FAILURE;
+	}
+
+	// the recording is replayed against the unhooked HostTarget, or any function of the same signature
+	if (!replayPath.empty()) {
+		void* function = reinterpret_cast<void*>(&HostTarget);
+		std::unique_ptr<Library> module;
+		if (const size_t colon = target.rfind(':'); colon != std::string::npos) {
+			module = std::make_unique<Library>(target.substr(0, colon));
+			if (!module->handle) {
+				std::fprintf(stderr, "failed to load target: %s\n", target.c_str());
+				return EXIT_FAILURE;
+			}
+			function = module->get<void*>(target.substr(colon + 1).c_str());
+		}
+		plg::string report = replayRecording(plg::string(replayPath), function, threads, 1);
+		std::printf("replay: %s\n", report.c_str());
+	}
+
+	// let the delayed removal queue drain like a real host would
+	auto drainUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(1100);
+	while (std::chrono::steady_clock::now() < drainUntil) {
+		update(0.01f);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	update(0.01f);
+
+	end();
+
+	return EXIT_SUCCESS;
+}
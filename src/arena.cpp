@@ -0,0 +1,456 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace asmjit;
+
+namespace {
+	struct BlockHeader {
+		uint64_t size;
+		uint64_t magic;
+	};
+
+	constexpr size_t kHeaderSize = sizeof(BlockHeader);
+	constexpr uint64_t kMagic = 0x616E657261687070ull;
+	constexpr uint64_t kMaxDistance = 0x7FFF0000ull;
+	constexpr int64_t kMaxSteps = static_cast<int64_t>(kMaxDistance / PLH::JitArena::kRegionSize) - 1;
+	constexpr uint8_t kInt3 = 0xCC;
+
+	struct ThreadCache {
+		uint64_t arena = 0;
+		void* region = nullptr;
+		uint64_t cursor = 0;
+		uint64_t end = 0;
+	};
+
+	thread_local ThreadCache t_cache;
+	thread_local uint64_t t_nearHint = 0;
+	thread_local bool t_hot = false;
+	std::atomic<uint64_t> g_nextArenaId = 1;
+
+	constexpr size_t AlignUp(size_t value, size_t alignment) noexcept {
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	uint64_t Distance(uint64_t a, uint64_t b) noexcept {
+		return a > b ? a - b : b - a;
+	}
+
+	const JitAllocator::CreateParams* GetAllocatorParams(PLH::JitArena::Mapping mapping) noexcept {
+		// code the arena cannot place should not end up writable and executable either
+		static const JitAllocator::CreateParams dual = [] {
+			JitAllocator::CreateParams params{};
+			params.options = JitAllocatorOptions::kUseDualMapping;
+			return params;
+		}();
+		return mapping == PLH::JitArena::Mapping::Dual ? &dual : nullptr;
+	}
+
+	// Backing file of a dual mapped region, -1 when the platform has none
+	int CreateCodeFile() {
+#if defined(__linux__)
+		int fd = memfd_create("polyhook-jit", MFD_CLOEXEC);
+		if (fd < 0)
+			return -1;
+		if (ftruncate(fd, PLH::JitArena::kRegionSize) != 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+#else
+		return -1;
+#endif
+	}
+
+	void CloseCodeFile(int fd) {
+#if !defined(_WIN32)
+		if (fd >= 0) {
+			close(fd);
+		}
+#else
+		(void) fd;
+#endif
+	}
+
+	void Advise(void* p) {
+#if defined(MADV_HUGEPAGE)
+		madvise(p, PLH::JitArena::kRegionSize, MADV_HUGEPAGE);
+#else
+		(void) p;
+#endif
+	}
+
+	// Maps the executable view, read/write/execute when fd is -1 and read/execute of the file otherwise
+	void* MapNear(uint64_t address, int fd, bool populate) {
+#if defined(_WIN32)
+		(void) fd;
+		(void) populate;
+		return VirtualAlloc(reinterpret_cast<void*>(address), PLH::JitArena::kRegionSize, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+#else
+		int flags = fd >= 0 ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#if defined(MAP_FIXED_NOREPLACE)
+		flags |= MAP_FIXED_NOREPLACE;
+#endif
+#if defined(MAP_POPULATE)
+		if (populate) {
+			flags |= MAP_POPULATE;
+		}
+#else
+		(void) populate;
+#endif
+		const int protection = fd >= 0 ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE | PROT_EXEC;
+		void* p = mmap(reinterpret_cast<void*>(address), PLH::JitArena::kRegionSize, protection, flags, fd, 0);
+		if (p == MAP_FAILED)
+			return nullptr;
+		Advise(p);
+		return p;
+#endif
+	}
+
+	void* MapWritable(int fd, bool populate) {
+#if defined(_WIN32)
+		(void) fd;
+		(void) populate;
+		return nullptr;
+#else
+		int flags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+		if (populate) {
+			flags |= MAP_POPULATE;
+		}
+#endif
+		void* p = mmap(nullptr, PLH::JitArena::kRegionSize, PROT_READ | PROT_WRITE, flags, fd, 0);
+		if (p == MAP_FAILED)
+			return nullptr;
+		Advise(p);
+		return p;
+#endif
+	}
+
+	void Unmap(void* p) {
+#if defined(_WIN32)
+		VirtualFree(p, 0, MEM_RELEASE);
+#else
+		munmap(p, PLH::JitArena::kRegionSize);
+#endif
+	}
+}
+
+PLH::JitArena::NearScope::NearScope(const void* address) noexcept : NearScope(reinterpret_cast<uint64_t>(address)) {
+}
+
+PLH::JitArena::NearScope::NearScope(uint64_t address) noexcept : m_previous(t_nearHint) {
+	if (address) {
+		t_nearHint = address;
+	}
+}
+
+PLH::JitArena::NearScope::~NearScope() {
+	t_nearHint = m_previous;
+}
+
+PLH::JitArena::HotScope::HotScope() noexcept : m_previous(t_hot) {
+	t_hot = true;
+}
+
+PLH::JitArena::HotScope::~HotScope() {
+	t_hot = m_previous;
+}
+
+PLH::JitArena::JitArena(Mapping mapping) : JitRuntime(GetAllocatorParams(mapping)), m_id(g_nextArenaId.fetch_add(1, std::memory_order_relaxed)), m_mapping(mapping) {
+}
+
+PLH::JitArena::~JitArena() {
+	for (const auto& region : m_regions) {
+		Unmap(reinterpret_cast<void*>(region->base));
+		if (region->writeOffset) {
+			Unmap(reinterpret_cast<void*>(region->base + region->writeOffset));
+		}
+	}
+}
+
+PLH::JitArena::Mapping PLH::JitArena::getDefaultMapping() noexcept {
+	const char* value = std::getenv("POLYHOOK_JIT_DUAL_MAP");
+	return value && value[0] == '1' ? Mapping::Dual : Mapping::Single;
+}
+
+void* PLH::JitArena::getWritable(uint64_t address) {
+	Region* region = findOwner(address);
+	if (!region)
+		return nullptr;
+	return reinterpret_cast<void*>(address + region->writeOffset);
+}
+
+uint64_t PLH::JitArena::getNearHint() noexcept {
+	// without a scope keep code next to the plugin, which every stub calls into
+	return t_nearHint ? t_nearHint : reinterpret_cast<uint64_t>(&JitArena::getNearHint);
+}
+
+bool PLH::JitArena::isNear(uint64_t a, uint64_t b, size_t size) noexcept {
+	return Distance(a, b) < kMaxDistance && Distance(a + size, b) < kMaxDistance;
+}
+
+PLH::JitArena::Statistics PLH::JitArena::getStatistics() const {
+	const auto& fallback = allocator()->statistics();
+
+	std::shared_lock lock(m_mutex);
+	Statistics stats;
+	stats.usedSize = m_used.load(std::memory_order_relaxed) + fallback.usedSize();
+	stats.reservedSize = m_regions.size() * kRegionSize + fallback.reservedSize();
+	stats.regionCount = m_regions.size();
+	stats.hotRegionCount = static_cast<size_t>(std::count_if(m_regions.begin(), m_regions.end(), [](const auto& region) { return region->hot; }));
+	return stats;
+}
+
+size_t PLH::JitArena::reserve(size_t bytes) {
+	const uint64_t hint = getNearHint();
+
+	// page tables are filled before the region is published, the first stubs in it do not fault
+	size_t reserved = 0;
+	while (reserved < bytes && reserveRegion(hint, false, true)) {
+		reserved += kRegionSize;
+	}
+	return reserved;
+}
+
+Error PLH::JitArena::_add(void** dst, CodeHolder* code) noexcept {
+	*dst = nullptr;
+
+	ASMJIT_PROPAGATE(code->flatten());
+	ASMJIT_PROPAGATE(code->resolveUnresolvedLinks());
+
+	const size_t estimatedSize = code->codeSize();
+	if (estimatedSize == 0)
+		return kErrorNoCodeGenerated;
+
+	void* p = allocate(estimatedSize, getNearHint());
+	if (!p)
+		return JitRuntime::_add(dst, code);
+
+	Error err = code->relocateToBase(reinterpret_cast<uint64_t>(p));
+	if (err) {
+		_release(p);
+		return err;
+	}
+
+	const size_t codeSize = code->codeSize();
+	code->copyFlattenedData(getWritable(reinterpret_cast<uint64_t>(p)), codeSize, CopySectionFlags::kPadSectionBuffer);
+	VirtMem::flushInstructionCache(p, codeSize);
+
+	*dst = p;
+	return kErrorOk;
+}
+
+Error PLH::JitArena::_release(void* p) noexcept {
+	const auto address = reinterpret_cast<uint64_t>(p);
+	Region* region = findOwner(address);
+	if (!region)
+		return JitRuntime::_release(p);
+
+	const uint64_t block = address - kHeaderSize;
+	auto* header = reinterpret_cast<BlockHeader*>(block);
+	if (header->magic != kMagic)
+		return kErrorInvalidArgument;
+
+	const size_t size = header->size;
+	std::memset(reinterpret_cast<void*>(block + region->writeOffset), kInt3, size);
+	VirtMem::flushInstructionCache(reinterpret_cast<void*>(block), size);
+
+	std::lock_guard lock(region->mutex);
+	region->free.emplace(size, block);
+	m_used.fetch_sub(size, std::memory_order_relaxed);
+	return kErrorOk;
+}
+
+void* PLH::JitArena::allocate(size_t size, uint64_t hint) {
+	const size_t total = AlignUp(size + kHeaderSize, kGranularity);
+	if (total > kChunkSize)
+		return nullptr;
+
+	uint64_t block = 0;
+	Region* owner = nullptr;
+	if (t_hot) {
+		block = allocateHot(total, hint, owner);
+	} else {
+		auto& cache = t_cache;
+
+		auto* cached = cache.arena == m_id ? static_cast<Region*>(cache.region) : nullptr;
+		if (cached && isNear(cached->base, hint, kRegionSize) && cache.end - cache.cursor >= total) {
+			block = cache.cursor;
+			cache.cursor += total;
+			owner = cached;
+		} else {
+			// hand the rest of the old chunk back before switching
+			if (cached && cache.end > cache.cursor) {
+				std::lock_guard lock(cached->mutex);
+				cached->free.emplace(cache.end - cache.cursor, cache.cursor);
+			}
+			cache = {};
+
+			for (int attempt = 0; attempt < 2 && !block; ++attempt) {
+				Region* region = attempt == 0 ? findRegion(hint, false) : reserveRegion(hint, false);
+				if (!region)
+					continue;
+
+				std::lock_guard lock(region->mutex);
+
+				// reuse released code before growing
+				block = reuse(*region, total, total * 2);
+				if (block) {
+					owner = region;
+					break;
+				}
+
+				const uint64_t limit = region->base + kRegionSize;
+				const size_t chunk = std::min<size_t>(kChunkSize, limit - region->bump);
+				if (chunk < total)
+					continue;
+
+				cache = {m_id, region, region->bump + total, region->bump + chunk};
+				block = region->bump;
+				region->bump += chunk;
+				owner = region;
+			}
+		}
+	}
+
+	if (!block)
+		return nullptr;
+
+	auto* header = reinterpret_cast<BlockHeader*>(block + owner->writeOffset);
+	header->size = total;
+	header->magic = kMagic;
+	m_used.fetch_add(total, std::memory_order_relaxed);
+	return reinterpret_cast<void*>(block + kHeaderSize);
+}
+
+uint64_t PLH::JitArena::allocateHot(size_t size, uint64_t hint, Region*& owner) {
+	for (int attempt = 0; attempt < 2; ++attempt) {
+		Region* region = attempt == 0 ? findRegion(hint, true) : reserveRegion(hint, true);
+		if (!region)
+			continue;
+
+		std::lock_guard lock(region->mutex);
+
+		owner = region;
+
+		// no per-thread chunks here, consecutive allocations have to stay adjacent
+		if (region->base + kRegionSize - region->bump >= size) {
+			const uint64_t block = region->bump;
+			region->bump += size;
+			return block;
+		}
+
+		// full, fill the holes left by stubs retired from earlier passes
+		if (uint64_t block = reuse(*region, size, SIZE_MAX))
+			return block;
+	}
+	return 0;
+}
+
+uint64_t PLH::JitArena::reuse(Region& region, size_t size, size_t maxSize) {
+	auto it = region.free.lower_bound(size);
+	if (it == region.free.end() || it->first >= maxSize)
+		return 0;
+
+	const uint64_t block = it->second;
+	const size_t remaining = it->first - size;
+	region.free.erase(it);
+	if (remaining >= kGranularity * 4) {
+		region.free.emplace(remaining, block + size);
+	}
+	return block;
+}
+
+PLH::JitArena::Region* PLH::JitArena::findRegion(uint64_t hint, bool hot) {
+	std::shared_lock lock(m_mutex);
+
+	// prefer the closest region which still has room for a chunk or reusable blocks
+	Region* best = nullptr;
+	for (const auto& region : m_regions) {
+		if (region->hot != hot || !isNear(region->base, hint, kRegionSize))
+			continue;
+		std::lock_guard regionLock(region->mutex);
+		if (region->base + kRegionSize - region->bump < kChunkSize && region->free.empty())
+			continue;
+		if (!best || Distance(region->base, hint) < Distance(best->base, hint)) {
+			best = region.get();
+		}
+	}
+	return best;
+}
+
+PLH::JitArena::Region* PLH::JitArena::findOwner(uint64_t address) {
+	std::shared_lock lock(m_mutex);
+	for (const auto& region : m_regions) {
+		if (address >= region->base && address < region->base + kRegionSize)
+			return region.get();
+	}
+	return nullptr;
+}
+
+PLH::JitArena::Region* PLH::JitArena::reserveRegion(uint64_t hint, bool hot, bool populate) {
+	const uint64_t origin = hint & ~static_cast<uint64_t>(kRegionSize - 1);
+
+	// without a file there is nothing to map a second view of, never fall back to read/write/execute
+	int fd = -1;
+	if (m_mapping == Mapping::Dual) {
+		fd = CreateCodeFile();
+		if (fd < 0)
+			return nullptr;
+	}
+
+	Region* result = nullptr;
+
+	// walk outwards from the target one region at a time, below first since modules usually have their data above
+	for (int64_t step = 1; step <= kMaxSteps && !result; ++step) {
+		for (int64_t direction : {-1, 1}) {
+			const int64_t offset = direction * step * static_cast<int64_t>(kRegionSize);
+			if (offset < 0 && origin < static_cast<uint64_t>(-offset))
+				continue;
+
+			const uint64_t candidate = origin + static_cast<uint64_t>(offset);
+			void* p = MapNear(candidate, fd, populate);
+			if (!p)
+				continue;
+
+			const auto base = reinterpret_cast<uint64_t>(p);
+			if (!isNear(base, hint, kRegionSize)) {
+				Unmap(p);
+				continue;
+			}
+
+			auto region = std::make_unique<Region>();
+			region->base = base;
+			region->bump = base;
+			region->hot = hot;
+
+			if (fd >= 0) {
+				void* writable = MapWritable(fd, populate);
+				if (!writable) {
+					Unmap(p);
+					CloseCodeFile(fd);
+					return nullptr;
+				}
+				region->writeOffset = static_cast<intptr_t>(reinterpret_cast<uint64_t>(writable) - base);
+			}
+
+			std::unique_lock lock(m_mutex);
+			result = m_regions.emplace_back(std::move(region)).get();
+			break;
+		}
+	}
+
+	// the mappings keep the file alive
+	CloseCodeFile(fd);
+	return result;
+}
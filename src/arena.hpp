@@ -0,0 +1,120 @@
+#pragma once
+
+#pragma warning(push, 0)
+#include <asmjit/asmjit.h>
+#pragma warning( pop )
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+namespace PLH {
+	/**
+	 * JitRuntime which places code in regions reserved within rel32 range of the code being hooked.
+	 *
+	 * The placement target is taken from the innermost NearScope on the calling thread, or the plugin
+	 * itself when there is none, so stubs stay reachable from their target and the plugin callbacks
+	 * they call. Regions are backed by transparent huge pages where the kernel allows it.
+	 * Every thread carves allocations out of its own chunk, the region lock is only taken to refill
+	 * the chunk or to release code. Anything the arena cannot place falls back to the asmjit allocator.
+	 *
+	 * With Mapping::Dual (POLYHOOK_JIT_DUAL_MAP=1, Linux only) a region is a memfd mapped twice, read/execute
+	 * near the target and read/write anywhere. Code is written through getWritable(), so emitting and
+	 * patching never changes page protection and no page is writable and executable at the same time.
+	 */
+	class JitArena final : public asmjit::JitRuntime {
+	public:
+		static constexpr size_t kRegionSize = 2 * 1024 * 1024;
+		static constexpr size_t kChunkSize = 64 * 1024;
+		static constexpr size_t kGranularity = 16;
+
+		enum class Mapping : uint8_t {
+			Single, ///< one read/write/execute view
+			Dual    ///< separate read/execute and read/write views of the same memory
+		};
+
+		/** Makes code emitted on this thread land near the given address until the scope ends. */
+		class NearScope {
+		public:
+			explicit NearScope(const void* address) noexcept;
+			explicit NearScope(uint64_t address) noexcept;
+			~NearScope();
+			NearScope(const NearScope&) = delete;
+			NearScope& operator=(const NearScope&) = delete;
+
+		private:
+			uint64_t m_previous;
+		};
+
+		/**
+		 * Places code emitted on this thread in hot regions until the scope ends. Hot regions are never
+		 * shared with regular allocations and are filled front to back, so stubs emitted in one scope end
+		 * up next to each other.
+		 */
+		class HotScope {
+		public:
+			HotScope() noexcept;
+			~HotScope();
+			HotScope(const HotScope&) = delete;
+			HotScope& operator=(const HotScope&) = delete;
+
+		private:
+			bool m_previous;
+		};
+
+		struct Statistics {
+			size_t usedSize = 0;      ///< bytes handed out by the arena and the fallback allocator
+			size_t reservedSize = 0;  ///< bytes reserved by both
+			size_t regionCount = 0;
+			size_t hotRegionCount = 0;
+		};
+
+		explicit JitArena(Mapping mapping = getDefaultMapping());
+		~JitArena() override;
+
+		static Mapping getDefaultMapping() noexcept;
+		Mapping getMapping() const noexcept { return m_mapping; }
+
+		/** Address to write the arena code at address through, nullptr when the code is not owned by the arena. */
+		void* getWritable(uint64_t address);
+
+		static uint64_t getNearHint() noexcept;
+		static bool isNear(uint64_t a, uint64_t b, size_t size = 0) noexcept;
+
+		Statistics getStatistics() const;
+
+		/** Reserves and prefaults regions near the current hint until at least bytes are available, returns the bytes reserved. */
+		size_t reserve(size_t bytes);
+
+		asmjit::Error _add(void** dst, asmjit::CodeHolder* code) noexcept override;
+		asmjit::Error _release(void* p) noexcept override;
+
+	private:
+		struct Region {
+			uint64_t base = 0;
+			uint64_t bump = 0;
+			bool hot = false;
+			intptr_t writeOffset = 0; ///< read/write view minus read/execute view
+			std::mutex mutex;
+			std::multimap<size_t, uint64_t> free;
+		};
+
+		void* allocate(size_t size, uint64_t hint);
+		uint64_t allocateHot(size_t size, uint64_t hint, Region*& owner);
+		static uint64_t reuse(Region& region, size_t size, size_t maxSize);
+		Region* findRegion(uint64_t hint, bool hot);
+		Region* findOwner(uint64_t address);
+		Region* reserveRegion(uint64_t hint, bool hot, bool populate = false);
+
+		const uint64_t m_id;
+		const Mapping m_mapping;
+		mutable std::shared_mutex m_mutex;
+		std::vector<std::unique_ptr<Region>> m_regions;
+		std::atomic<size_t> m_used = 0;
+	};
+}
@@ -1,4 +1,11 @@
 #include "callback.hpp"
+#include "arena.hpp"
+#include "replay.hpp"
+#include "signature.hpp"
+#include "slab.hpp"
+#include "stubcache.hpp"
+#include "symbols.hpp"
+#include "tier.hpp"
 
 #include <thread>
 #include <immintrin.h>
@@ -42,44 +49,6 @@ bool PLH::Callback::hasHiArgSlot(const x86::Compiler& compiler, const TypeId typ
 	}
 }
 
-template<typename T>
-constexpr TypeId getTypeIdx() noexcept {
-	return static_cast<TypeId>(TypeUtils::TypeIdOfT<T>::kTypeId);
-}
-
-TypeId PLH::Callback::getTypeId(const DataType type) noexcept {
-	switch (type) {
-		case DataType::Void:
-			return getTypeIdx<void>();
-		case DataType::Bool:
-			return getTypeIdx<bool>();
-		case DataType::Int8:
-			return getTypeIdx<int8_t>();
-		case DataType::Int16:
-			return getTypeIdx<int16_t>();
-		case DataType::Int32:
-			return getTypeIdx<int32_t>();
-		case DataType::Int64:
-			return getTypeIdx<int64_t>();
-		case DataType::UInt8:
-			return getTypeIdx<uint8_t>();
-		case DataType::UInt16:
-			return getTypeIdx<uint16_t>();
-		case DataType::UInt32:
-			return getTypeIdx<uint32_t>();
-		case DataType::UInt64:
-			return getTypeIdx<uint64_t>();
-		case DataType::Float:
-			return getTypeIdx<float>();
-		case DataType::Double:
-			return getTypeIdx<double>();
-		case DataType::Pointer:
-		case DataType::String:
-			return TypeId::kUIntPtr;
-	}
-	return TypeId::kVoid;
-}
-
 uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry pre, const CallbackEntry post) {
 	if (m_functionPtr) {
 		return m_functionPtr;
@@ -91,9 +60,66 @@ uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry
 		return 0;
 	}
 
-	SimpleErrorHandler eh;
+	// stubs only differ in the constants they load, compile once per signature and patch copies
+	std::shared_ptr<const StubTemplate> stub = m_signature ? StubCache::instance().find(m_signature->text) : nullptr;
+	if (!stub) {
+		stub = compileStub(*rt, sig);
+		if (!stub)
+			return 0;
+		if (m_signature) {
+			StubCache::instance().store(m_signature->text, stub);
+		}
+	}
+
+	StubTemplate::Values values{};
+	values[StubTemplate::kCallback] = reinterpret_cast<uintptr_t>(this);
+	values[StubTemplate::kCalls] = reinterpret_cast<uintptr_t>(&m_calls);
+	values[StubTemplate::kTrampoline] = reinterpret_cast<uintptr_t>(getTrampolineHolder());
+	values[StubTemplate::kPre] = reinterpret_cast<uintptr_t>(pre);
+	values[StubTemplate::kPost] = reinterpret_cast<uintptr_t>(post);
+	const std::vector<uint8_t> bytes = stub->instantiate(values);
+
 	CodeHolder code;
 	code.init(rt->environment(), rt->cpuFeatures());
+	x86::Assembler a(&code);
+	a.embed(bytes.data(), bytes.size());
+
+	if (rt->add(&m_functionPtr, &code) != kErrorOk) {
+		m_functionPtr = 0;
+		m_errorCode = "Failed to allocate JIT stub";
+		return 0;
+	}
+
+	m_functionSize = bytes.size();
+	JitSymbols::add(m_functionPtr, m_functionSize, m_name.empty() ? "polyhook::stub" : m_name);
+
+	// describe the prologue asmjit emitted, works for both frame pointer and frame-pointer-less stubs
+	m_unwind.registerFrame(stub->layout, m_functionPtr, m_functionSize);
+
+	return m_functionPtr;
+}
+
+bool PLH::Callback::precompile(const std::shared_ptr<JitRuntime>& rt, const Signature* signature) {
+	if (!rt || !signature)
+		return false;
+
+	if (StubCache::instance().find(signature->text))
+		return true;
+
+	// the template does not depend on the callback, any instance can compile it
+	Callback callback(rt);
+	auto stub = callback.compileStub(*rt, signature->funcSignature);
+	if (!stub)
+		return false;
+
+	StubCache::instance().store(signature->text, std::move(stub));
+	return true;
+}
+
+std::shared_ptr<PLH::StubTemplate> PLH::Callback::compileStub(const JitRuntime& rt, const FuncSignature& sig) {
+	SimpleErrorHandler eh;
+	CodeHolder code;
+	code.init(rt.environment(), rt.cpuFeatures());
 	code.setErrorHandler(&eh);
 
 	// initialize function
@@ -115,6 +141,11 @@ uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry
 	func->frame().resetPreservedFP();
 #endif
 
+	// counts every call, sampled by the hot stub layout
+	x86::Gp calls = cc.newUIntPtr("calls");
+	cc.mov(calls, StubTemplate::placeholder(StubTemplate::kCalls));
+	cc.lock().add(x86::ptr(calls, 0, sizeof(size_t)), 1);
+
 	// Create labels
 	Label supercede = cc.newLabel();
 	Label noPost = cc.newLabel();
@@ -139,7 +170,7 @@ uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry
 			argSlot.low = cc.newXmm();
 		} else {
 			m_errorCode = "Parameters wider than 64bits not supported";
-			return 0;
+			return nullptr;
 		}
 
 		func->setArg(argSlot.argIdx, 0, argSlot.low);
@@ -190,7 +221,7 @@ uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry
 			cc.movq(argsStackIdx, argSlot.low.as<x86::Xmm>());
 		} else {
 			m_errorCode = "Parameters wider than 64bits not supported";
-			return 0;
+			return nullptr;
 		}
 
 		// next structure slot (+= sizeof(uint64_t))
@@ -202,7 +233,7 @@ uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry
 
 	// get pointer to callback and pass it to the user callback
 	x86::Gp argCallback = cc.newUIntPtr("argCallback");
-	cc.mov(argCallback, this);
+	cc.mov(argCallback, StubTemplate::placeholder(StubTemplate::kCallback));
 
 	// get pointer to stack structure and pass it to the user callback
 	x86::Gp argStruct = cc.newUIntPtr("argStruct");
@@ -228,7 +259,9 @@ uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry
 	InvokeNode* invokePreNode;
 
 	// Call pre callback
-	cc.invoke(&invokePreNode, (uint64_t)pre, callbackSig);
+	x86::Gp preFunc = cc.newUIntPtr("preFunc");
+	cc.mov(preFunc, StubTemplate::placeholder(StubTemplate::kPre));
+	cc.invoke(&invokePreNode, preFunc, callbackSig);
 
 	// call to user provided function (use ABI of host compiler)
 	invokePreNode->setArg(0, argCallback);
@@ -260,7 +293,7 @@ uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry
 			cc.movq(argSlot.low.as<x86::Xmm>(), argsStackIdx);
 		} else {
 			m_errorCode = "Parameters wider than 64bits not supported";
-			return 0;
+			return nullptr;
 		}
 
 		// next structure slot (+= sizeof(uint64_t))
@@ -270,7 +303,7 @@ uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry
 
 	// deref the trampoline ptr (holder must live longer, must be concrete reg since push later)
 	x86::Gp origPtr = cc.zbx();
-	cc.mov(origPtr, (uint64_t) getTrampolineHolder());
+	cc.mov(origPtr, StubTemplate::placeholder(StubTemplate::kTrampoline));
 	cc.mov(origPtr, ptr(origPtr));
 
 	InvokeNode* origInvokeNode;
@@ -311,7 +344,9 @@ uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry
 	InvokeNode* invokePostNode;
 
 	// Call post callback
-	cc.invoke(&invokePostNode, (uint64_t)post, callbackSig);
+	x86::Gp postFunc = cc.newUIntPtr("postFunc");
+	cc.mov(postFunc, StubTemplate::placeholder(StubTemplate::kPost));
+	cc.invoke(&invokePostNode, postFunc, callbackSig);
 
 	// call to user provided function (use ABI of host compiler)
 	invokePostNode->setArg(0, argCallback);
@@ -338,7 +373,7 @@ uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry
 			cc.movq(argSlot.low.as<x86::Xmm>(), argsStackIdx);
 		} else {
 			m_errorCode = "Parameters wider than 64bits not supported";
-			return 0;
+			return nullptr;
 		}
 
 		// next structure slot (+= sizeof(uint64_t))
@@ -368,27 +403,197 @@ uint64_t PLH::Callback::getJitFunc(const FuncSignature& sig, const CallbackEntry
 
 	cc.finalize();
 
-	rt->add(&m_functionPtr, &code);
-
 	if (eh.error) {
-		m_functionPtr = 0;
 		m_errorCode = eh.code;
-		return 0;
+		return nullptr;
+	}
+
+	// anything left to relocate would tie the code to one address
+	if (code.flatten() != kErrorOk || code.resolveUnresolvedLinks() != kErrorOk || !code.relocEntries().empty()) {
+		m_errorCode = "JIT stub is not position independent";
+		return nullptr;
+	}
+
+	auto stub = std::make_shared<StubTemplate>();
+	stub->code.resize(code.codeSize());
+	code.copyFlattenedData(stub->code.data(), stub->code.size(), CopySectionFlags::kPadSectionBuffer);
+	stub->layout = FrameLayout::from(func->frame());
+
+	if (!stub->locate()) {
+		m_errorCode = "Failed to locate JIT stub constants";
+		return nullptr;
 	}
 
 #if 0
 	Log::log("JIT Stub:\n" + std::string(log.data()), ErrorLevel::INFO);
 #endif
 
-	return m_functionPtr;
+	return stub;
+}
+
+uint64_t PLH::Callback::getJitFunc(const Signature* signature, const CallbackEntry pre, const CallbackEntry post) {
+	if (!signature) {
+		m_errorCode = "Invalid signature";
+		return 0;
+	}
+	m_signature = signature;
+	return getJitFunc(signature->funcSignature, pre, post);
 }
 
 uint64_t PLH::Callback::getJitFunc(const DataType retType, std::span<const DataType> paramTypes, const CallbackEntry pre, const CallbackEntry post, uint8_t vaIndex) {
-	FuncSignature sig(CallConvId::kCDecl, vaIndex, getTypeId(retType));
-	for (const DataType& type : paramTypes) {
-		sig.addArg(getTypeId(type));
+	return getJitFunc(SignatureTable::instance().intern(retType, paramTypes, vaIndex), pre, post);
+}
+
+uint64_t PLH::Callback::getTieredFunc(const Signature* signature, const CallbackEntry pre, const CallbackEntry post, const std::shared_ptr<TieredCompiler>& tier) {
+	if (!tier || !TieredCompiler::isSupported(signature))
+		return getJitFunc(signature, pre, post);
+
+	if (m_thunkPtr) {
+		return m_thunkPtr;
+	}
+
+	m_signature = signature;
+	m_pre = pre;
+	m_post = post;
+	m_entryTarget.store(tier->getGenericStub(), std::memory_order_relaxed);
+
+	if (reinterpret_cast<uintptr_t>(&m_entryTarget) != reinterpret_cast<uintptr_t>(this))
+		return getJitFunc(signature, pre, post);
+
+	m_thunkPtr = tier->createThunk(this);
+	if (!m_thunkPtr) {
+		m_errorCode = "Failed to allocate entry thunk";
+		return 0;
+	}
+
+	m_tier = tier;
+	m_nearHint = JitArena::getNearHint();
+	m_promoteAfter = tier->getThreshold();
+	if (m_promoteAfter == 0) {
+		tier->enqueue(this);
+	}
+
+	return m_thunkPtr;
+}
+
+bool PLH::Callback::promote() {
+	if (!m_signature || !m_pre || !m_post)
+		return false;
+
+	// compiled on the worker thread, place it where the hook would have put it
+	JitArena::NearScope near(m_nearHint);
+
+	// the stub fields are read by other threads, publish them under the lock the handlers take as well
+	std::unique_lock lock(m_mutex);
+	uint64_t function = getJitFunc(m_signature->funcSignature, m_pre, m_post);
+	if (!function)
+		return false;
+
+	m_entryTarget.store(function, std::memory_order_release);
+	return true;
+}
+
+bool PLH::Callback::isPromoted() const noexcept {
+	// m_functionPtr is written by the worker, only trust it once the entry target moved off the generic stub
+	auto tier = m_tier.lock();
+	return tier && m_entryTarget.load(std::memory_order_acquire) != tier->getGenericStub();
+}
+
+bool PLH::Callback::relocate() {
+	// moved once at most, so a hook holds no more than one old copy and frees it with the hook
+	if (m_retired || !isPromoted())
+		return false;
+
+	JitArena::NearScope near(m_nearHint);
+
+	std::unique_lock lock(m_mutex);
+	const uint64_t previous = m_functionPtr;
+	const size_t previousSize = m_functionSize;
+
+	// the old copy keeps its unwind registration until it is released
+	UnwindInfo unwind;
+	unwind.swap(m_unwind);
+
+	m_functionPtr = 0;
+	if (!getJitFunc(m_signature->funcSignature, m_pre, m_post)) {
+		m_functionPtr = previous;
+		m_functionSize = previousSize;
+		m_unwind.swap(unwind);
+		return false;
+	}
+
+	m_entryTarget.store(m_functionPtr, std::memory_order_release);
+	m_retired = std::make_unique<RetiredStub>(m_rt, previous, unwind);
+	return true;
+}
+
+namespace {
+	bool IsFloat(PLH::DataType type) noexcept {
+		return type == PLH::DataType::Float || type == PLH::DataType::Double;
+	}
+
+	// Locates where the caller placed an argument, following the x64 calling convention of the host
+	uint64_t* GetArgumentSlot(PLH::GenericFrame* frame, size_t index, bool isFloat, size_t& gp, size_t& xmm, size_t& stack) noexcept {
+#if defined(_WIN32)
+		(void) gp;
+		(void) xmm;
+		if (index < PLH::GenericFrame::kGpArgs)
+			return isFloat ? &frame->xmm[index] : &frame->gp[index];
+		return &frame->stack[stack++];
+#else
+		(void) index;
+		if (isFloat)
+			return xmm < PLH::GenericFrame::kXmmArgs ? &frame->xmm[xmm++] : &frame->stack[stack++];
+		return gp < PLH::GenericFrame::kGpArgs ? &frame->gp[gp++] : &frame->stack[stack++];
+#endif
+	}
+}
+
+bool PLH::Callback::genericEnter(GenericFrame* frame) {
+	Callback* callback = frame->callback;
+	const auto& arguments = callback->m_signature->arguments;
+
+	const size_t calls = callback->m_calls.fetch_add(1, std::memory_order_relaxed) + 1;
+	if (callback->m_promoteAfter != TieredCompiler::kNeverPromote && calls == callback->m_promoteAfter) {
+		if (auto tier = callback->m_tier.lock()) {
+			tier->enqueue(callback);
+		}
+	}
+
+	size_t gp = 0, xmm = 0, stack = 0;
+	for (size_t i = 0; i < arguments.size(); ++i) {
+		frame->args[i] = *GetArgumentSlot(frame, i, IsFloat(arguments[i]), gp, xmm, stack);
+	}
+
+	frame->ret = 0;
+	frame->flag = ReturnFlag::Default;
+	callback->m_pre(callback, reinterpret_cast<Parameters*>(frame->args), arguments.size(), reinterpret_cast<Return*>(&frame->ret), &frame->flag);
+
+	if (frame->flag & ReturnFlag::Supercede)
+		return true;
+
+	gp = 0, xmm = 0, stack = 0;
+	for (size_t i = 0; i < arguments.size(); ++i) {
+		*GetArgumentSlot(frame, i, IsFloat(arguments[i]), gp, xmm, stack) = frame->args[i];
+	}
+
+	frame->stackSlots = stack;
+	frame->original = *callback->getTrampolineHolder();
+	return false;
+}
+
+void PLH::Callback::genericLeave(GenericFrame* frame) {
+	Callback* callback = frame->callback;
+	const Signature* signature = callback->m_signature;
+
+	// the original ran, pick its return value out of the right register
+	if (!(frame->flag & ReturnFlag::Supercede) && IsFloat(signature->returnType)) {
+		frame->ret = frame->retXmm;
+	}
+
+	if (!(frame->flag & ReturnFlag::NoPost)) {
+		callback->m_post(callback, reinterpret_cast<Parameters*>(frame->args), signature->arguments.size(), reinterpret_cast<Return*>(&frame->ret), &frame->flag);
 	}
-	return getJitFunc(sig, pre, post);
 }
 
 bool PLH::Callback::addCallback(const CallbackType type, const CallbackHandler callback) {
@@ -450,7 +655,40 @@ bool PLH::Callback::areCallbacksRegistered() const noexcept {
 }
 
 PLH::Callback::Callbacks PLH::Callback::getCallbacks(const CallbackType type) noexcept {
-	return { m_callbacks[static_cast<size_t>(type)], std::shared_lock(m_mutex) };
+	// only a contended lock is timed, the common case stays a single atomic
+	std::shared_lock lock(m_mutex, std::try_to_lock);
+	if (!lock.owns_lock()) {
+		const uint64_t start = Metrics::now();
+		lock.lock();
+		m_lockWait.fetch_add(Metrics::now() - start, std::memory_order_relaxed);
+	}
+	return { m_callbacks[static_cast<size_t>(type)], std::move(lock) };
+}
+
+size_t PLH::Callback::getCallbackCount(const CallbackType type) const {
+	std::shared_lock lock(m_mutex);
+	return m_callbacks[static_cast<size_t>(type)].size();
+}
+
+PLH::LatencyHistogram& PLH::Callback::getLatency() noexcept {
+	return m_latency;
+}
+
+uint64_t PLH::Callback::getLockWait() const noexcept {
+	return m_lockWait.load(std::memory_order_relaxed);
+}
+
+size_t PLH::Callback::getStorageBytes() const {
+	std::lock_guard lock(m_storageMutex);
+	size_t bytes = 0;
+	if (m_storage) {
+		for (const auto& [_, strings] : *m_storage) {
+			for (const auto& str : strings) {
+				bytes += str.capacity();
+			}
+		}
+	}
+	return bytes;
 }
 
 uint64_t* PLH::Callback::getTrampolineHolder() noexcept {
@@ -461,12 +699,73 @@ uint64_t* PLH::Callback::getFunctionHolder() noexcept {
 	return &m_functionPtr;
 }
 
+uint64_t PLH::Callback::getEntryAddress() const noexcept {
+	return m_thunkPtr ? m_thunkPtr : m_functionPtr;
+}
+
+size_t PLH::Callback::getFunctionSize() const noexcept {
+	std::shared_lock lock(m_mutex);
+	return m_functionSize;
+}
+
+const PLH::Signature* PLH::Callback::getSignature() const noexcept {
+	return m_signature;
+}
+
+uint64_t PLH::Callback::getId() const noexcept {
+	return m_id;
+}
+
+size_t PLH::Callback::getCallCount() const noexcept {
+	return m_calls.load(std::memory_order_relaxed);
+}
+
+size_t PLH::Callback::sampleCalls() noexcept {
+	const size_t calls = getCallCount();
+	const size_t delta = calls - m_sampledCalls;
+	m_sampledCalls = calls;
+	return delta;
+}
+
+void PLH::Callback::setName(std::string name) {
+	m_name = std::move(name);
+}
+
+const std::string& PLH::Callback::getName() const noexcept {
+	return m_name;
+}
+
+void PLH::Callback::setTraced(bool traced) noexcept {
+	m_traced.store(traced, std::memory_order_relaxed);
+}
+
+bool PLH::Callback::isTraced() const noexcept {
+	return m_traced.load(std::memory_order_relaxed);
+}
+
+PLH::CallRecorder* PLH::Callback::getRecorder() const noexcept {
+	return m_recorder.load(std::memory_order_acquire);
+}
+
+PLH::CallRecorder& PLH::Callback::makeRecorder() {
+	std::unique_lock lock(m_mutex);
+	CallRecorder* recorder = m_recorder.load(std::memory_order_relaxed);
+	if (!recorder) {
+		recorder = new CallRecorder(m_signature);
+		m_recorder.store(recorder, std::memory_order_release);
+	}
+	return *recorder;
+}
+
 std::string_view PLH::Callback::getError() const noexcept {
+	// the tier worker may be promoting the hook right after it was installed
+	std::shared_lock lock(m_mutex);
 	return !m_functionPtr && m_errorCode ? m_errorCode : "";
 }
 
 const std::string& PLH::Callback::store(std::string_view str) {
-	std::unique_lock lock(m_mutex);
+	// handlers call this while the dispatch holds m_mutex shared, it must not take that one
+	std::lock_guard lock(m_storageMutex);
 	if (!m_storage) {
 		m_storage = std::make_unique<std::unordered_map<std::thread::id, std::deque<std::string>>>();
 	}
@@ -475,18 +774,69 @@ const std::string& PLH::Callback::store(std::string_view str) {
 
 void PLH::Callback::cleanup() {
 	if (m_storage) {
-		std::unique_lock lock(m_mutex);
+		std::lock_guard lock(m_storageMutex);
 		(*m_storage)[std::this_thread::get_id()].clear();
 	}
 }
 
-PLH::Callback::Callback(std::weak_ptr<JitRuntime> rt) : m_rt(std::move(rt)) {
+namespace {
+	PLH::Slab& GetCallbackSlab() {
+		// leaked, callbacks may still be released from static destructors
+		static auto* slab = new PLH::Slab(sizeof(PLH::Callback), alignof(PLH::Callback));
+		return *slab;
+	}
+
+	std::atomic<uint64_t> g_nextId = 1;
+}
+
+void* PLH::Callback::operator new(size_t size) {
+	if (size != sizeof(Callback))
+		return ::operator new(size, std::align_val_t{alignof(Callback)});
+	return GetCallbackSlab().allocate();
+}
+
+void PLH::Callback::operator delete(void* p, size_t size) noexcept {
+	if (size != sizeof(Callback)) {
+		::operator delete(p, std::align_val_t{alignof(Callback)});
+		return;
+	}
+	GetCallbackSlab().deallocate(p);
+}
+
+size_t PLH::Callback::getSlabReservedBytes() {
+	return GetCallbackSlab().getReservedBytes();
+}
+
+PLH::Callback::Callback(std::weak_ptr<JitRuntime> rt) : m_rt(std::move(rt)), m_id(g_nextId.fetch_add(1, std::memory_order_relaxed)) {
 }
 
 PLH::Callback::~Callback() {
+	if (auto tier = m_tier.lock()) {
+		tier->cancel(this);
+		if (m_thunkPtr) {
+			tier->releaseThunk(m_thunkPtr);
+		}
+	}
+
 	if (auto rt = m_rt.lock()) {
 		if (m_functionPtr) {
+			JitSymbols::remove(m_functionPtr);
+			m_unwind.deregisterFrame();
 			rt->release(m_functionPtr);
 		}
 	}
+
+	delete m_recorder.load(std::memory_order_relaxed);
+}
+
+PLH::RetiredStub::RetiredStub(std::weak_ptr<JitRuntime> rt, uint64_t function, UnwindInfo& unwind) noexcept : m_rt(std::move(rt)), m_function(function) {
+	m_unwind.swap(unwind);
+}
+
+PLH::RetiredStub::~RetiredStub() {
+	if (auto rt = m_rt.lock()) {
+		JitSymbols::remove(m_function);
+		m_unwind.deregisterFrame();
+		rt->release(m_function);
+	}
 }
\ No newline at end of file
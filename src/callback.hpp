@@ -10,13 +10,18 @@
 #include "polyhook2/MemAccessor.hpp"
 #include "polyhook2/PolyHookOs.hpp"
 
+#include "metrics.hpp"
+#include "unwind.hpp"
+
 #include <array>
 #include <vector>
 #include <string>
 #include <span>
 #include <shared_mutex>
+#include <mutex>
 #include <atomic>
 #include <map>
+#include <memory>
 #include <deque>
 #include <thread>
 
@@ -39,6 +44,13 @@ namespace PLH {
 		// TODO: Add support of POD types
 	};
 
+	struct Signature;
+	struct GenericFrame;
+	class TieredCompiler;
+	class RetiredStub;
+	struct StubTemplate;
+	class CallRecorder;
+
 	enum class ReturnAction : int32_t {
 		Ignored,  ///< Handler didn't take any action
 		Handled,  ///< We did something, but real function should still be called
@@ -55,6 +67,9 @@ namespace PLH {
 		Default = 0, ///< Value means this gives no information about return flag.
 		NoPost = 1,
 		Supercede = 2,
+		TreeFrame = 4, ///< Pre entry opened a call tree frame, post entry must close it
+		TimelineFrame = 8, ///< Pre entry wrote a timeline begin event, post entry must write the end
+		LatencySample = 16, ///< Pre entry started timing the call, post entry adds it to the hook's latency histogram
 	};
 
 	class Callback {
@@ -101,17 +116,51 @@ namespace PLH {
 		typedef ReturnAction (*CallbackHandler)(Callback* callback, const Parameters* params, int32_t count, const Return* ret, CallbackType type);
 		using Callbacks = std::pair<std::vector<CallbackHandler>&, std::shared_lock<std::shared_mutex>>;
 
+		static constexpr size_t kCacheLine = 64;
+
 		explicit Callback(std::weak_ptr<asmjit::JitRuntime> rt);
 		~Callback();
 
+		// callbacks are packed into a Slab instead of being spread over the heap
+		static void* operator new(size_t size);
+		static void operator delete(void* p, size_t size) noexcept;
+		static size_t getSlabReservedBytes();
+
 		uint64_t getJitFunc(const asmjit::FuncSignature& sig, CallbackEntry pre, CallbackEntry post);
+		uint64_t getJitFunc(const Signature* signature, CallbackEntry pre, CallbackEntry post);
 		uint64_t getJitFunc(DataType retType, std::span<const DataType> paramTypes, CallbackEntry pre, CallbackEntry post, uint8_t vaIndex);
+		uint64_t getTieredFunc(const Signature* signature, CallbackEntry pre, CallbackEntry post, const std::shared_ptr<TieredCompiler>& tier);
+		bool promote();
+		bool isPromoted() const noexcept;
+		static bool precompile(const std::shared_ptr<asmjit::JitRuntime>& rt, const Signature* signature);
+		bool relocate();
+
+		static bool genericEnter(GenericFrame* frame);
+		static void genericLeave(GenericFrame* frame);
 
 		uint64_t* getTrampolineHolder() noexcept;
 		uint64_t* getFunctionHolder() noexcept;
+		uint64_t getEntryAddress() const noexcept;
+		size_t getFunctionSize() const noexcept;
+		const Signature* getSignature() const noexcept;
+		/// unique for the process lifetime, unlike the address which the slab hands out again
+		uint64_t getId() const noexcept;
+		size_t getCallCount() const noexcept;
+		size_t sampleCalls() noexcept;
 		Callbacks getCallbacks(CallbackType type) noexcept;
 		std::string_view getError() const noexcept;
 
+		void setName(std::string name);
+		const std::string& getName() const noexcept;
+
+		// calls of traced callbacks are recorded into the TraceBuffer by the plugin's post entry
+		void setTraced(bool traced) noexcept;
+		bool isTraced() const noexcept;
+
+		// calls are written to the recorder by the plugin's post entry while it is open, created on first use
+		CallRecorder* getRecorder() const noexcept;
+		CallRecorder& makeRecorder();
+
 		const std::string& store(std::string_view str);
 		void cleanup();
 
@@ -120,21 +169,68 @@ namespace PLH {
 		bool isCallbackRegistered(CallbackType type, CallbackHandler callback) const noexcept;
 		bool areCallbacksRegistered(CallbackType type) const noexcept;
 		bool areCallbacksRegistered() const noexcept;
+		size_t getCallbackCount(CallbackType type) const;
+
+		// sampled by the plugin's entries while metrics are enabled
+		LatencyHistogram& getLatency() noexcept;
+		/// nanoseconds calls spent waiting for the handler lock
+		uint64_t getLockWait() const noexcept;
+		size_t getStorageBytes() const;
 
 	private:
-		static asmjit::TypeId getTypeId(DataType type) noexcept;
 		static bool hasHiArgSlot(const asmjit::x86::Compiler& compiler, const asmjit::TypeId typeId) noexcept;
-
+		std::shared_ptr<StubTemplate> compileStub(const asmjit::JitRuntime& rt, const asmjit::FuncSignature& sig);
+
+		// first line, only read by a call
+		// must stay the first member, pooled entry thunks jump through [this]
+		std::atomic<uint64_t> m_entryTarget = 0;
+		uint64_t m_trampolinePtr = 0;
+		const Signature* m_signature = nullptr;
+		CallbackEntry m_pre = nullptr;
+		CallbackEntry m_post = nullptr;
+		uint32_t m_promoteAfter = 0;
+		std::atomic<bool> m_traced = false;
+		std::atomic<CallRecorder*> m_recorder = nullptr;
+
+		// written by every call, kept off the read-only lines
+		alignas(kCacheLine) mutable std::shared_mutex m_mutex;
+		std::atomic<size_t> m_calls = 0;
+
+		alignas(kCacheLine) std::array<std::vector<CallbackHandler>, 2> m_callbacks;
+
+		// written by sampled and contended calls only
+		alignas(kCacheLine) LatencyHistogram m_latency;
+		std::atomic<uint64_t> m_lockWait = 0;
+
+		// cold, touched when installing, promoting or removing the hook
 		std::weak_ptr<asmjit::JitRuntime> m_rt;
-		std::array<std::vector<CallbackHandler>, 2> m_callbacks;
-		std::shared_mutex m_mutex;
+		uint64_t m_id = 0;
 		uint64_t m_functionPtr = 0;
-		union {
-			uint64_t m_trampolinePtr = 0;
-			const char* m_errorCode;
-		};
+		size_t m_functionSize = 0;
+		const char* m_errorCode = nullptr;
+		uint64_t m_thunkPtr = 0;
+		uint64_t m_nearHint = 0;
+		size_t m_sampledCalls = 0;
+		std::weak_ptr<TieredCompiler> m_tier;
+		std::string m_name;
+		UnwindInfo m_unwind;
+		std::unique_ptr<RetiredStub> m_retired; ///< the stub before relocate, a call blocked in the original still returns through it
+		std::unique_ptr<std::unordered_map<std::thread::id, std::deque<std::string>>> m_storage; ///< only touched by store/cleanup, never by the entries
+		mutable std::mutex m_storageMutex; ///< guards m_storage, separate from m_mutex which handlers run under
+	};
 
-		std::unique_ptr<std::unordered_map<std::thread::id, std::deque<std::string>>> m_storage;
+	/** Stub code replaced by Callback::relocate, other threads may still run it until it is destroyed. */
+	class RetiredStub {
+	public:
+		RetiredStub(std::weak_ptr<asmjit::JitRuntime> rt, uint64_t function, UnwindInfo& unwind) noexcept;
+		~RetiredStub();
+		RetiredStub(const RetiredStub&) = delete;
+		RetiredStub& operator=(const RetiredStub&) = delete;
+
+	private:
+		std::weak_ptr<asmjit::JitRuntime> m_rt;
+		uint64_t m_function;
+		UnwindInfo m_unwind;
 	};
 }
 
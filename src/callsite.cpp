@@ -0,0 +1,114 @@
+#include "callsite.hpp"
+#include "arena.hpp"
+#include "modules.hpp"
+
+#include "polyhook2/MemProtector.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace {
+	uint64_t GetCallDestination(uint64_t site) noexcept {
+		int32_t displacement;
+		std::memcpy(&displacement, reinterpret_cast<const void*>(site + 1), sizeof(displacement));
+		return static_cast<uintptr_t>(site + PLH::CallSiteHook::kCallSize + static_cast<int64_t>(displacement));
+	}
+
+	bool IsCallTo(uint64_t site, uint64_t target) noexcept {
+		return *reinterpret_cast<const uint8_t*>(site) == PLH::CallSiteHook::kCallRel32 && GetCallDestination(site) == target;
+	}
+
+	// a displacement inside one aligned qword is swapped with a single store, so a thread executing the
+	// site concurrently calls either the old or the new destination, never a torn mix of both
+	bool IsPatchable(uint64_t site) noexcept {
+		const uint64_t address = site + 1;
+		return (address & 7) + sizeof(int32_t) <= sizeof(uint64_t);
+	}
+}
+
+PLH::CallSiteHook::CallSiteHook(uint64_t target, uint64_t replacement) : m_target(target), m_replacement(replacement) {
+}
+
+PLH::CallSiteHook::~CallSiteHook() {
+	if (!m_sites.empty()) {
+		unHook();
+	}
+}
+
+size_t PLH::CallSiteHook::hook(std::span<const uint64_t> sites) {
+	size_t patched = 0;
+	for (uint64_t site : sites) {
+		if (std::find(m_sites.begin(), m_sites.end(), site) != m_sites.end()) {
+			++patched;
+			continue;
+		}
+		if (!IsCallTo(site, m_target) || !JitArena::isNear(site + kCallSize, m_replacement) || !IsPatchable(site))
+			continue;
+
+		write(site, m_replacement);
+		m_sites.push_back(site);
+		++patched;
+	}
+	return patched;
+}
+
+bool PLH::CallSiteHook::unHook() {
+	if (m_sites.empty())
+		return false;
+
+	for (uint64_t site : m_sites) {
+		if (IsCallTo(site, m_replacement)) {
+			write(site, m_target);
+		}
+	}
+
+	m_sites.clear();
+	return true;
+}
+
+std::vector<uint64_t> PLH::CallSiteHook::scan(std::string_view module, uint64_t target) {
+	std::vector<uint64_t> sites;
+	if (auto loaded = LoadedModule::find(module)) {
+		for (const auto& segment : loaded->segments) {
+			if (!segment.executable)
+				continue;
+			auto found = scan(segment.begin, segment.end, target);
+			sites.insert(sites.end(), found.begin(), found.end());
+		}
+	}
+	return sites;
+}
+
+std::vector<uint64_t> PLH::CallSiteHook::scan(uint64_t begin, uint64_t end, uint64_t target) {
+	std::vector<uint64_t> sites;
+	if (end < begin + kCallSize)
+		return sites;
+
+	// memchr skips most of the code, only an E8 whose displacement lands on the target is kept. This is a
+	// byte match, not a disassembly, callers patching sites they did not pick themselves should know the code
+	const auto* cursor = reinterpret_cast<const uint8_t*>(begin);
+	const auto* last = reinterpret_cast<const uint8_t*>(end - kCallSize + 1);
+	while ((cursor = static_cast<const uint8_t*>(std::memchr(cursor, kCallRel32, static_cast<size_t>(last - cursor))))) {
+		const auto site = reinterpret_cast<uint64_t>(cursor);
+		if (GetCallDestination(site) == target) {
+			sites.push_back(site);
+		}
+		++cursor;
+	}
+	return sites;
+}
+
+void PLH::CallSiteHook::write(uint64_t site, uint64_t destination) {
+	const auto displacement = static_cast<int32_t>(static_cast<int64_t>(destination - (site + kCallSize)));
+	const uint64_t address = site + 1;
+
+	MemoryProtector protector(site, kCallSize, RWX, *this);
+
+	// only sites passing IsPatchable get here
+	const uint64_t word = address & ~uint64_t{7};
+	std::atomic_ref ref(*reinterpret_cast<uint64_t*>(word));
+	uint64_t value = ref.load(std::memory_order_relaxed);
+	std::memcpy(reinterpret_cast<uint8_t*>(&value) + (address - word), &displacement, sizeof(displacement));
+	ref.store(value, std::memory_order_release);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "polyhook2/MemAccessor.hpp"
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace PLH {
+	/**
+	 * Retargets individual 'call rel32' instructions at a hook stub, the callee and every other caller stay
+	 * untouched. The stub calls the original function directly, so a patched site pays neither the detour
+	 * jump nor the trampoline back into the relocated prologue.
+	 *
+	 * The stub has to be within rel32 range of a site, sites out of range or no longer calling the target are
+	 * skipped. So are sites whose displacement straddles an 8 byte boundary, it could not be swapped with one
+	 * store while other threads run the code. Unhooking restores every site which still calls the stub.
+	 */
+	class CallSiteHook : public MemAccessor {
+	public:
+		static constexpr uint8_t kCallRel32 = 0xE8;
+		static constexpr size_t kCallSize = 5;
+
+		CallSiteHook(uint64_t target, uint64_t replacement);
+		~CallSiteHook();
+		CallSiteHook(const CallSiteHook&) = delete;
+		CallSiteHook& operator=(const CallSiteHook&) = delete;
+
+		/// patches the given sites which are not patched yet, returns how many of them call the stub afterwards
+		size_t hook(std::span<const uint64_t> sites);
+		bool unHook();
+
+		size_t getSiteCount() const noexcept { return m_sites.size(); }
+
+		/// every 'call rel32' in the executable segments of a loaded module (see LoadedModule::find) resolving to target
+		static std::vector<uint64_t> scan(std::string_view module, uint64_t target);
+		static std::vector<uint64_t> scan(uint64_t begin, uint64_t end, uint64_t target);
+
+	private:
+		void write(uint64_t site, uint64_t destination);
+
+		uint64_t m_target;
+		uint64_t m_replacement;
+		std::vector<uint64_t> m_sites;
+	};
+}
@@ -0,0 +1,202 @@
+#include "calltree.hpp"
+#include "callback.hpp"
+#include <plugify/compat_format.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+namespace {
+	struct Node {
+		uint64_t hook = 0; ///< Callback::getId, a freed hook's address may belong to another one later
+		std::string name;
+		Node* sibling = nullptr; ///< set before the node is published, never changed after
+		std::atomic<Node*> child = nullptr;
+		std::atomic<uint64_t> calls = 0;
+		std::atomic<uint64_t> inclusive = 0;
+		std::atomic<uint64_t> exclusive = 0;
+	};
+
+	struct Frame {
+		Node* node;
+		const void* slot;
+		uint64_t start;
+		uint64_t children; ///< inclusive cycles of the hooked calls made from this one
+	};
+
+	struct Totals {
+		uint64_t calls = 0;
+		uint64_t inclusive = 0;
+		uint64_t exclusive = 0;
+	};
+	using Paths = std::map<std::string, Totals>;
+
+	// only the owning thread writes, a plain load and store is enough
+	void Add(std::atomic<uint64_t>& counter, uint64_t value) noexcept {
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	std::string GetFrameName(const PLH::Callback* hook) {
+		std::string name = hook->getName().empty() ? std::format("{}", static_cast<const void*>(hook)) : hook->getName();
+		// ';' separates frames in collapsed stacks
+		std::replace(name.begin(), name.end(), ';', ',');
+		return name;
+	}
+
+	class ThreadTree {
+	public:
+		ThreadTree();
+		~ThreadTree();
+		ThreadTree(const ThreadTree&) = delete;
+		ThreadTree& operator=(const ThreadTree&) = delete;
+
+		void enter(const PLH::Callback* hook, const void* slot);
+		void leave(const void* slot) noexcept;
+		void collect(Paths& paths) const;
+
+	private:
+		Node* getChild(Node* parent, const PLH::Callback* hook);
+		static void collect(const Node* node, const std::string& prefix, Paths& paths);
+
+		Node m_root;
+		std::deque<Node> m_nodes;
+		std::array<Frame, PLH::CallTree::kMaxDepth> m_frames;
+		size_t m_depth = 0;
+	};
+
+	std::atomic<bool> g_enabled = false;
+
+	// readers hold the mutex while walking, owners only take it to register and when their thread exits
+	std::mutex g_mutex;
+	std::vector<const ThreadTree*> g_trees;
+	Paths g_exited;
+
+	ThreadTree& GetThreadTree() {
+		thread_local ThreadTree tree;
+		return tree;
+	}
+
+	ThreadTree::ThreadTree() {
+		std::lock_guard lock(g_mutex);
+		g_trees.push_back(this);
+	}
+
+	ThreadTree::~ThreadTree() {
+		std::lock_guard lock(g_mutex);
+		collect(g_exited);
+		std::erase(g_trees, this);
+	}
+
+	Node* ThreadTree::getChild(Node* parent, const PLH::Callback* hook) {
+		Node* first = parent->child.load(std::memory_order_relaxed);
+		for (Node* node = first; node; node = node->sibling) {
+			if (node->hook == hook->getId())
+				return node;
+		}
+
+		// deque growth at the back leaves published nodes where they are
+		Node& node = m_nodes.emplace_back();
+		node.hook = hook->getId();
+		node.name = GetFrameName(hook);
+		node.sibling = first;
+		parent->child.store(&node, std::memory_order_release);
+		return &node;
+	}
+
+	void ThreadTree::enter(const PLH::Callback* hook, const void* slot) {
+		if (m_depth == m_frames.size())
+			return;
+
+		Node* parent = m_depth ? m_frames[m_depth - 1].node : &m_root;
+		Node* node = getChild(parent, hook);
+		m_frames[m_depth++] = {node, slot, __rdtsc(), 0};
+	}
+
+	void ThreadTree::leave(const void* slot) noexcept {
+		const uint64_t now = __rdtsc();
+
+		// the stack grows down, argument blocks of calls nested deeper have lower addresses
+		while (m_depth && m_frames[m_depth - 1].slot <= slot) {
+			const Frame& frame = m_frames[--m_depth];
+			const uint64_t elapsed = now - frame.start;
+			Add(frame.node->calls, 1);
+			Add(frame.node->inclusive, elapsed);
+			Add(frame.node->exclusive, elapsed - std::min(frame.children, elapsed));
+			if (m_depth) {
+				m_frames[m_depth - 1].children += elapsed;
+			}
+			if (frame.slot == slot)
+				return;
+		}
+	}
+
+	void ThreadTree::collect(Paths& paths) const {
+		collect(&m_root, {}, paths);
+	}
+
+	void ThreadTree::collect(const Node* node, const std::string& prefix, Paths& paths) {
+		for (const Node* child = node->child.load(std::memory_order_acquire); child; child = child->sibling) {
+			std::string path = prefix.empty() ? child->name : prefix + ';' + child->name;
+			Totals& totals = paths[path];
+			totals.calls += child->calls.load(std::memory_order_relaxed);
+			totals.inclusive += child->inclusive.load(std::memory_order_relaxed);
+			totals.exclusive += child->exclusive.load(std::memory_order_relaxed);
+			collect(child, path, paths);
+		}
+	}
+
+	Paths Merge() {
+		std::lock_guard lock(g_mutex);
+
+		Paths paths = g_exited;
+		for (const ThreadTree* tree : g_trees) {
+			tree->collect(paths);
+		}
+		return paths;
+	}
+}
+
+void PLH::CallTree::setEnabled(bool enabled) noexcept {
+	g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool PLH::CallTree::isEnabled() noexcept {
+	return g_enabled.load(std::memory_order_relaxed);
+}
+
+void PLH::CallTree::enter(const Callback* hook, const void* slot) {
+	GetThreadTree().enter(hook, slot);
+}
+
+void PLH::CallTree::leave(const void* slot) noexcept {
+	GetThreadTree().leave(slot);
+}
+
+std::string PLH::CallTree::report() {
+	std::string text = "calls\tinclusive\texclusive\tpath\n";
+	for (const auto& [path, totals] : Merge()) {
+		std::format_to(std::back_inserter(text), "{}\t{}\t{}\t{}\n", totals.calls, totals.inclusive, totals.exclusive, path);
+	}
+	return text;
+}
+
+std::string PLH::CallTree::collapse() {
+	std::string text;
+	for (const auto& [path, totals] : Merge()) {
+		if (totals.exclusive) {
+			std::format_to(std::back_inserter(text), "{} {}\n", path, totals.exclusive);
+		}
+	}
+	return text;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace PLH {
+	class Callback;
+
+	/**
+	 * Caller -> callee tree of hooked calls with inclusive and exclusive rdtsc cycles, to tell the time spent in
+	 * a hooked function itself from the time spent in the hooked functions it calls. While enabled, the plugin's
+	 * pre entry pushes the hook and a timestamp onto a per-thread shadow call stack and its post entry pops it.
+	 *
+	 * Every thread aggregates into a tree only it writes, without locks or atomic read-modify-writes. Trees are
+	 * merged when a report is asked for, and folded into a shared total when their thread exits. Frames are
+	 * keyed by the stub's argument block, so calls skipped by an exception or longjmp are closed when an outer
+	 * hooked call returns. Calls nested deeper than kMaxDepth hooks are not recorded.
+	 */
+	class CallTree {
+	public:
+		static constexpr size_t kMaxDepth = 256;
+
+		static void setEnabled(bool enabled) noexcept;
+		static bool isEnabled() noexcept;
+
+		static void enter(const Callback* hook, const void* slot);
+		static void leave(const void* slot) noexcept;
+
+		/// one line per call path, outermost hook first: calls, inclusive cycles, exclusive cycles, path
+		static std::string report();
+		/// collapsed stacks weighted by exclusive cycles, as flamegraph.pl and speedscope read them
+		static std::string collapse();
+	};
+}
@@ -0,0 +1,283 @@
+#include "exithook.hpp"
+#include "symbols.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+using namespace asmjit;
+
+static_assert(offsetof(PLH::ExitRegisters, returnAddress) == 56, "exit thunk writes the caller here");
+
+namespace {
+#ifdef POLYHOOK2_ARCH_X64
+#if defined(_WIN32)
+	const x86::SReg& kTlsSegment = x86::gs;
+	const x86::Gp& kArg0 = x86::rcx;
+	constexpr int32_t kShadowSpace = 32;
+#else
+	const x86::SReg& kTlsSegment = x86::fs;
+	const x86::Gp& kArg0 = x86::rdi;
+	constexpr int32_t kShadowSpace = 0;
+#endif
+
+	// argument and scratch registers the entry stub keeps intact around ShadowStack::attach
+	const x86::Gp kVolatile[] = {
+		x86::rax, x86::rcx, x86::rdx, x86::rsi, x86::rdi, x86::r8, x86::r9, x86::r10
+	};
+	constexpr int32_t kVolatileXmm = 8;
+#endif
+
+	// one thunk serves every hook, it lives as long as the runtime it was allocated from
+	std::mutex g_thunkMutex;
+	std::weak_ptr<JitRuntime> g_thunkRuntime;
+	uint64_t g_thunk = 0;
+}
+
+PLH::ExitHook::ExitHook(std::weak_ptr<JitRuntime> rt) : m_rt(std::move(rt)) {
+}
+
+PLH::ExitHook::~ExitHook() {
+	if (auto rt = m_rt.lock()) {
+		if (m_functionPtr) {
+			JitSymbols::remove(m_functionPtr);
+			rt->release(m_functionPtr);
+		}
+	}
+}
+
+uint64_t PLH::ExitHook::getJitFunc() {
+	if (m_functionPtr)
+		return m_functionPtr;
+
+	auto rt = m_rt.lock();
+	if (!rt) {
+		m_errorCode = "JitRuntime invalid";
+		return 0;
+	}
+
+#ifdef POLYHOOK2_ARCH_X64
+	int32_t tlsOffset = 0;
+	if (!ShadowStack::getTlsOffset(tlsOffset)) {
+		m_errorCode = "No fixed thread local slot for the shadow stack";
+		return 0;
+	}
+
+	const uint64_t exitThunk = getExitThunk(rt);
+	if (!exitThunk) {
+		m_errorCode = "Failed to allocate exit thunk";
+		return 0;
+	}
+
+	CodeHolder code;
+	code.init(rt->environment(), rt->cpuFeatures());
+	x86::Assembler a(&code);
+
+	Label resume = a.newLabel();
+	emitTakeover(a, this, exitThunk, tlsOffset, resume);
+	a.bind(resume);
+	a.mov(x86::r11, imm(reinterpret_cast<uintptr_t>(&m_trampolinePtr)));
+	a.jmp(x86::qword_ptr(x86::r11));
+
+	if (rt->add(&m_functionPtr, &code) != kErrorOk) {
+		m_functionPtr = 0;
+		m_errorCode = "Failed to allocate JIT stub";
+		return 0;
+	}
+
+	JitSymbols::add(m_functionPtr, code.codeSize(), m_name.empty() ? "polyhook::exit" : m_name);
+	return m_functionPtr;
+#else
+	m_errorCode = "Exit hooks need x86-64";
+	return 0;
+#endif
+}
+
+void PLH::ExitHook::emitTakeover(x86::Assembler& a, ShadowOwner* owner, uint64_t exitThunk, int32_t tlsOffset, const Label& resume) {
+#ifdef POLYHOOK2_ARCH_X64
+	Label slow = a.newLabel();
+	Label tracked = a.newLabel();
+	Label full = a.newLabel();
+
+	// r11 is neither an argument nor callee saved, everything else is preserved
+	x86::Mem shadow = x86::qword_ptr_abs(static_cast<uint64_t>(static_cast<int64_t>(tlsOffset)));
+	shadow.setSegment(kTlsSegment);
+	a.mov(x86::r11, shadow);
+	a.test(x86::r11, x86::r11);
+	a.jz(slow);
+
+	a.bind(tracked);
+	a.push(x86::rax);
+	a.push(x86::rdx);
+	a.mov(x86::rax, x86::qword_ptr(x86::r11, offsetof(ShadowStack, top)));
+	a.cmp(x86::rax, x86::qword_ptr(x86::r11, offsetof(ShadowStack, limit)));
+	a.jae(full);
+	a.lea(x86::rdx, x86::ptr(x86::rax, sizeof(ShadowFrame)));
+	a.mov(x86::qword_ptr(x86::r11, offsetof(ShadowStack, top)), x86::rdx);
+	a.mov(x86::rdx, x86::qword_ptr(x86::rsp, 16));
+	a.mov(x86::qword_ptr(x86::rax, offsetof(ShadowFrame, returnAddress)), x86::rdx);
+	a.mov(x86::rdx, imm(reinterpret_cast<uintptr_t>(owner)));
+	a.mov(x86::qword_ptr(x86::rax, offsetof(ShadowFrame, owner)), x86::rdx);
+	a.lea(x86::rdx, x86::ptr(x86::rsp, 16));
+	a.mov(x86::qword_ptr(x86::rax, offsetof(ShadowFrame, slot)), x86::rdx);
+	a.mov(x86::r11, x86::rax);
+	a.rdtsc();
+	a.shl(x86::rdx, 32);
+	a.or_(x86::rax, x86::rdx);
+	a.mov(x86::qword_ptr(x86::r11, offsetof(ShadowFrame, timestamp)), x86::rax);
+	a.mov(x86::rax, imm(exitThunk));
+	a.mov(x86::qword_ptr(x86::rsp, 16), x86::rax);
+
+	a.bind(full);
+	a.pop(x86::rdx);
+	a.pop(x86::rax);
+	a.jmp(resume);
+
+	// first taken over call on this thread, create the shadow stack without disturbing the arguments
+	constexpr int32_t kSpill = kVolatileXmm * 16 + 8 + kShadowSpace;
+	a.bind(slow);
+	for (const x86::Gp& reg : kVolatile) {
+		a.push(reg);
+	}
+	a.sub(x86::rsp, kSpill);
+	for (int32_t i = 0; i < kVolatileXmm; ++i) {
+		a.movups(x86::ptr(x86::rsp, kShadowSpace + i * 16), x86::xmm(static_cast<uint32_t>(i)));
+	}
+	a.mov(x86::rax, imm(reinterpret_cast<uintptr_t>(&ShadowStack::attach)));
+	a.call(x86::rax);
+	a.mov(x86::r11, x86::rax);
+	for (int32_t i = 0; i < kVolatileXmm; ++i) {
+		a.movups(x86::xmm(static_cast<uint32_t>(i)), x86::ptr(x86::rsp, kShadowSpace + i * 16));
+	}
+	a.add(x86::rsp, kSpill);
+	for (auto it = std::rbegin(kVolatile); it != std::rend(kVolatile); ++it) {
+		a.pop(*it);
+	}
+	a.test(x86::r11, x86::r11);
+	a.jnz(tracked);
+	a.jmp(resume);
+#else
+	(void) a;
+	(void) owner;
+	(void) exitThunk;
+	(void) tlsOffset;
+	(void) resume;
+#endif
+}
+
+uint64_t PLH::ExitHook::getExitThunk(const std::shared_ptr<JitRuntime>& rt) {
+	std::lock_guard lock(g_thunkMutex);
+
+	if (g_thunk && g_thunkRuntime.lock() == rt)
+		return g_thunk;
+
+	g_thunk = 0;
+	g_thunkRuntime = rt;
+
+#ifdef POLYHOOK2_ARCH_X64
+	CodeHolder code;
+	code.init(rt->environment(), rt->cpuFeatures());
+	x86::Assembler a(&code);
+
+	// entered by 'ret' with the stack aligned, the slot for the caller keeps it aligned for the call
+	constexpr int32_t kFrame = static_cast<int32_t>(offsetof(ExitRegisters, rdx)) + kShadowSpace;
+	a.sub(x86::rsp, 8);
+	a.push(x86::rax);
+	a.push(x86::rdx);
+	a.sub(x86::rsp, kFrame);
+	a.movups(x86::ptr(x86::rsp, kShadowSpace + offsetof(ExitRegisters, xmm0)), x86::xmm0);
+	a.movups(x86::ptr(x86::rsp, kShadowSpace + offsetof(ExitRegisters, xmm1)), x86::xmm1);
+	a.lea(kArg0, x86::ptr(x86::rsp, kShadowSpace));
+	a.mov(x86::rax, imm(reinterpret_cast<uintptr_t>(&ExitHook::leave)));
+	a.call(x86::rax);
+	a.mov(x86::qword_ptr(x86::rsp, kShadowSpace + offsetof(ExitRegisters, returnAddress)), x86::rax);
+	a.movups(x86::xmm0, x86::ptr(x86::rsp, kShadowSpace + offsetof(ExitRegisters, xmm0)));
+	a.movups(x86::xmm1, x86::ptr(x86::rsp, kShadowSpace + offsetof(ExitRegisters, xmm1)));
+	a.add(x86::rsp, kFrame);
+	a.pop(x86::rdx);
+	a.pop(x86::rax);
+	a.ret();
+
+	void* thunk = nullptr;
+	if (rt->add(&thunk, &code) != kErrorOk)
+		return 0;
+
+	g_thunk = reinterpret_cast<uint64_t>(thunk);
+	JitSymbols::add(g_thunk, code.codeSize(), "polyhook::exit_thunk");
+#endif
+	return g_thunk;
+}
+
+uint64_t PLH::ExitHook::leave(ExitRegisters* registers) {
+	const uint64_t exitTime = __rdtsc();
+
+	// the thunk reserved the caller's slot exactly where the return address was taken from
+	const ShadowFrame frame = ShadowStack::current()->pop(reinterpret_cast<uint64_t>(&registers->returnAddress));
+	static_cast<ShadowOwner*>(frame.owner)->onReturn(frame, registers, exitTime);
+	return frame.returnAddress;
+}
+
+void PLH::ExitHook::onReturn(const ShadowFrame& frame, ExitRegisters* registers, uint64_t exitTime) {
+	const ExitContext context{registers, frame.timestamp, exitTime};
+
+	std::shared_lock lock(m_mutex);
+	for (const ExitHandler handler : m_handlers) {
+		handler(this, &context);
+	}
+}
+
+std::string_view PLH::ExitHook::getError() const noexcept {
+	return !m_functionPtr && m_errorCode ? m_errorCode : "";
+}
+
+void PLH::ExitHook::setName(std::string name) {
+	m_name = std::move(name);
+}
+
+bool PLH::ExitHook::addHandler(const ExitHandler handler) {
+	if (!handler)
+		return false;
+
+	std::unique_lock lock(m_mutex);
+
+	if (std::find(m_handlers.begin(), m_handlers.end(), handler) != m_handlers.end())
+		return false;
+
+	m_handlers.push_back(handler);
+	return true;
+}
+
+bool PLH::ExitHook::removeHandler(const ExitHandler handler) {
+	if (!handler)
+		return false;
+
+	std::unique_lock lock(m_mutex);
+
+	auto it = std::find(m_handlers.begin(), m_handlers.end(), handler);
+	if (it == m_handlers.end())
+		return false;
+
+	m_handlers.erase(it);
+	return true;
+}
+
+bool PLH::ExitHook::isHandlerRegistered(const ExitHandler handler) const noexcept {
+	std::shared_lock lock(m_mutex);
+	return std::find(m_handlers.begin(), m_handlers.end(), handler) != m_handlers.end();
+}
+
+bool PLH::ExitHook::areHandlersRegistered() const noexcept {
+	std::shared_lock lock(m_mutex);
+	return !m_handlers.empty();
+}
+
+void PLH::ExitHook::clearHandlers() {
+	std::unique_lock lock(m_mutex);
+	m_handlers.clear();
+}
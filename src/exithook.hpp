@@ -0,0 +1,102 @@
+#pragma once
+
+#pragma warning(push, 0)
+#include <asmjit/asmjit.h>
+#pragma warning( pop )
+
+#include "shadowstack.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace PLH {
+	/** Return registers as saved by the shared exit thunk, lowest address first. */
+	struct ExitRegisters {
+		union Xmm {
+			float f32[4];
+			double f64[2];
+			uint64_t u64[2];
+		};
+
+		Xmm xmm0;
+		Xmm xmm1;
+		uint64_t padding;
+		uint64_t rdx;
+		uint64_t rax;
+		uint64_t returnAddress; ///< the caller, written back by the thunk before it returns
+	};
+
+	struct ExitContext {
+		ExitRegisters* registers;
+		uint64_t entryTime; ///< rdtsc when the function was entered
+		uint64_t exitTime;  ///< rdtsc when it returned
+	};
+
+	/** Whatever pushed a ShadowFrame, told when the call returns through the exit thunk. */
+	class ShadowOwner {
+	public:
+		virtual void onReturn(const ShadowFrame& frame, ExitRegisters* registers, uint64_t exitTime) = 0;
+
+	protected:
+		~ShadowOwner() = default;
+	};
+
+	/**
+	 * Observe-only hook which runs when the function returns. The entry stub does not spill arguments or call
+	 * anything: it moves the return address onto the thread's ShadowStack together with the hook and a
+	 * timestamp, puts the shared exit thunk in its place and jumps to the trampoline. On return the thunk saves
+	 * the return registers, calls the handlers and returns to the real caller.
+	 *
+	 * x86-64 only. The hooked function must not be unwound by an exception, the unwinder has no frame
+	 * information for the exit thunk. Frames skipped by longjmp are dropped once an outer hooked call returns.
+	 * A hook can have calls in flight long after it was removed, so removed hooks are kept until plugin end.
+	 */
+	class ExitHook final : public ShadowOwner {
+	public:
+		typedef void (*ExitHandler)(ExitHook* hook, const ExitContext* context);
+
+		explicit ExitHook(std::weak_ptr<asmjit::JitRuntime> rt);
+		~ExitHook();
+		ExitHook(const ExitHook&) = delete;
+		ExitHook& operator=(const ExitHook&) = delete;
+
+		uint64_t getJitFunc();
+
+		uint64_t* getTrampolineHolder() noexcept { return &m_trampolinePtr; }
+		std::string_view getError() const noexcept;
+		void setName(std::string name);
+
+		bool addHandler(ExitHandler handler);
+		bool removeHandler(ExitHandler handler);
+		bool isHandlerRegistered(ExitHandler handler) const noexcept;
+		bool areHandlersRegistered() const noexcept;
+		void clearHandlers();
+
+		/// shared thunk every taken over return goes through, 0 when it cannot be allocated
+		static uint64_t getExitThunk(const std::shared_ptr<asmjit::JitRuntime>& rt);
+
+		/**
+		 * Emits the return address takeover: pushes a frame for owner onto the thread's shadow stack, points
+		 * the return address at exitThunk and continues at resume. Only r11 and the flags are clobbered.
+		 */
+		static void emitTakeover(asmjit::x86::Assembler& a, ShadowOwner* owner, uint64_t exitThunk, int32_t tlsOffset, const asmjit::Label& resume);
+
+	private:
+		void onReturn(const ShadowFrame& frame, ExitRegisters* registers, uint64_t exitTime) override;
+
+		static uint64_t leave(ExitRegisters* registers);
+
+		std::weak_ptr<asmjit::JitRuntime> m_rt;
+		uint64_t m_functionPtr = 0;
+		uint64_t m_trampolinePtr = 0;
+		const char* m_errorCode = nullptr;
+		std::string m_name;
+		mutable std::shared_mutex m_mutex;
+		std::vector<ExitHandler> m_handlers;
+	};
+}
@@ -0,0 +1,167 @@
+#include "imports.hpp"
+#include "modules.hpp"
+
+#include "polyhook2/MemProtector.hpp"
+
+#include <atomic>
+#include <string>
+
+#if defined(__linux__)
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#endif
+
+namespace {
+#if defined(__linux__)
+#ifdef POLYHOOK2_ARCH_X64
+	using Relocation = ElfW(Rela);
+	constexpr auto kRelocationTable = DT_RELA;
+	constexpr auto kRelocationTableSize = DT_RELASZ;
+	constexpr uint32_t kJumpSlot = R_X86_64_JUMP_SLOT;
+	constexpr uint32_t kGlobDat = R_X86_64_GLOB_DAT;
+
+	constexpr uint32_t GetSymbolIndex(ElfW(Xword) info) noexcept { return static_cast<uint32_t>(ELF64_R_SYM(info)); }
+	constexpr uint32_t GetType(ElfW(Xword) info) noexcept { return static_cast<uint32_t>(ELF64_R_TYPE(info)); }
+#else
+	using Relocation = ElfW(Rel);
+	constexpr auto kRelocationTable = DT_REL;
+	constexpr auto kRelocationTableSize = DT_RELSZ;
+	constexpr uint32_t kJumpSlot = R_386_JMP_SLOT;
+	constexpr uint32_t kGlobDat = R_386_GLOB_DAT;
+
+	constexpr uint32_t GetSymbolIndex(ElfW(Word) info) noexcept { return ELF32_R_SYM(info); }
+	constexpr uint32_t GetType(ElfW(Word) info) noexcept { return ELF32_R_TYPE(info); }
+#endif
+
+	// glibc relocates the dynamic section in place, other loaders leave the link time values
+	uintptr_t GetAddress(const PLH::LoadedModule& module, ElfW(Addr) value) noexcept {
+		return value < module.base ? module.base + value : value;
+	}
+
+	std::vector<uintptr_t> FindSlots(const PLH::LoadedModule& module, std::string_view symbol) {
+		const ElfW(Sym)* symbols = nullptr;
+		const char* strings = nullptr;
+		uintptr_t plt = 0, pltSize = 0;
+		uintptr_t relocations = 0, relocationsSize = 0;
+
+		for (auto* entry = reinterpret_cast<const ElfW(Dyn)*>(module.dynamic); entry->d_tag != DT_NULL; ++entry) {
+			switch (entry->d_tag) {
+				case DT_SYMTAB: symbols = reinterpret_cast<const ElfW(Sym)*>(GetAddress(module, entry->d_un.d_ptr)); break;
+				case DT_STRTAB: strings = reinterpret_cast<const char*>(GetAddress(module, entry->d_un.d_ptr)); break;
+				case DT_JMPREL: plt = GetAddress(module, entry->d_un.d_ptr); break;
+				case DT_PLTRELSZ: pltSize = entry->d_un.d_val; break;
+				case kRelocationTable: relocations = GetAddress(module, entry->d_un.d_ptr); break;
+				case kRelocationTableSize: relocationsSize = entry->d_un.d_val; break;
+				default: break;
+			}
+		}
+
+		std::vector<uintptr_t> slots;
+		if (!symbols || !strings)
+			return slots;
+
+		// PLT calls load the target from JUMP_SLOT entries, -fno-plt calls and taken addresses from GLOB_DAT ones
+		auto scan = [&](uintptr_t table, uintptr_t size) {
+			const auto* begin = reinterpret_cast<const Relocation*>(table);
+			const auto* end = begin + size / sizeof(Relocation);
+			for (const Relocation* relocation = begin; relocation != end; ++relocation) {
+				const uint32_t type = GetType(relocation->r_info);
+				if (type != kJumpSlot && type != kGlobDat)
+					continue;
+				const uint32_t index = GetSymbolIndex(relocation->r_info);
+				if (index == 0 || symbol != strings + symbols[index].st_name)
+					continue;
+				slots.push_back(module.base + relocation->r_offset);
+			}
+		};
+		if (plt)
+			scan(plt, pltSize);
+		if (relocations)
+			scan(relocations, relocationsSize);
+
+		return slots;
+	}
+
+	// A lazily bound slot still points back into the importer's PLT, calling that would run the resolver
+	// which overwrites the hooked slot. Ask the loader for the definition the importer binds to instead.
+	uintptr_t Resolve(const PLH::LoadedModule& module, std::string_view symbol, const std::vector<uintptr_t>& slots) {
+		for (uintptr_t slot : slots) {
+			const uintptr_t value = std::atomic_ref(*reinterpret_cast<uintptr_t*>(slot)).load(std::memory_order_relaxed);
+			if (value && !module.contains(value))
+				return value;
+		}
+
+		void* handle = module.path.empty() ? dlopen(nullptr, RTLD_LAZY) : dlopen(module.path.c_str(), RTLD_LAZY | RTLD_NOLOAD);
+		if (!handle)
+			return 0;
+		const auto address = reinterpret_cast<uintptr_t>(dlsym(handle, std::string(symbol).c_str()));
+		dlclose(handle);
+		return address;
+	}
+#endif
+}
+
+PLH::ImportHook::ImportHook(std::string_view importer, std::string_view symbol) {
+#if defined(__linux__)
+	auto module = LoadedModule::find(importer);
+	if (!module || !module->dynamic)
+		return;
+
+	auto slots = FindSlots(*module, symbol);
+	if (slots.empty())
+		return;
+
+	m_target = Resolve(*module, symbol, slots);
+	for (uintptr_t address : slots) {
+		m_slots.push_back({address, 0});
+	}
+#else
+	(void) importer;
+	(void) symbol;
+#endif
+}
+
+PLH::ImportHook::~ImportHook() {
+	if (m_hooked) {
+		unHook();
+	}
+}
+
+bool PLH::ImportHook::hook(uint64_t replacement, uint64_t* userOrigVar) {
+	if (m_hooked || !m_target || !replacement)
+		return false;
+
+	// calls can arrive through the first slot before the others are written
+	*userOrigVar = m_target;
+	m_replacement = static_cast<uintptr_t>(replacement);
+
+	for (auto& slot : m_slots) {
+		slot.previous = std::atomic_ref(*reinterpret_cast<uintptr_t*>(slot.address)).load(std::memory_order_relaxed);
+		write(slot.address, m_replacement);
+	}
+
+	m_hooked = true;
+	return true;
+}
+
+bool PLH::ImportHook::unHook() {
+	if (!m_hooked)
+		return false;
+
+	for (const auto& slot : m_slots) {
+		// a hook installed over ours owns the slot now, it restores our stub which is still alive until released
+		if (std::atomic_ref(*reinterpret_cast<uintptr_t*>(slot.address)).load(std::memory_order_relaxed) == m_replacement) {
+			write(slot.address, slot.previous);
+		}
+	}
+
+	m_hooked = false;
+	return true;
+}
+
+void PLH::ImportHook::write(uintptr_t address, uintptr_t value) {
+	// full RELRO leaves the GOT read-only once the loader is done with it
+	MemoryProtector protector(address, sizeof(uintptr_t), ProtFlag::R | ProtFlag::W, *this);
+	std::atomic_ref(*reinterpret_cast<uintptr_t*>(address)).store(value, std::memory_order_release);
+}
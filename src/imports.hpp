@@ -0,0 +1,47 @@
+#pragma once
+
+#include "polyhook2/MemAccessor.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace PLH {
+	/**
+	 * Redirects the calls one loaded module makes to an imported function by rewriting its GOT entries, the
+	 * slots its PLT stubs (JUMP_SLOT) and -fno-plt or address taking code (GLOB_DAT) load the target from.
+	 * The callee is left untouched, so there is no prologue to relocate and no trampoline: the resolved GOT
+	 * value is the original. Install and removal are one pointer store per slot.
+	 *
+	 * The importer is matched by full path or file name of a loaded object, an empty name selects the main
+	 * executable. Linux only, elsewhere no slots are found.
+	 */
+	class ImportHook : public MemAccessor {
+	public:
+		ImportHook(std::string_view importer, std::string_view symbol);
+		~ImportHook();
+		ImportHook(const ImportHook&) = delete;
+		ImportHook& operator=(const ImportHook&) = delete;
+
+		bool hook(uint64_t replacement, uint64_t* userOrigVar);
+		bool unHook();
+
+		bool isHooked() const noexcept { return m_hooked; }
+		/// function the importer currently resolves the symbol to, 0 when it does not import it
+		uint64_t getTarget() const noexcept { return m_target; }
+		size_t getSlotCount() const noexcept { return m_slots.size(); }
+
+	private:
+		struct Slot {
+			uintptr_t address;
+			uintptr_t previous;
+		};
+
+		void write(uintptr_t address, uintptr_t value);
+
+		std::vector<Slot> m_slots;
+		uintptr_t m_target = 0;
+		uintptr_t m_replacement = 0;
+		bool m_hooked = false;
+	};
+}
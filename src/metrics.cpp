@@ -0,0 +1,133 @@
+#include "metrics.hpp"
+#include <plugify/compat_format.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+
+namespace {
+	struct Sample {
+		const void* slot;
+		uint64_t start;
+	};
+
+	std::atomic<bool> g_enabled = false;
+
+	thread_local std::array<Sample, PLH::Metrics::kMaxDepth> t_samples;
+	thread_local size_t t_depth = 0;
+
+	void AppendEscaped(std::string& out, std::string_view value) {
+		for (char c : value) {
+			switch (c) {
+				case '\\': out += "\\\\"; break;
+				case '"': out += "\\\""; break;
+				case '\n': out += "\\n"; break;
+				default: out += c; break;
+			}
+		}
+	}
+}
+
+void PLH::LatencyHistogram::add(uint64_t ns) noexcept {
+	const size_t bucket = std::min<size_t>(static_cast<size_t>(std::bit_width(ns)), kBuckets - 1);
+	m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t PLH::LatencyHistogram::getCount() const noexcept {
+	uint64_t count = 0;
+	for (const auto& bucket : m_buckets) {
+		count += bucket.load(std::memory_order_relaxed);
+	}
+	return count;
+}
+
+double PLH::LatencyHistogram::getQuantile(double quantile) const noexcept {
+	std::array<uint64_t, kBuckets> counts;
+	uint64_t total = 0;
+	for (size_t i = 0; i < kBuckets; ++i) {
+		counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+		total += counts[i];
+	}
+	if (!total)
+		return 0;
+
+	const double rank = quantile * static_cast<double>(total);
+	double seen = 0;
+	for (size_t i = 0; i < kBuckets; ++i) {
+		if (!counts[i])
+			continue;
+		if (seen + static_cast<double>(counts[i]) >= rank) {
+			const double low = i ? static_cast<double>(uint64_t{1} << (i - 1)) : 0;
+			const double high = i ? low * 2 : 1;
+			return low + (high - low) * (rank - seen) / static_cast<double>(counts[i]);
+		}
+		seen += static_cast<double>(counts[i]);
+	}
+	return static_cast<double>(uint64_t{1} << (kBuckets - 1));
+}
+
+void PLH::Metrics::setEnabled(bool enabled) noexcept {
+	g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool PLH::Metrics::isEnabled() noexcept {
+	return g_enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t PLH::Metrics::now() noexcept {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void PLH::Metrics::enter(const void* slot) noexcept {
+	if (t_depth == kMaxDepth)
+		return;
+	t_samples[t_depth++] = {slot, now()};
+}
+
+uint64_t PLH::Metrics::leave(const void* slot) noexcept {
+	// the stack grows down, samples of calls skipped by an exception or longjmp have lower addresses
+	while (t_depth && t_samples[t_depth - 1].slot <= slot) {
+		const Sample& sample = t_samples[--t_depth];
+		if (sample.slot == slot)
+			return now() - sample.start;
+	}
+	return 0;
+}
+
+void PLH::Metrics::addFamily(std::string_view name, std::string_view type, std::string_view help) {
+	std::format_to(std::back_inserter(m_text), "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+void PLH::Metrics::add(std::string_view name, std::initializer_list<std::pair<std::string_view, std::string_view>> labels, double value) {
+	m_text += name;
+	if (labels.size()) {
+		char separator = '{';
+		for (const auto& [label, text] : labels) {
+			m_text += separator;
+			m_text += label;
+			m_text += "=\"";
+			AppendEscaped(m_text, text);
+			m_text += '"';
+			separator = ',';
+		}
+		m_text += '}';
+	}
+	std::format_to(std::back_inserter(m_text), " {}\n", value);
+}
+
+bool PLH::Metrics::write(const std::filesystem::path& path) const {
+	std::filesystem::path temp = path;
+	temp += ".tmp";
+	{
+		std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+		if (!file.write(m_text.data(), static_cast<std::streamsize>(m_text.size())))
+			return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temp, path, error);
+	return !error;
+}
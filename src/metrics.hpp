@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace PLH {
+	/** Log2 buckets of sampled call latencies in nanoseconds, written by the sampled calls with relaxed adds. */
+	class LatencyHistogram {
+	public:
+		static constexpr size_t kBuckets = 48; ///< bucket b counts [2^(b-1), 2^b), the last one everything above
+
+		void add(uint64_t ns) noexcept;
+		uint64_t getCount() const noexcept;
+		/// interpolated within the bucket, 0 without samples
+		double getQuantile(double quantile) const noexcept;
+
+	private:
+		std::array<std::atomic<uint64_t>, kBuckets> m_buckets{};
+	};
+
+	/**
+	 * Prometheus text exposition for a textfile collector. While enabled, the plugin's pre entry times one call
+	 * in 2^kSampleShift per hook, found from the stub's own call counter, and its post entry adds the time to the
+	 * hook's LatencyHistogram. Other calls pay nothing beyond the counter increment the stub always does.
+	 * The plugin collects everything else when it writes the file, from its update on a low frequency timer.
+	 */
+	class Metrics {
+	public:
+		static constexpr uint32_t kSampleShift = 6;
+		static constexpr size_t kMaxDepth = 64; ///< nested sampled calls per thread
+
+		static void setEnabled(bool enabled) noexcept;
+		static bool isEnabled() noexcept;
+		static bool isSampled(size_t calls) noexcept { return (calls & ((size_t{1} << kSampleShift) - 1)) == 0; }
+
+		static uint64_t now() noexcept;
+		static void enter(const void* slot) noexcept;
+		/// nanoseconds since the matching enter, 0 if there was none
+		static uint64_t leave(const void* slot) noexcept;
+
+		void addFamily(std::string_view name, std::string_view type, std::string_view help);
+		/// labels as name, value pairs
+		void add(std::string_view name, std::initializer_list<std::pair<std::string_view, std::string_view>> labels, double value);
+
+		const std::string& str() const noexcept { return m_text; }
+
+		/// writes a temporary file next to path and renames it over path, collectors never see a partial file
+		bool write(const std::filesystem::path& path) const;
+
+	private:
+		std::string m_text;
+	};
+}
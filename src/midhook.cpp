@@ -0,0 +1,216 @@
+#include "midhook.hpp"
+#include "symbols.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+
+using namespace asmjit;
+
+namespace {
+#ifdef POLYHOOK2_ARCH_X64
+	// leaf functions may keep data below the stack pointer, the stub must not push over it
+	constexpr int32_t kRedZone = 128;
+
+	// push order, the reverse of the MidContext fields
+	const x86::Gp kSaved[] = {
+		x86::rax, x86::rcx, x86::rdx, x86::rbx, x86::rbp, x86::rsi, x86::rdi,
+		x86::r8, x86::r9, x86::r10, x86::r11, x86::r12, x86::r13, x86::r14, x86::r15
+	};
+#endif
+
+	constexpr int32_t kXmmSize = static_cast<int32_t>(sizeof(PLH::MidContext::xmm));
+}
+
+uintptr_t* PLH::MidContext::getRegister(Register reg) noexcept {
+	switch (reg) {
+		case Register::Rax: return &rax;
+		case Register::Rcx: return &rcx;
+		case Register::Rdx: return &rdx;
+		case Register::Rbx: return &rbx;
+		case Register::Rsp: return &rsp;
+		case Register::Rbp: return &rbp;
+		case Register::Rsi: return &rsi;
+		case Register::Rdi: return &rdi;
+#ifdef POLYHOOK2_ARCH_X64
+		case Register::R8: return &r8;
+		case Register::R9: return &r9;
+		case Register::R10: return &r10;
+		case Register::R11: return &r11;
+		case Register::R12: return &r12;
+		case Register::R13: return &r13;
+		case Register::R14: return &r14;
+		case Register::R15: return &r15;
+#endif
+		case Register::Flags: return &flags;
+		default: return nullptr;
+	}
+}
+
+PLH::MidHook::MidHook(std::weak_ptr<JitRuntime> rt) : m_rt(std::move(rt)) {
+}
+
+PLH::MidHook::~MidHook() {
+	if (auto rt = m_rt.lock()) {
+		if (m_functionPtr) {
+			JitSymbols::remove(m_functionPtr);
+			rt->release(m_functionPtr);
+		}
+	}
+}
+
+uint64_t PLH::MidHook::getJitFunc() {
+	if (m_functionPtr)
+		return m_functionPtr;
+
+	auto rt = m_rt.lock();
+	if (!rt) {
+		m_errorCode = "JitRuntime invalid";
+		return 0;
+	}
+
+	CodeHolder code;
+	code.init(rt->environment(), rt->cpuFeatures());
+	x86::Assembler a(&code);
+
+#ifdef POLYHOOK2_ARCH_X64
+	// slot for the resume address above the red zone, so nothing live ever sits below the stack pointer
+	a.lea(x86::rsp, x86::ptr(x86::rsp, -(kRedZone + 8)));
+	a.pushfq();
+	for (const x86::Gp& reg : kSaved) {
+		a.push(reg);
+	}
+	// pushed registers and flags, the resume slot sits right above them
+	constexpr int32_t kSavedSize = static_cast<int32_t>(std::size(kSaved) * sizeof(uint64_t)) + 8;
+	a.lea(x86::rax, x86::ptr(x86::rsp, kSavedSize + kRedZone + 8));
+	a.push(x86::rax);
+	a.sub(x86::rsp, kXmmSize);
+	for (uint32_t i = 0; i < MidContext::kXmmCount; ++i) {
+		a.movups(x86::ptr(x86::rsp, static_cast<int32_t>(i * 16)), x86::xmm(i));
+	}
+
+	// rbx is callee saved and already captured, it keeps the context across the call
+	a.mov(x86::rbx, x86::rsp);
+	a.and_(x86::rsp, -16);
+	a.sub(x86::rsp, 32);
+#if defined(_WIN32)
+	a.mov(x86::rcx, imm(reinterpret_cast<uintptr_t>(this)));
+	a.mov(x86::rdx, x86::rbx);
+#else
+	a.mov(x86::rdi, imm(reinterpret_cast<uintptr_t>(this)));
+	a.mov(x86::rsi, x86::rbx);
+#endif
+	a.mov(x86::rax, imm(reinterpret_cast<uintptr_t>(&MidHook::dispatch)));
+	a.call(x86::rax);
+	a.mov(x86::rsp, x86::rbx);
+
+	for (uint32_t i = 0; i < MidContext::kXmmCount; ++i) {
+		a.movups(x86::xmm(i), x86::ptr(x86::rsp, static_cast<int32_t>(i * 16)));
+	}
+	a.add(x86::rsp, kXmmSize + 8);
+
+	// the trampoline is read on every pass, it is only known once the detour is installed
+	a.mov(x86::rax, imm(reinterpret_cast<uintptr_t>(&m_trampolinePtr)));
+	a.mov(x86::rax, x86::ptr(x86::rax));
+	a.mov(x86::ptr(x86::rsp, kSavedSize), x86::rax);
+	for (auto it = std::rbegin(kSaved); it != std::rend(kSaved); ++it) {
+		a.pop(*it);
+	}
+	a.popfq();
+	a.ret(imm(kRedZone));
+#else
+	a.sub(x86::esp, 4);
+	a.pushfd();
+	a.pushad();
+	// pushad stores the stack pointer after the resume slot and flags were pushed
+	a.add(x86::dword_ptr(x86::esp, 12), 8);
+	a.sub(x86::esp, kXmmSize);
+	for (uint32_t i = 0; i < MidContext::kXmmCount; ++i) {
+		a.movups(x86::ptr(x86::esp, static_cast<int32_t>(i * 16)), x86::xmm(i));
+	}
+
+	a.mov(x86::ebx, x86::esp);
+	a.and_(x86::esp, -16);
+	a.sub(x86::esp, 8);
+	a.push(x86::ebx);
+	a.push(imm(reinterpret_cast<uintptr_t>(this)));
+	a.mov(x86::eax, imm(reinterpret_cast<uintptr_t>(&MidHook::dispatch)));
+	a.call(x86::eax);
+	a.mov(x86::esp, x86::ebx);
+
+	for (uint32_t i = 0; i < MidContext::kXmmCount; ++i) {
+		a.movups(x86::xmm(i), x86::ptr(x86::esp, static_cast<int32_t>(i * 16)));
+	}
+	a.add(x86::esp, kXmmSize);
+
+	a.mov(x86::eax, imm(reinterpret_cast<uintptr_t>(&m_trampolinePtr)));
+	a.mov(x86::eax, x86::ptr(x86::eax));
+	a.mov(x86::ptr(x86::esp, 36), x86::eax);
+	a.popad();
+	a.popfd();
+	a.ret();
+#endif
+
+	if (rt->add(&m_functionPtr, &code) != kErrorOk) {
+		m_functionPtr = 0;
+		m_errorCode = "Failed to allocate JIT stub";
+		return 0;
+	}
+
+	m_functionSize = code.codeSize();
+	JitSymbols::add(m_functionPtr, m_functionSize, m_name.empty() ? "polyhook::mid" : m_name);
+
+	return m_functionPtr;
+}
+
+void PLH::MidHook::dispatch(MidHook* hook, MidContext* context) {
+	std::shared_lock lock(hook->m_mutex);
+	for (const MidHandler handler : hook->m_handlers) {
+		handler(hook, context);
+	}
+}
+
+std::string_view PLH::MidHook::getError() const noexcept {
+	return !m_functionPtr && m_errorCode ? m_errorCode : "";
+}
+
+void PLH::MidHook::setName(std::string name) {
+	m_name = std::move(name);
+}
+
+bool PLH::MidHook::addHandler(const MidHandler handler) {
+	if (!handler)
+		return false;
+
+	std::unique_lock lock(m_mutex);
+
+	if (std::find(m_handlers.begin(), m_handlers.end(), handler) != m_handlers.end())
+		return false;
+
+	m_handlers.push_back(handler);
+	return true;
+}
+
+bool PLH::MidHook::removeHandler(const MidHandler handler) {
+	if (!handler)
+		return false;
+
+	std::unique_lock lock(m_mutex);
+
+	auto it = std::find(m_handlers.begin(), m_handlers.end(), handler);
+	if (it == m_handlers.end())
+		return false;
+
+	m_handlers.erase(it);
+	return true;
+}
+
+bool PLH::MidHook::isHandlerRegistered(const MidHandler handler) const noexcept {
+	std::shared_lock lock(m_mutex);
+	return std::find(m_handlers.begin(), m_handlers.end(), handler) != m_handlers.end();
+}
+
+bool PLH::MidHook::areHandlersRegistered() const noexcept {
+	std::shared_lock lock(m_mutex);
+	return !m_handlers.empty();
+}
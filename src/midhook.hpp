@@ -0,0 +1,114 @@
+#pragma once
+
+#pragma warning(push, 0)
+#include <asmjit/asmjit.h>
+#pragma warning( pop )
+
+#include "polyhook2/PolyHookOs.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace PLH {
+	enum class Register : uint8_t {
+		Rax,
+		Rcx,
+		Rdx,
+		Rbx,
+		Rsp, ///< value at the hooked instruction, writes are ignored
+		Rbp,
+		Rsi,
+		Rdi,
+		R8,  ///< R8 - R15 are x64 only
+		R9,
+		R10,
+		R11,
+		R12,
+		R13,
+		R14,
+		R15,
+		Flags
+	};
+
+	/**
+	 * Registers at the hooked instruction, laid out exactly as the mid-function stub pushes them.
+	 * Handlers may change any field but the stack pointer, the stub restores the context as left by the last
+	 * handler. Only the low 128 bits of the vector registers are captured.
+	 */
+	struct MidContext {
+		union Xmm {
+			float f32[4];
+			double f64[2];
+			uint32_t u32[4];
+			uint64_t u64[2];
+		};
+
+#ifdef POLYHOOK2_ARCH_X64
+		static constexpr size_t kXmmCount = 16;
+
+		Xmm xmm[kXmmCount];
+		uintptr_t rsp;
+		uintptr_t r15, r14, r13, r12, r11, r10, r9, r8;
+		uintptr_t rdi, rsi, rbp, rbx, rdx, rcx, rax;
+		uintptr_t flags;
+#else
+		static constexpr size_t kXmmCount = 8;
+
+		Xmm xmm[kXmmCount];
+		uintptr_t rdi, rsi, rbp, rsp, rbx, rdx, rcx, rax; ///< pushad order, named after their x64 counterparts
+		uintptr_t flags;
+#endif
+
+		/// nullptr for registers the architecture does not have
+		uintptr_t* getRegister(Register reg) noexcept;
+		Xmm* getXmm(size_t index) noexcept { return index < kXmmCount ? &xmm[index] : nullptr; }
+	};
+
+	/**
+	 * Hook placed on any instruction instead of a function entry, for reading or changing state in the middle
+	 * of a function without knowing its signature. The stub saves the flags, general purpose and XMM registers
+	 * into a MidContext with plain pushes and unaligned moves, calls every handler with it, restores it and
+	 * resumes through the detour trampoline, which replays the relocated instructions.
+	 *
+	 * The detour overwrites the instruction at the address and the ones following it up to the size of a jump.
+	 * None of them may be a branch target.
+	 */
+	class MidHook {
+	public:
+		typedef void (*MidHandler)(MidHook* hook, MidContext* context);
+
+		explicit MidHook(std::weak_ptr<asmjit::JitRuntime> rt);
+		~MidHook();
+		MidHook(const MidHook&) = delete;
+		MidHook& operator=(const MidHook&) = delete;
+
+		uint64_t getJitFunc();
+
+		uint64_t* getTrampolineHolder() noexcept { return &m_trampolinePtr; }
+		uint64_t getFunctionSize() const noexcept { return m_functionSize; }
+		std::string_view getError() const noexcept;
+		void setName(std::string name);
+
+		bool addHandler(MidHandler handler);
+		bool removeHandler(MidHandler handler);
+		bool isHandlerRegistered(MidHandler handler) const noexcept;
+		bool areHandlersRegistered() const noexcept;
+
+	private:
+		static void dispatch(MidHook* hook, MidContext* context);
+
+		std::weak_ptr<asmjit::JitRuntime> m_rt;
+		uint64_t m_functionPtr = 0;
+		uint64_t m_functionSize = 0;
+		uint64_t m_trampolinePtr = 0;
+		const char* m_errorCode = nullptr;
+		std::string m_name;
+		mutable std::shared_mutex m_mutex;
+		std::vector<MidHandler> m_handlers;
+	};
+}
@@ -0,0 +1,133 @@
+#include "modules.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#if defined(__linux__)
+	struct Search {
+		std::string_view name;
+		size_t visited = 0;
+		std::optional<PLH::LoadedModule> module;
+	};
+
+	// The main executable is always reported first and without a name
+	int FindModule(dl_phdr_info* info, size_t, void* data) {
+		auto* search = static_cast<Search*>(data);
+		const std::string_view path = info->dlpi_name ? info->dlpi_name : "";
+		const bool main = search->visited++ == 0;
+
+		if (search->name.empty()) {
+			if (!main)
+				return 0;
+		} else if (path != search->name && path.substr(path.find_last_of('/') + 1) != search->name) {
+			return 0;
+		}
+
+		auto& module = search->module.emplace();
+		module.path = path;
+		module.base = info->dlpi_addr;
+		for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+			const auto& header = info->dlpi_phdr[i];
+			if (header.p_type == PT_DYNAMIC) {
+				module.dynamic = info->dlpi_addr + header.p_vaddr;
+			} else if (header.p_type == PT_LOAD) {
+				const uintptr_t begin = info->dlpi_addr + header.p_vaddr;
+				module.segments.push_back({begin, begin + header.p_memsz, (header.p_flags & PF_X) != 0});
+			}
+		}
+		return 1;
+	}
+
+	constexpr unsigned char kElfClass = sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32;
+
+	void ReadFunctions(const uint8_t* image, size_t size, uintptr_t base, std::vector<PLH::LoadedModule::Symbol>& functions) {
+		const auto* header = reinterpret_cast<const ElfW(Ehdr)*>(image);
+		if (size < sizeof(ElfW(Ehdr)) || std::memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != kElfClass)
+			return;
+		if (header->e_shoff == 0 || header->e_shoff > size || header->e_shnum > (size - header->e_shoff) / sizeof(ElfW(Shdr)))
+			return;
+
+		const auto* sections = reinterpret_cast<const ElfW(Shdr)*>(image + header->e_shoff);
+		auto inside = [size](const ElfW(Shdr)& section) {
+			return section.sh_offset <= size && section.sh_size <= size - section.sh_offset;
+		};
+
+		for (ElfW(Half) i = 0; i < header->e_shnum; ++i) {
+			const auto& table = sections[i];
+			if ((table.sh_type != SHT_SYMTAB && table.sh_type != SHT_DYNSYM) || table.sh_link >= header->e_shnum)
+				continue;
+			const auto& names = sections[table.sh_link];
+			if (!inside(table) || !inside(names))
+				continue;
+
+			const auto* strings = reinterpret_cast<const char*>(image + names.sh_offset);
+			const auto* begin = reinterpret_cast<const ElfW(Sym)*>(image + table.sh_offset);
+			const auto* end = begin + table.sh_size / sizeof(ElfW(Sym));
+			for (const ElfW(Sym)* symbol = begin; symbol != end; ++symbol) {
+				if (ELF64_ST_TYPE(symbol->st_info) != STT_FUNC || symbol->st_shndx == SHN_UNDEF || symbol->st_value == 0)
+					continue;
+				if (symbol->st_name >= names.sh_size)
+					continue;
+				const char* name = strings + symbol->st_name;
+				functions.push_back({std::string(name, strnlen(name, names.sh_size - symbol->st_name)), base + symbol->st_value, symbol->st_size});
+			}
+		}
+	}
+#endif
+}
+
+bool PLH::LoadedModule::contains(uintptr_t address) const noexcept {
+	for (const auto& segment : segments) {
+		if (address >= segment.begin && address < segment.end)
+			return true;
+	}
+	return false;
+}
+
+std::vector<PLH::LoadedModule::Symbol> PLH::LoadedModule::getFunctions() const {
+	std::vector<Symbol> functions;
+#if defined(__linux__)
+	// the loader maps no section headers, read the file the module was loaded from
+	const int fd = open(path.empty() ? "/proc/self/exe" : path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return functions;
+
+	struct stat info{};
+	void* image = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		image = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (image == MAP_FAILED)
+		return functions;
+
+	ReadFunctions(static_cast<const uint8_t*>(image), static_cast<size_t>(info.st_size), base, functions);
+	munmap(image, static_cast<size_t>(info.st_size));
+
+	// .symtab repeats every exported function, local aliases and versioned names share addresses too
+	std::stable_sort(functions.begin(), functions.end(), [](const Symbol& a, const Symbol& b) { return a.address < b.address; });
+	functions.erase(std::unique(functions.begin(), functions.end(), [](const Symbol& a, const Symbol& b) { return a.address == b.address; }), functions.end());
+#endif
+	return functions;
+}
+
+std::optional<PLH::LoadedModule> PLH::LoadedModule::find(std::string_view name) {
+#if defined(__linux__)
+	Search search;
+	search.name = name;
+	dl_iterate_phdr(&FindModule, &search);
+	return std::move(search.module);
+#else
+	(void) name;
+	return std::nullopt;
+#endif
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace PLH {
+	/**
+	 * A loaded object as reported by the dynamic loader. Looked up by full path or file name, an empty name
+	 * selects the main executable. Linux only, elsewhere nothing is found.
+	 */
+	struct LoadedModule {
+		struct Segment {
+			uintptr_t begin;
+			uintptr_t end;
+			bool executable;
+		};
+
+		struct Symbol {
+			std::string name;
+			uintptr_t address;
+			size_t size;
+		};
+
+		std::string path;
+		uintptr_t base = 0;
+		uintptr_t dynamic = 0; ///< runtime address of the dynamic section, 0 for static objects
+		std::vector<Segment> segments;
+
+		bool contains(uintptr_t address) const noexcept;
+
+		/// functions defined in the file's .symtab and .dynsym, sorted by address with aliases dropped
+		std::vector<Symbol> getFunctions() const;
+
+		static std::optional<LoadedModule> find(std::string_view name);
+	};
+}
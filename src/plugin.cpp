@@ -1,5 +1,14 @@
 #include "plugin.hpp"
+#include "modules.hpp"
 #include <dynlibutils/module.hpp>
+#include <plugify/compat_format.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__linux__)
+#include <dlfcn.h>
+#endif
 
 PLH::PolyHookPlugin g_polyHookPlugin;
 EXPOSE_PLUGIN(PLUGIN_API, PLH::PolyHookPlugin, &g_polyHookPlugin)
@@ -8,20 +17,51 @@ using namespace PLH;
 using enum CallbackType;
 using namespace std::chrono_literals;
 
+static constexpr auto kLayoutInterval = 5s;
+static constexpr auto kCacheFlushInterval = 30s;
+static constexpr size_t kHotMinCalls = 1000;
+
+static bool IsRecording(const Callback* callback) {
+	const CallRecorder* recorder = callback->getRecorder();
+	return recorder && recorder->isOpen();
+}
+
 static void PreCallback(Callback* callback, const Callback::Parameters* params, size_t count, const Callback::Return* ret, ReturnFlag* flag) {
 	callback->cleanup();
 
+	if (Metrics::isEnabled() && Metrics::isSampled(callback->getCallCount())) {
+		Metrics::enter(params);
+		*flag |= ReturnFlag::LatencySample;
+	}
+
+	// begins before the handlers, so their spans nest inside the hook's
+	const bool timeline = Timeline::isEnabled();
+	if (timeline) {
+		Timeline::begin(callback);
+		*flag |= ReturnFlag::TimelineFrame;
+	}
+
 	auto [callbacks, lock] = callback->getCallbacks(Pre);
 
 	ReturnAction returnAction = ReturnAction::Ignored;
 
 	for (const auto& cb : callbacks) {
+		const uint64_t start = timeline ? Timeline::now() : 0;
 		ReturnAction result = cb(callback, params, static_cast<int32_t>(count), ret, Pre);
+		if (timeline) {
+			Timeline::handler(reinterpret_cast<const void*>(cb), start);
+		}
 		if (result > returnAction)
 			returnAction = result;
 	}
 
-	if (!callback->areCallbacksRegistered(Post)) {
+	// opened after the handlers ran, the frame times the original and the hooks it calls
+	if (CallTree::isEnabled()) {
+		CallTree::enter(callback, params);
+		*flag |= ReturnFlag::TreeFrame;
+	}
+
+	if (!callback->areCallbacksRegistered(Post) && !(*flag & (ReturnFlag::TreeFrame | ReturnFlag::TimelineFrame | ReturnFlag::LatencySample)) && !callback->isTraced() && !IsRecording(callback)) {
 		*flag |= ReturnFlag::NoPost;
 	}
 	if (returnAction >= ReturnAction::Supercede) {
@@ -29,38 +69,255 @@ static void PreCallback(Callback* callback, const Callback::Parameters* params,
 	}
 }
 
-static void PostCallback(Callback* callback, const Callback::Parameters* params, size_t count, const Callback::Return* ret, ReturnFlag*) {
+static void PostCallback(Callback* callback, const Callback::Parameters* params, size_t count, const Callback::Return* ret, ReturnFlag* flag) {
+	if (*flag & ReturnFlag::TreeFrame) {
+		CallTree::leave(params);
+	}
+	// before the handlers, the record holds what the original returned
+	if (callback->isTraced()) {
+		TraceBuffer::record(callback, params, count, ret);
+	}
+	if (IsRecording(callback)) {
+		callback->getRecorder()->record(params, count, ret);
+	}
+
 	auto [callbacks, lock] = callback->getCallbacks(Post);
 
+	const bool timeline = *flag & ReturnFlag::TimelineFrame;
 	for (const auto& cb : callbacks) {
+		const uint64_t start = timeline ? Timeline::now() : 0;
 		cb(callback, params, static_cast<int32_t>(count), ret, Post);
+		if (timeline) {
+			Timeline::handler(reinterpret_cast<const void*>(cb), start);
+		}
 	}
+
+	if (timeline) {
+		Timeline::end();
+	}
+	if (*flag & ReturnFlag::LatencySample) {
+		if (const uint64_t elapsed = Metrics::leave(params)) {
+			callback->getLatency().add(elapsed);
+		}
+	}
+}
+
+static std::string_view GetTypeName(DataType type) {
+	switch (type) {
+		case DataType::Void: return "void";
+		case DataType::Bool: return "bool";
+		case DataType::Int8: return "int8";
+		case DataType::UInt8: return "uint8";
+		case DataType::Int16: return "int16";
+		case DataType::UInt16: return "uint16";
+		case DataType::Int32: return "int32";
+		case DataType::UInt32: return "uint32";
+		case DataType::Int64: return "int64";
+		case DataType::UInt64: return "uint64";
+		case DataType::Float: return "float";
+		case DataType::Double: return "double";
+		case DataType::Pointer: return "ptr";
+		case DataType::String: return "string";
+	}
+	return "?";
+}
+
+// Resolves a readable name for the hooked target, used to symbolize JIT stubs in perf and gdb
+static std::string GetTargetName(void* pFunc) {
+	std::string target;
+#if defined(__linux__)
+	Dl_info info{};
+	if (pFunc && dladdr(pFunc, &info)) {
+		if (info.dli_sname && info.dli_saddr == pFunc) {
+			target = info.dli_sname;
+		} else if (info.dli_fname) {
+			std::string_view module = info.dli_fname;
+			module = module.substr(module.find_last_of('/') + 1);
+			target = std::format("{}+0x{:x}", module, reinterpret_cast<uintptr_t>(pFunc) - reinterpret_cast<uintptr_t>(info.dli_fbase));
+		}
+	}
+#endif
+	if (target.empty()) {
+		target = std::format("0x{:x}", reinterpret_cast<uintptr_t>(pFunc));
+	}
+	return target;
+}
+
+static std::string GetStubName(void* pFunc, const Signature* signature) {
+	std::string name = std::format("polyhook::{} {}(", GetTargetName(pFunc), GetTypeName(signature->returnType));
+	for (size_t i = 0; i < signature->arguments.size(); ++i) {
+		if (i != 0)
+			name += ',';
+		name += GetTypeName(signature->arguments[i]);
+	}
+	name += ')';
+	return name;
+}
+
+// Import hooks are keyed by the importer's path as the loader reports it, a file name and a full path of
+// the same object resolve to the same GOT slots and must find the same hook
+static std::pair<std::string, std::string> GetImportKey(std::string_view module, std::string_view symbol) {
+	auto loaded = LoadedModule::find(module);
+	return {loaded ? std::move(loaded->path) : std::string(module), std::string(symbol)};
+}
+
+// Number of stubs kept in the hot region, POLYHOOK_HOT_STUBS=<n> (unset or 0 disables the layout pass)
+static size_t GetHotStubLimit() {
+	const char* value = std::getenv("POLYHOOK_HOT_STUBS");
+	if (!value || !*value)
+		return 0;
+	return static_cast<size_t>(std::strtoul(value, nullptr, 10));
+}
+
+// Hook health is written to polyhook.prom in the logs directory every POLYHOOK_METRICS=<seconds> (unset or 0 disables)
+static std::chrono::seconds GetMetricsInterval() {
+	if (!plg::plugin::GetLogsDir)
+		return {};
+	const char* value = std::getenv("POLYHOOK_METRICS");
+	if (!value || !*value)
+		return {};
+	return std::chrono::seconds(std::strtoul(value, nullptr, 10));
+}
+
+// Stub templates persist in the plugin data directory unless POLYHOOK_STUB_CACHE=0, plugify has to provide one
+static bool IsStubCacheEnabled() {
+	if (!plg::plugin::GetDataDir || !plg::plugin::GetVersion)
+		return false;
+	const char* value = std::getenv("POLYHOOK_STUB_CACHE");
+	return !value || value[0] != '0';
+}
+
+// Call tree instrumentation from the start with POLYHOOK_CALL_TREE=1, it can also be switched at runtime
+static bool IsCallTreeEnabled() {
+	const char* value = std::getenv("POLYHOOK_CALL_TREE");
+	return value && value[0] == '1';
+}
+
+// Recordings and timelines given by a relative path go to the logs directory
+static std::filesystem::path GetLogPath(std::string_view path) {
+	std::filesystem::path result(path);
+	if (result.is_relative() && plg::plugin::GetLogsDir)
+		return std::filesystem::path(g_polyHookPlugin.GetLogsDir()) / result;
+	return result;
+}
+
+// Hook activity streams into timeline.json in the logs directory with POLYHOOK_TIMELINE=1
+static bool IsTimelineEnabled() {
+	if (!plg::plugin::GetLogsDir)
+		return false;
+	const char* value = std::getenv("POLYHOOK_TIMELINE");
+	return value && value[0] == '1';
+}
+
+// Traced calls stream into the logs directory with POLYHOOK_TRACE_FILE=<MiB>, unset or 0 keeps them in memory
+static size_t GetTraceFileSize() {
+	if (!plg::plugin::GetLogsDir)
+		return 0;
+	const char* value = std::getenv("POLYHOOK_TRACE_FILE");
+	if (!value || !*value)
+		return 0;
+	return static_cast<size_t>(std::strtoul(value, nullptr, 10)) * 1024 * 1024;
 }
 
 void PolyHookPlugin::OnPluginStart() {
-	m_jitRuntime = std::make_unique<asmjit::JitRuntime>();
+	CallTree::setEnabled(IsCallTreeEnabled());
+	m_jitRuntime = std::make_shared<JitArena>();
+	m_tier = TieredCompiler::create(m_jitRuntime);
+
+	if (IsStubCacheEnabled()) {
+		StubCache::instance().open(std::filesystem::path(GetDataDir()) / "stubs.bin", *m_jitRuntime, GetVersion());
+		m_nextCacheFlush = Clock::now() + kCacheFlushInterval;
+	}
+
+	// after the cache is loaded, shapes it already has are not compiled again
+	if (Warmup::isEnabled()) {
+		auto config = plg::plugin::GetConfigsDir ? WarmupConfig::load(std::filesystem::path(GetConfigsDir()) / "warmup.cfg") : WarmupConfig::getDefault();
+		m_warmup = std::make_unique<Warmup>(m_jitRuntime, std::move(config));
+	}
+
+	// only tiered hooks enter through a thunk which can be repointed
+	m_hotStubLimit = m_tier ? GetHotStubLimit() : 0;
+	m_nextLayout = Clock::now() + kLayoutInterval;
+
+	if (size_t size = GetTraceFileSize()) {
+		auto writer = std::make_unique<TraceWriter>(std::filesystem::path(GetLogsDir()) / "trace.bin", size);
+		if (writer->isOpen()) {
+			m_traceWriter = std::move(writer);
+		}
+	}
+
+	if (IsTimelineEnabled()) {
+		Timeline::open(std::filesystem::path(GetLogsDir()) / "timeline.json");
+	}
+
+	m_lastMetrics = Clock::now();
+	m_metricsInterval = GetMetricsInterval();
+	if (m_metricsInterval.count()) {
+		Metrics::setEnabled(true);
+		m_nextMetrics = m_lastMetrics + m_metricsInterval;
+	}
 }
 
 void PolyHookPlugin::OnPluginUpdate(float dt) {
 	if (!m_removals.empty() && Clock::now() >= m_removals.top().when) {
 		m_removals.pop();
 	}
+
+	if (m_hotStubLimit && Clock::now() >= m_nextLayout) {
+		layoutHotStubs();
+		m_nextLayout = Clock::now() + kLayoutInterval;
+	}
+
+	// restarts are not always clean, do not wait for OnPluginEnd to persist new stubs
+	if (Clock::now() >= m_nextCacheFlush) {
+		StubCache::instance().save();
+		m_nextCacheFlush = Clock::now() + kCacheFlushInterval;
+	}
+
+	if (Clock::now() >= m_nextMetrics) {
+		if (!collectMetrics().write(std::filesystem::path(GetLogsDir()) / "polyhook.prom")) {
+			std::puts("PolyHook: failed to write metrics");
+		}
+		m_nextMetrics = Clock::now() + m_metricsInterval;
+	}
+
+	// every frame, the rings only hold a few frames worth of calls at millions per second
+	if (m_traceWriter) {
+		m_traceWriter->flush();
+	}
+	Timeline::flush();
 }
 
 void PolyHookPlugin::OnPluginEnd() {
+	m_warmup.reset();
+
 	unhookAll();
 
 	while (!m_removals.empty()) {
 		m_removals.pop();
 	}
+	m_retiredExitHooks.clear();
+	m_retiredProfiles.clear();
+	m_traceWriter.reset();
+	Timeline::close();
+	Metrics::setEnabled(false);
+
+	StubCache::instance().save();
+	StubCache::instance().close();
 
+	m_tier.reset();
 	m_jitRuntime.reset();
 }
 
 Callback* PolyHookPlugin::hookDetour(void* pFunc, DataType returnType, std::span<const DataType> arguments, uint8_t varIndex) {
-	if (!pFunc)
+	return hookDetour(pFunc, SignatureTable::instance().intern(returnType, arguments, varIndex));
+}
+
+Callback* PolyHookPlugin::hookDetour(void* pFunc, const Signature* signature) {
+	if (!pFunc || !signature)
 		return nullptr;
 
+	Timeline::Span span("HookDetour", pFunc);
 	std::lock_guard lock(m_mutex);
 
 	auto it = m_detours.find(pFunc);
@@ -68,9 +325,13 @@ Callback* PolyHookPlugin::hookDetour(void* pFunc, DataType returnType, std::span
 		return it->second.callback.get();
 	}
 
+	JitArena::NearScope near(pFunc);
+
 	auto callback = std::make_unique<Callback>(m_jitRuntime);
+	callback->setName(GetStubName(pFunc, signature));
+	Timeline::setName(callback.get(), callback->getName());
 
-	uint64_t JIT = callback->getJitFunc(returnType, arguments, &PreCallback, &PostCallback, varIndex);
+	uint64_t JIT = callback->getTieredFunc(signature, &PreCallback, &PostCallback, m_tier);
 
 	auto error = callback->getError();
 	if (!error.empty()) {
@@ -86,9 +347,18 @@ Callback* PolyHookPlugin::hookDetour(void* pFunc, DataType returnType, std::span
 }
 
 Callback* PolyHookPlugin::hookVirtual(void* pClass, int index, DataType returnType, std::span<const DataType> arguments, uint8_t varIndex) {
-	if (!pClass || index == -1)
+	return hookVirtual(pClass, index, SignatureTable::instance().intern(returnType, arguments, varIndex));
+}
+
+Callback* PolyHookPlugin::hookVirtual(void* pClass, void* pFunc, DataType returnType, std::span<const DataType> arguments, uint8_t varIndex) {
+	return hookVirtual(pClass, getVirtualTableIndex(pFunc), returnType, arguments, varIndex);
+}
+
+Callback* PolyHookPlugin::hookVirtual(void* pClass, int index, const Signature* signature) {
+	if (!pClass || index == -1 || !signature)
 		return nullptr;
 
+	Timeline::Span span("HookVirtual", pClass);
 	std::lock_guard lock(m_mutex);
 
 	auto it = m_vhooks.find(pClass);
@@ -105,8 +375,13 @@ Callback* PolyHookPlugin::hookVirtual(void* pClass, int index, DataType returnTy
 
 	auto& [vtable, callbacks, redirectMap, origVFuncs] = it->second;
 
+	void* pFunc = (*reinterpret_cast<void***>(pClass))[index];
+	JitArena::NearScope near(pFunc);
+
 	auto& callback = callbacks.emplace(index, std::make_unique<Callback>(m_jitRuntime)).first->second;
-	uint64_t JIT = callback->getJitFunc(returnType, arguments, &PreCallback, &PostCallback, varIndex);
+	callback->setName(GetStubName(pFunc, signature));
+	Timeline::setName(callback.get(), callback->getName());
+	uint64_t JIT = callback->getTieredFunc(signature, &PreCallback, &PostCallback, m_tier);
 
 	auto error = callback->getError();
 	if (!error.empty()) {
@@ -131,14 +406,185 @@ Callback* PolyHookPlugin::hookVirtual(void* pClass, int index, DataType returnTy
 	return callback.get();
 }
 
-Callback* PolyHookPlugin::hookVirtual(void* pClass, void* pFunc, DataType returnType, std::span<const DataType> arguments, uint8_t varIndex) {
-	return hookVirtual(pClass, getVirtualTableIndex(pFunc), returnType, arguments, varIndex);
+Callback* PolyHookPlugin::hookVirtual(void* pClass, void* pFunc, const Signature* signature) {
+	return hookVirtual(pClass, getVirtualTableIndex(pFunc), signature);
+}
+
+Callback* PolyHookPlugin::hookImport(std::string_view module, std::string_view symbol, DataType returnType, std::span<const DataType> arguments, uint8_t varIndex) {
+	return hookImport(module, symbol, SignatureTable::instance().intern(returnType, arguments, varIndex));
+}
+
+Callback* PolyHookPlugin::hookImport(std::string_view module, std::string_view symbol, const Signature* signature) {
+	if (symbol.empty() || !signature)
+		return nullptr;
+
+	Timeline::Span span("HookImport", symbol);
+	std::lock_guard lock(m_mutex);
+
+	auto key = GetImportKey(module, symbol);
+	auto it = m_imports.find(key);
+	if (it != m_imports.end()) {
+		return it->second.callback.get();
+	}
+
+	auto import = std::make_unique<ImportHook>(module, symbol);
+	if (!import->getTarget())
+		return nullptr;
+
+	void* pFunc = reinterpret_cast<void*>(import->getTarget());
+
+	auto callback = std::make_unique<Callback>(m_jitRuntime);
+	callback->setName(GetStubName(pFunc, signature));
+	Timeline::setName(callback.get(), callback->getName());
+
+	uint64_t JIT = callback->getTieredFunc(signature, &PreCallback, &PostCallback, m_tier);
+
+	auto error = callback->getError();
+	if (!error.empty()) {
+		std::puts(error.data());
+		std::terminate();
+	}
+
+	// the resolved GOT value is the original, calls to it skip the stub without any trampoline
+	if (!import->hook(JIT, callback->getTrampolineHolder()))
+		return nullptr;
+
+	return m_imports.emplace(std::move(key), GHook{std::move(import), std::move(callback)}).first->second.callback.get();
+}
+
+Callback* PolyHookPlugin::hookCallSites(void* pFunc, std::span<void* const> sites, DataType returnType, std::span<const DataType> arguments, uint8_t varIndex) {
+	return hookCallSites(pFunc, sites, SignatureTable::instance().intern(returnType, arguments, varIndex));
+}
+
+Callback* PolyHookPlugin::hookCallSites(void* pFunc, std::span<void* const> sites, const Signature* signature) {
+	if (!pFunc || sites.empty() || !signature)
+		return nullptr;
+
+	std::vector<uint64_t> addresses;
+	addresses.reserve(sites.size());
+	for (void* site : sites) {
+		addresses.push_back((uint64_t) site);
+	}
+
+	Timeline::Span span("HookCallSites", pFunc);
+	std::lock_guard lock(m_mutex);
+
+	// further sites for a hooked function share its stub
+	auto it = m_callSites.find(pFunc);
+	if (it != m_callSites.end()) {
+		if (!it->second.sites->hook(addresses))
+			return nullptr;
+		return it->second.callback.get();
+	}
+
+	// the entry thunk is what the sites call, it has to be within rel32 range of them
+	JitArena::NearScope near(addresses.front());
+
+	auto callback = std::make_unique<Callback>(m_jitRuntime);
+	callback->setName(GetStubName(pFunc, signature));
+	Timeline::setName(callback.get(), callback->getName());
+
+	uint64_t JIT = callback->getTieredFunc(signature, &PreCallback, &PostCallback, m_tier);
+
+	auto error = callback->getError();
+	if (!error.empty()) {
+		std::puts(error.data());
+		std::terminate();
+	}
+
+	// the callee is not patched, the stub calls it directly
+	*callback->getTrampolineHolder() = (uint64_t) pFunc;
+
+	auto callSites = std::make_unique<CallSiteHook>((uint64_t) pFunc, JIT);
+	if (!callSites->hook(addresses))
+		return nullptr;
+
+	return m_callSites.emplace(pFunc, CHook{std::move(callSites), std::move(callback)}).first->second.callback.get();
+}
+
+MidHook* PolyHookPlugin::hookMidFunction(void* pAddr) {
+	if (!pAddr)
+		return nullptr;
+
+	Timeline::Span span("HookMidFunction", pAddr);
+	std::lock_guard lock(m_mutex);
+
+	auto it = m_midHooks.find(pAddr);
+	if (it != m_midHooks.end()) {
+		return it->second.hook.get();
+	}
+
+	JitArena::NearScope near(pAddr);
+
+	auto hook = std::make_unique<MidHook>(m_jitRuntime);
+	hook->setName(std::format("polyhook::mid {}", GetTargetName(pAddr)));
+
+	uint64_t JIT = hook->getJitFunc();
+
+	auto error = hook->getError();
+	if (!error.empty()) {
+		std::puts(error.data());
+		std::terminate();
+	}
+
+	auto detour = std::make_unique<NatDetour>((uint64_t) pAddr, JIT, hook->getTrampolineHolder());
+	if (!detour->hook())
+		return nullptr;
+
+	return m_midHooks.emplace(pAddr, MHook{std::move(detour), std::move(hook)}).first->second.hook.get();
+}
+
+ExitHook* PolyHookPlugin::hookExit(void* pFunc) {
+	if (!pFunc)
+		return nullptr;
+
+	Timeline::Span span("HookExit", pFunc);
+	std::lock_guard lock(m_mutex);
+
+	auto it = m_exitHooks.find(pFunc);
+	if (it != m_exitHooks.end()) {
+		return it->second.hook.get();
+	}
+
+	JitArena::NearScope near(pFunc);
+
+	auto hook = std::make_unique<ExitHook>(m_jitRuntime);
+	hook->setName(std::format("polyhook::exit {}", GetTargetName(pFunc)));
+
+	uint64_t JIT = hook->getJitFunc();
+
+	// unlike a stub compile failure this depends on the platform, report it instead of terminating
+	auto error = hook->getError();
+	if (!error.empty()) {
+		std::puts(error.data());
+		return nullptr;
+	}
+
+	auto detour = std::make_unique<NatDetour>((uint64_t) pFunc, JIT, hook->getTrampolineHolder());
+	if (!detour->hook())
+		return nullptr;
+
+	return m_exitHooks.emplace(pFunc, EHook{std::move(detour), std::move(hook)}).first->second.hook.get();
+}
+
+ModuleProfile* PolyHookPlugin::profileModule(std::string_view module, std::string_view filter, uint32_t sampleShift) {
+	Timeline::Span span("ProfileModule", module);
+	std::lock_guard lock(m_mutex);
+
+	auto profile = std::make_unique<ModuleProfile>(m_jitRuntime, module, filter, sampleShift);
+	if (!profile->hook()) {
+		std::puts(profile->getError().data());
+		return nullptr;
+	}
+
+	return m_profiles.emplace_back(std::move(profile)).get();
 }
 
 bool PolyHookPlugin::unhookDetour(void* pFunc) {
 	if (!pFunc)
 		return false;
 
+	Timeline::Span span("UnhookDetour", pFunc);
 	std::lock_guard lock(m_mutex);
 
 	auto it = m_detours.find(pFunc);
@@ -157,6 +603,7 @@ bool PolyHookPlugin::unhookVirtual(void* pClass, int index) {
 	if (!pClass || index == -1)
 		return false;
 
+	Timeline::Span span("UnhookVirtual", pClass);
 	std::lock_guard lock(m_mutex);
 
 	auto it = m_vhooks.find(pClass);
@@ -196,6 +643,100 @@ bool PolyHookPlugin::unhookVirtual(void* pClass, void* pFunc) {
 	return unhookVirtual(pClass, getVirtualTableIndex(pFunc));
 }
 
+bool PolyHookPlugin::unhookImport(std::string_view module, std::string_view symbol) {
+	Timeline::Span span("UnhookImport", symbol);
+	std::lock_guard lock(m_mutex);
+
+	auto it = m_imports.find(GetImportKey(module, symbol));
+	if (it != m_imports.end()) {
+		auto& [import, callback] = it->second;
+		import->unHook();
+		m_removals.push({std::move(callback), Clock::now() + 1s});
+		m_imports.erase(it);
+		return true;
+	}
+
+	return false;
+}
+
+bool PolyHookPlugin::unhookMidFunction(void* pAddr) {
+	if (!pAddr)
+		return false;
+
+	Timeline::Span span("UnhookMidFunction", pAddr);
+	std::lock_guard lock(m_mutex);
+
+	auto it = m_midHooks.find(pAddr);
+	if (it != m_midHooks.end()) {
+		auto& [detour, hook] = it->second;
+		detour->unHook();
+		m_removals.push({nullptr, Clock::now() + 1s, std::move(hook)});
+		m_midHooks.erase(it);
+		return true;
+	}
+
+	return false;
+}
+
+bool PolyHookPlugin::unhookExit(void* pFunc) {
+	if (!pFunc)
+		return false;
+
+	Timeline::Span span("UnhookExit", pFunc);
+	std::lock_guard lock(m_mutex);
+
+	auto it = m_exitHooks.find(pFunc);
+	if (it != m_exitHooks.end()) {
+		auto& [detour, hook] = it->second;
+		detour->unHook();
+		// calls entered before the unhook still return through the hook, keep it until plugin end
+		hook->clearHandlers();
+		m_retiredExitHooks.push_back(std::move(hook));
+		m_exitHooks.erase(it);
+		return true;
+	}
+
+	return false;
+}
+
+bool PolyHookPlugin::unprofileModule(ModuleProfile* profile) {
+	if (!profile)
+		return false;
+
+	Timeline::Span span("UnprofileModule", profile);
+	std::lock_guard lock(m_mutex);
+
+	auto it = std::find_if(m_profiles.begin(), m_profiles.end(), [profile](const auto& p) { return p.get() == profile; });
+	if (it != m_profiles.end()) {
+		(*it)->unHook();
+		// like exit hooks, sampled calls may still return through the profile
+		m_retiredProfiles.push_back(std::move(*it));
+		m_profiles.erase(it);
+		return true;
+	}
+
+	return false;
+}
+
+bool PolyHookPlugin::unhookCallSites(void* pFunc) {
+	if (!pFunc)
+		return false;
+
+	Timeline::Span span("UnhookCallSites", pFunc);
+	std::lock_guard lock(m_mutex);
+
+	auto it = m_callSites.find(pFunc);
+	if (it != m_callSites.end()) {
+		auto& [sites, callback] = it->second;
+		sites->unHook();
+		m_removals.push({std::move(callback), Clock::now() + 1s});
+		m_callSites.erase(it);
+		return true;
+	}
+
+	return false;
+}
+
 Callback* PolyHookPlugin::findDetour(void* pFunc) const {
 	auto it = m_detours.find(pFunc);
 	if (it != m_detours.end()) {
@@ -220,14 +761,63 @@ Callback* PolyHookPlugin::findVirtual(void* pClass, void* pFunc) const {
 	return findVirtual(pClass, getVirtualTableIndex(pFunc));
 }
 
+Callback* PolyHookPlugin::findImport(std::string_view module, std::string_view symbol) const {
+	auto it = m_imports.find(GetImportKey(module, symbol));
+	if (it != m_imports.end()) {
+		return it->second.callback.get();
+	}
+	return nullptr;
+}
+
+MidHook* PolyHookPlugin::findMidFunction(void* pAddr) const {
+	auto it = m_midHooks.find(pAddr);
+	if (it != m_midHooks.end()) {
+		return it->second.hook.get();
+	}
+	return nullptr;
+}
+
+ExitHook* PolyHookPlugin::findExit(void* pFunc) const {
+	auto it = m_exitHooks.find(pFunc);
+	if (it != m_exitHooks.end()) {
+		return it->second.hook.get();
+	}
+	return nullptr;
+}
+
+Callback* PolyHookPlugin::findCallSites(void* pFunc) const {
+	auto it = m_callSites.find(pFunc);
+	if (it != m_callSites.end()) {
+		return it->second.callback.get();
+	}
+	return nullptr;
+}
+
 void PolyHookPlugin::unhookAll() {
+	Timeline::Span span("UnhookAll", std::string_view{});
 	std::lock_guard lock(m_mutex);
 
 	m_detours.clear();
 	m_vhooks.clear();
+	m_imports.clear();
+	m_callSites.clear();
+	m_midHooks.clear();
+	for (auto& [_, exit] : m_exitHooks) {
+		exit.detour->unHook();
+		exit.hook->clearHandlers();
+		m_retiredExitHooks.push_back(std::move(exit.hook));
+	}
+	m_exitHooks.clear();
+	for (auto& profile : m_profiles) {
+		profile->unHook();
+		m_retiredProfiles.push_back(std::move(profile));
+	}
+	m_profiles.clear();
+	m_hotStubs.clear();
 }
 
 void PolyHookPlugin::unhookAllVirtual(void* pClass) {
+	Timeline::Span span("UnhookAllVirtual", pClass);
 	std::lock_guard lock(m_mutex);
 
 	auto it = m_vhooks.find(pClass);
@@ -236,6 +826,182 @@ void PolyHookPlugin::unhookAllVirtual(void* pClass) {
 	}
 }
 
+void PolyHookPlugin::layoutHotStubs() {
+	std::lock_guard lock(m_mutex);
+
+	std::vector<std::pair<size_t, Callback*>> samples;
+	auto sample = [&](Callback* callback) {
+		const size_t calls = callback->sampleCalls();
+		if (calls >= kHotMinCalls && callback->isPromoted()) {
+			samples.emplace_back(calls, callback);
+		}
+	};
+	for (const auto& [_, hook] : m_detours) {
+		sample(hook.callback.get());
+	}
+	for (const auto& [_, hook] : m_vhooks) {
+		for (const auto& [_, callback] : hook.callbacks) {
+			sample(callback.get());
+		}
+	}
+	for (const auto& [_, hook] : m_imports) {
+		sample(hook.callback.get());
+	}
+	for (const auto& [_, hook] : m_callSites) {
+		sample(hook.callback.get());
+	}
+
+	const size_t count = std::min(samples.size(), m_hotStubLimit);
+	std::partial_sort(samples.begin(), samples.begin() + static_cast<ptrdiff_t>(count), samples.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+	std::vector<Callback*> hot;
+	hot.reserve(count);
+	for (size_t i = 0; i < count; ++i) {
+		hot.push_back(samples[i].second);
+	}
+
+	// re-emitting is only worth it when the set changed, not when the order shuffles
+	std::vector<Callback*> sorted = hot;
+	std::sort(sorted.begin(), sorted.end());
+	if (sorted == m_hotStubs)
+		return;
+	m_hotStubs = std::move(sorted);
+
+	// hottest first, back to back in the hot region, the entry thunks are repointed one by one
+	// stubs already moved stay where they are, every hook keeps its old copy until it is removed
+	JitArena::HotScope scope;
+	for (Callback* callback : hot) {
+		callback->relocate();
+	}
+}
+
+JitArena::Statistics PolyHookPlugin::getJitStatistics() const {
+	if (!m_jitRuntime)
+		return {};
+	return m_jitRuntime->getStatistics();
+}
+
+Metrics PolyHookPlugin::collectMetrics() {
+	std::lock_guard lock(m_mutex);
+
+	// names repeat, one implementation behind several vtables or one symbol imported by several modules,
+	// the id label keeps every hook its own series
+	struct Hook {
+		std::string_view type;
+		Callback* callback;
+		std::string id;
+	};
+	std::vector<Hook> hooks;
+	size_t virtuals = 0;
+	auto add = [&](std::string_view type, Callback* callback) {
+		hooks.push_back({type, callback, std::to_string(callback->getId())});
+	};
+	for (const auto& [_, hook] : m_detours) {
+		add("detour", hook.callback.get());
+	}
+	for (const auto& [_, hook] : m_vhooks) {
+		for (const auto& [_, callback] : hook.callbacks) {
+			add("virtual", callback.get());
+		}
+		virtuals += hook.callbacks.size();
+	}
+	for (const auto& [_, hook] : m_imports) {
+		add("import", hook.callback.get());
+	}
+	for (const auto& [_, hook] : m_callSites) {
+		add("callsite", hook.callback.get());
+	}
+
+	Metrics metrics;
+	metrics.addFamily("polyhook_hooks", "gauge", "Installed hooks by type");
+	metrics.add("polyhook_hooks", {{"type", "detour"}}, static_cast<double>(m_detours.size()));
+	metrics.add("polyhook_hooks", {{"type", "virtual"}}, static_cast<double>(virtuals));
+	metrics.add("polyhook_hooks", {{"type", "import"}}, static_cast<double>(m_imports.size()));
+	metrics.add("polyhook_hooks", {{"type", "callsite"}}, static_cast<double>(m_callSites.size()));
+	metrics.add("polyhook_hooks", {{"type", "mid"}}, static_cast<double>(m_midHooks.size()));
+	metrics.add("polyhook_hooks", {{"type", "exit"}}, static_cast<double>(m_exitHooks.size()));
+	metrics.add("polyhook_hooks", {{"type", "profile"}}, static_cast<double>(m_profiles.size()));
+
+	// the rate covers the time since the previous collection, hooks installed in between count from zero
+	const TimePoint now = Clock::now();
+	const double seconds = std::chrono::duration<double>(now - m_lastMetrics).count();
+	std::unordered_map<uint64_t, size_t> calls;
+
+	metrics.addFamily("polyhook_hook_calls_total", "counter", "Calls of a callback hook");
+	for (const auto& [type, callback, id] : hooks) {
+		calls[callback->getId()] = callback->getCallCount();
+		metrics.add("polyhook_hook_calls_total", {{"hook", callback->getName()}, {"type", type}, {"id", id}}, static_cast<double>(calls[callback->getId()]));
+	}
+
+	metrics.addFamily("polyhook_hook_call_rate", "gauge", "Calls per second since the previous collection");
+	for (const auto& [type, callback, id] : hooks) {
+		// keyed by id, the slab hands a freed callback's address to the next hook
+		auto it = m_metricCalls.find(callback->getId());
+		const size_t delta = calls[callback->getId()] - (it != m_metricCalls.end() ? it->second : 0);
+		metrics.add("polyhook_hook_call_rate", {{"hook", callback->getName()}, {"type", type}, {"id", id}}, seconds > 0 ? static_cast<double>(delta) / seconds : 0);
+	}
+
+	metrics.addFamily("polyhook_hook_latency_seconds", "gauge", "Latency of sampled calls including handlers, from log2 buckets");
+	for (const auto& [type, callback, id] : hooks) {
+		const LatencyHistogram& latency = callback->getLatency();
+		for (const auto& [quantile, text] : {std::pair{0.5, "0.5"}, std::pair{0.9, "0.9"}, std::pair{0.99, "0.99"}}) {
+			metrics.add("polyhook_hook_latency_seconds", {{"hook", callback->getName()}, {"type", type}, {"id", id}, {"quantile", text}}, latency.getQuantile(quantile) * 1e-9);
+		}
+	}
+
+	metrics.addFamily("polyhook_hook_latency_samples_total", "counter", "Calls timed for the latency quantiles");
+	for (const auto& [type, callback, id] : hooks) {
+		metrics.add("polyhook_hook_latency_samples_total", {{"hook", callback->getName()}, {"type", type}, {"id", id}}, static_cast<double>(callback->getLatency().getCount()));
+	}
+
+	metrics.addFamily("polyhook_hook_handlers", "gauge", "Registered handlers");
+	for (const auto& [type, callback, id] : hooks) {
+		metrics.add("polyhook_hook_handlers", {{"hook", callback->getName()}, {"type", type}, {"id", id}, {"stage", "pre"}}, static_cast<double>(callback->getCallbackCount(Pre)));
+		metrics.add("polyhook_hook_handlers", {{"hook", callback->getName()}, {"type", type}, {"id", id}, {"stage", "post"}}, static_cast<double>(callback->getCallbackCount(Post)));
+	}
+
+	metrics.addFamily("polyhook_hook_string_storage_bytes", "gauge", "Bytes held by strings handlers stored for the current calls");
+	for (const auto& [type, callback, id] : hooks) {
+		metrics.add("polyhook_hook_string_storage_bytes", {{"hook", callback->getName()}, {"type", type}, {"id", id}}, static_cast<double>(callback->getStorageBytes()));
+	}
+
+	metrics.addFamily("polyhook_hook_lock_wait_seconds_total", "counter", "Time calls waited for the handler lock");
+	for (const auto& [type, callback, id] : hooks) {
+		metrics.add("polyhook_hook_lock_wait_seconds_total", {{"hook", callback->getName()}, {"type", type}, {"id", id}}, static_cast<double>(callback->getLockWait()) * 1e-9);
+	}
+
+	const JitArena::Statistics jit = m_jitRuntime ? m_jitRuntime->getStatistics() : JitArena::Statistics{};
+	metrics.addFamily("polyhook_jit_bytes", "gauge", "JIT memory for stubs and thunks");
+	metrics.add("polyhook_jit_bytes", {{"state", "used"}}, static_cast<double>(jit.usedSize));
+	metrics.add("polyhook_jit_bytes", {{"state", "reserved"}}, static_cast<double>(jit.reservedSize));
+
+	metrics.addFamily("polyhook_pending_removals", "gauge", "Removed hooks waiting for their delayed release");
+	metrics.add("polyhook_pending_removals", {}, static_cast<double>(m_removals.size()));
+
+	m_metricCalls = std::move(calls);
+	m_lastMetrics = now;
+	return metrics;
+}
+
+bool PolyHookPlugin::startRecording(Callback* callback, std::string_view path, uint64_t maxBytes) const {
+	if (!callback || !callback->getSignature())
+		return false;
+
+	if (!callback->makeRecorder().open(GetLogPath(path), maxBytes)) {
+		std::puts(std::format("PolyHook: cannot open recording {}", path).c_str());
+		return false;
+	}
+	return true;
+}
+
+std::string PolyHookPlugin::replayRecording(std::string_view path, void* pFunc, size_t threads, size_t passes) const {
+	CallReplayer replayer(m_jitRuntime);
+	CallReplayer::Statistics statistics;
+	if (!replayer.load(GetLogPath(path)) || !replayer.run(reinterpret_cast<uint64_t>(pFunc), threads, passes, statistics))
+		return std::format("replay failed: {}", replayer.getError());
+	return CallReplayer::format(statistics);
+}
+
 int PolyHookPlugin::getVirtualTableIndex(void* pFunc, ProtFlag flag) const {
 	constexpr size_t size = 12;
 
@@ -361,6 +1127,62 @@ extern "C" {
 		return g_polyHookPlugin.hookVirtual(pClass, pFunc, returnType, arguments.span(), static_cast<uint8_t>(varIndex));
 	}
 
+	PLUGIN_API const Signature* RegisterSignature(const plg::string& signature) {
+		return SignatureTable::instance().parse(signature);
+	}
+
+	PLUGIN_API Callback* HookDetourBySignature(void* pFunc, const plg::string& signature) {
+		return g_polyHookPlugin.hookDetour(pFunc, SignatureTable::instance().parse(signature));
+	}
+
+	PLUGIN_API Callback* HookVirtualBySignature(void* pClass, int index, const plg::string& signature) {
+		return g_polyHookPlugin.hookVirtual(pClass, index, SignatureTable::instance().parse(signature));
+	}
+
+	PLUGIN_API Callback* HookDetourByHandle(void* pFunc, const Signature* signature) {
+		return g_polyHookPlugin.hookDetour(pFunc, signature);
+	}
+
+	PLUGIN_API Callback* HookVirtualByHandle(void* pClass, int index, const Signature* signature) {
+		return g_polyHookPlugin.hookVirtual(pClass, index, signature);
+	}
+
+	PLUGIN_API Callback* HookImport(const plg::string& module, const plg::string& symbol, DataType returnType, const plg::vector<DataType>& arguments, int varIndex) {
+		return g_polyHookPlugin.hookImport(module, symbol, returnType, arguments.span(), static_cast<uint8_t>(varIndex));
+	}
+
+	PLUGIN_API Callback* HookImportBySignature(const plg::string& module, const plg::string& symbol, const plg::string& signature) {
+		return g_polyHookPlugin.hookImport(module, symbol, SignatureTable::instance().parse(signature));
+	}
+
+	PLUGIN_API Callback* HookImportByHandle(const plg::string& module, const plg::string& symbol, const Signature* signature) {
+		return g_polyHookPlugin.hookImport(module, symbol, signature);
+	}
+
+	PLUGIN_API Callback* HookCallSites(void* pFunc, const plg::vector<void*>& sites, DataType returnType, const plg::vector<DataType>& arguments, int varIndex) {
+		return g_polyHookPlugin.hookCallSites(pFunc, sites.span(), returnType, arguments.span(), static_cast<uint8_t>(varIndex));
+	}
+
+	PLUGIN_API Callback* HookCallSitesBySignature(void* pFunc, const plg::vector<void*>& sites, const plg::string& signature) {
+		return g_polyHookPlugin.hookCallSites(pFunc, sites.span(), SignatureTable::instance().parse(signature));
+	}
+
+	PLUGIN_API Callback* HookCallSitesByHandle(void* pFunc, const plg::vector<void*>& sites, const Signature* signature) {
+		return g_polyHookPlugin.hookCallSites(pFunc, sites.span(), signature);
+	}
+
+	PLUGIN_API MidHook* HookMidFunction(void* pAddr) {
+		return g_polyHookPlugin.hookMidFunction(pAddr);
+	}
+
+	PLUGIN_API ExitHook* HookExit(void* pFunc) {
+		return g_polyHookPlugin.hookExit(pFunc);
+	}
+
+	PLUGIN_API ModuleProfile* ProfileModule(const plg::string& module, const plg::string& filter, int sampleShift) {
+		return g_polyHookPlugin.profileModule(module, filter, static_cast<uint32_t>(std::max(sampleShift, 0)));
+	}
+
 	PLUGIN_API bool UnhookDetour(void* pFunc) {
 		return g_polyHookPlugin.unhookDetour(pFunc);
 	}
@@ -373,6 +1195,26 @@ extern "C" {
 		return g_polyHookPlugin.unhookVirtual(pClass, pFunc);
 	}
 
+	PLUGIN_API bool UnhookImport(const plg::string& module, const plg::string& symbol) {
+		return g_polyHookPlugin.unhookImport(module, symbol);
+	}
+
+	PLUGIN_API bool UnhookCallSites(void* pFunc) {
+		return g_polyHookPlugin.unhookCallSites(pFunc);
+	}
+
+	PLUGIN_API bool UnhookMidFunction(void* pAddr) {
+		return g_polyHookPlugin.unhookMidFunction(pAddr);
+	}
+
+	PLUGIN_API bool UnhookExit(void* pFunc) {
+		return g_polyHookPlugin.unhookExit(pFunc);
+	}
+
+	PLUGIN_API bool UnprofileModule(ModuleProfile* profile) {
+		return g_polyHookPlugin.unprofileModule(profile);
+	}
+
 	PLUGIN_API Callback* FindDetour(void* pFunc) {
 		return g_polyHookPlugin.findDetour(pFunc);
 	}
@@ -385,6 +1227,30 @@ extern "C" {
 		return g_polyHookPlugin.findVirtual(pClass, pFunc);
 	}
 
+	PLUGIN_API Callback* FindImport(const plg::string& module, const plg::string& symbol) {
+		return g_polyHookPlugin.findImport(module, symbol);
+	}
+
+	PLUGIN_API Callback* FindCallSites(void* pFunc) {
+		return g_polyHookPlugin.findCallSites(pFunc);
+	}
+
+	PLUGIN_API MidHook* FindMidFunction(void* pAddr) {
+		return g_polyHookPlugin.findMidFunction(pAddr);
+	}
+
+	PLUGIN_API ExitHook* FindExit(void* pFunc) {
+		return g_polyHookPlugin.findExit(pFunc);
+	}
+
+	PLUGIN_API plg::vector<void*> ScanCallSites(const plg::string& module, void* pFunc) {
+		plg::vector<void*> sites;
+		for (uint64_t site : CallSiteHook::scan(module, (uint64_t) pFunc)) {
+			sites.push_back((void*) site);
+		}
+		return sites;
+	}
+
 	PLUGIN_API int GetVTableIndex(void* pFunc) {
 		return g_polyHookPlugin.getVirtualTableIndex(pFunc);
 	}
@@ -413,8 +1279,133 @@ extern "C" {
 		return callback->areCallbacksRegistered();
 	}
 
+	PLUGIN_API bool AddMidHandler(MidHook* hook, MidHook::MidHandler handler) {
+		return hook->addHandler(handler);
+	}
+
+	PLUGIN_API bool RemoveMidHandler(MidHook* hook, MidHook::MidHandler handler) {
+		return hook->removeHandler(handler);
+	}
+
+	PLUGIN_API bool AddExitHandler(ExitHook* hook, ExitHook::ExitHandler handler) {
+		return hook->addHandler(handler);
+	}
+
+	PLUGIN_API bool RemoveExitHandler(ExitHook* hook, ExitHook::ExitHandler handler) {
+		return hook->removeHandler(handler);
+	}
+
+	PLUGIN_API uint64_t GetExitReturn(const ExitContext* context) { return context->registers->rax; }
+	PLUGIN_API float GetExitReturnFloat(const ExitContext* context) { return context->registers->xmm0.f32[0]; }
+	PLUGIN_API double GetExitReturnDouble(const ExitContext* context) { return context->registers->xmm0.f64[0]; }
+	PLUGIN_API uint64_t GetExitEntryTime(const ExitContext* context) { return context->entryTime; }
+	PLUGIN_API uint64_t GetExitCycles(const ExitContext* context) { return context->exitTime - context->entryTime; }
+
+	PLUGIN_API plg::string DumpProfile(ModuleProfile* profile) {
+		if (profile == nullptr)
+			return {};
+		std::string text = profile->dump();
+		return plg::string(text.data(), text.size());
+	}
+
+	PLUGIN_API void SetTrace(Callback* callback, bool enabled) {
+		callback->setTraced(enabled);
+	}
+
+	PLUGIN_API int64_t DrainTrace(void* buffer, int64_t capacity) {
+		if (buffer == nullptr || capacity <= 0)
+			return 0;
+		return static_cast<int64_t>(TraceBuffer::drain({static_cast<TraceRecord*>(buffer), static_cast<size_t>(capacity)}));
+	}
+
+	PLUGIN_API uint64_t GetTraceDropped() {
+		return TraceBuffer::getDropped();
+	}
+
+	PLUGIN_API plg::string GetMetrics() {
+		std::string text = g_polyHookPlugin.collectMetrics().str();
+		return plg::string(text.data(), text.size());
+	}
+
+	PLUGIN_API bool StartTimeline(const plg::string& path) {
+		return Timeline::open(GetLogPath(path));
+	}
+
+	PLUGIN_API bool StopTimeline() {
+		return Timeline::close();
+	}
+
+	PLUGIN_API int64_t FlushTimeline() {
+		return static_cast<int64_t>(Timeline::flush());
+	}
+
+	PLUGIN_API uint64_t GetTimelineDropped() {
+		return Timeline::getDropped();
+	}
+
+	PLUGIN_API bool StartRecording(Callback* callback, const plg::string& path, uint64_t maxBytes) {
+		return g_polyHookPlugin.startRecording(callback, path, maxBytes);
+	}
+
+	PLUGIN_API bool StopRecording(Callback* callback) {
+		CallRecorder* recorder = callback->getRecorder();
+		return recorder && recorder->close();
+	}
+
+	PLUGIN_API plg::string ReplayRecording(const plg::string& path, void* pFunc, int threads, int passes) {
+		std::string text = g_polyHookPlugin.replayRecording(path, pFunc, static_cast<size_t>(std::max(threads, 1)), static_cast<size_t>(std::max(passes, 1)));
+		return plg::string(text.data(), text.size());
+	}
+
+	PLUGIN_API void SetCallTreeEnabled(bool enabled) {
+		CallTree::setEnabled(enabled);
+	}
+
+	PLUGIN_API plg::string GetCallTree() {
+		std::string text = CallTree::report();
+		return plg::string(text.data(), text.size());
+	}
+
+	PLUGIN_API plg::string GetCollapsedStacks() {
+		std::string text = CallTree::collapse();
+		return plg::string(text.data(), text.size());
+	}
+
+	PLUGIN_API uint64_t GetRegister(MidContext* context, Register reg) {
+		const uintptr_t* value = context->getRegister(reg);
+		return value ? *value : 0;
+	}
+
+	PLUGIN_API void SetRegister(MidContext* context, Register reg, uint64_t value) {
+		if (uintptr_t* target = context->getRegister(reg)) {
+			*target = static_cast<uintptr_t>(value);
+		}
+	}
+
+	PLUGIN_API float GetXmmFloat(MidContext* context, size_t index) {
+		const MidContext::Xmm* xmm = context->getXmm(index);
+		return xmm ? xmm->f32[0] : 0.0f;
+	}
+
+	PLUGIN_API double GetXmmDouble(MidContext* context, size_t index) {
+		const MidContext::Xmm* xmm = context->getXmm(index);
+		return xmm ? xmm->f64[0] : 0.0;
+	}
+
+	PLUGIN_API void SetXmmFloat(MidContext* context, size_t index, float value) {
+		if (MidContext::Xmm* xmm = context->getXmm(index)) {
+			xmm->f32[0] = value;
+		}
+	}
+
+	PLUGIN_API void SetXmmDouble(MidContext* context, size_t index, double value) {
+		if (MidContext::Xmm* xmm = context->getXmm(index)) {
+			xmm->f64[0] = value;
+		}
+	}
+
 	PLUGIN_API void* GetFunctionAddr(Callback* callback) {
-		return (void*) *callback->getFunctionHolder();
+		return (void*) callback->getEntryAddress();
 	}
 
 	PLUGIN_API void* GetOriginalAddr(Callback* callback) {
@@ -1,7 +1,22 @@
 #pragma once
 
+#include "arena.hpp"
 #include "callback.hpp"
+#include "calltree.hpp"
+#include "callsite.hpp"
+#include "exithook.hpp"
 #include "hash.hpp"
+#include "imports.hpp"
+#include "metrics.hpp"
+#include "midhook.hpp"
+#include "profiler.hpp"
+#include "replay.hpp"
+#include "signature.hpp"
+#include "stubcache.hpp"
+#include "tier.hpp"
+#include "timeline.hpp"
+#include "trace.hpp"
+#include "warmup.hpp"
 
 #include <plugify/cpp_plugin.hpp>
 #include <plugin_export.h>
@@ -30,21 +45,56 @@ namespace PLH {
 		Callback* hookVirtual(void* pClass, int index, DataType returnType, std::span<const DataType> arguments, uint8_t vaIndex);
 		Callback* hookVirtual(void* pClass, void* pFunc, DataType returnType, std::span<const DataType> arguments, uint8_t vaIndex);
 
+		Callback* hookDetour(void* pFunc, const Signature* signature);
+		Callback* hookVirtual(void* pClass, int index, const Signature* signature);
+		Callback* hookVirtual(void* pClass, void* pFunc, const Signature* signature);
+
+		Callback* hookImport(std::string_view module, std::string_view symbol, DataType returnType, std::span<const DataType> arguments, uint8_t vaIndex);
+		Callback* hookImport(std::string_view module, std::string_view symbol, const Signature* signature);
+
+		Callback* hookCallSites(void* pFunc, std::span<void* const> sites, DataType returnType, std::span<const DataType> arguments, uint8_t vaIndex);
+		Callback* hookCallSites(void* pFunc, std::span<void* const> sites, const Signature* signature);
+
+		MidHook* hookMidFunction(void* pAddr);
+		ExitHook* hookExit(void* pFunc);
+		ModuleProfile* profileModule(std::string_view module, std::string_view filter, uint32_t sampleShift);
+
 		bool unhookDetour(void* pFunc);
 		bool unhookVirtual(void* pClass, int index);
 		bool unhookVirtual(void* pClass, void* pFunc);
+		bool unhookImport(std::string_view module, std::string_view symbol);
+		bool unhookCallSites(void* pFunc);
+		bool unhookMidFunction(void* pAddr);
+		bool unhookExit(void* pFunc);
+		bool unprofileModule(ModuleProfile* profile);
 
 		Callback* findDetour(void* pFunc) const;
 		Callback* findVirtual(void* pClass, void* pFunc) const;
 		Callback* findVirtual(void* pClass, int index) const;
+		Callback* findImport(std::string_view module, std::string_view symbol) const;
+		Callback* findCallSites(void* pFunc) const;
+		MidHook* findMidFunction(void* pAddr) const;
+		ExitHook* findExit(void* pFunc) const;
 
 		void unhookAll();
 		void unhookAllVirtual(void* pClass);
 
 		int getVirtualTableIndex(void* pFunc, ProtFlag flag = RWX) const;
 
+		void layoutHotStubs();
+
+		size_t getPendingRemovals() const { return m_removals.size(); }
+		JitArena::Statistics getJitStatistics() const;
+		Metrics collectMetrics();
+
+		bool startRecording(Callback* callback, std::string_view path, uint64_t maxBytes) const;
+		std::string replayRecording(std::string_view path, void* pFunc, size_t threads, size_t passes) const;
+
 	private:
-		std::shared_ptr<asmjit::JitRuntime> m_jitRuntime;
+		std::shared_ptr<JitArena> m_jitRuntime;
+		std::shared_ptr<TieredCompiler> m_tier;
+		std::unique_ptr<Warmup> m_warmup;
+		std::unique_ptr<TraceWriter> m_traceWriter;
 		struct VHook {
 			std::unique_ptr<VTableSwapHook> vtable;
 			std::unordered_map<int, std::unique_ptr<Callback>> callbacks;
@@ -57,15 +107,47 @@ namespace PLH {
 			std::unique_ptr<Callback> callback;
 		};
 		std::unordered_map<void*, DHook> m_detours;
+		struct GHook {
+			std::unique_ptr<ImportHook> import;
+			std::unique_ptr<Callback> callback;
+		};
+		std::unordered_map<std::pair<std::string, std::string>, GHook> m_imports;
+		struct CHook {
+			std::unique_ptr<CallSiteHook> sites;
+			std::unique_ptr<Callback> callback;
+		};
+		std::unordered_map<void*, CHook> m_callSites;
+		struct MHook {
+			std::unique_ptr<NatDetour> detour;
+			std::unique_ptr<MidHook> hook;
+		};
+		std::unordered_map<void*, MHook> m_midHooks;
+		struct EHook {
+			std::unique_ptr<NatDetour> detour;
+			std::unique_ptr<ExitHook> hook;
+		};
+		std::unordered_map<void*, EHook> m_exitHooks;
+		std::vector<std::unique_ptr<ExitHook>> m_retiredExitHooks;
+		std::vector<std::unique_ptr<ModuleProfile>> m_profiles;
+		std::vector<std::unique_ptr<ModuleProfile>> m_retiredProfiles;
 		using Clock = std::chrono::steady_clock;
 		using TimePoint = std::chrono::time_point<Clock>;
 		struct DelayedRemoval {
 			std::unique_ptr<Callback> callback;
 			TimePoint when;
+			std::unique_ptr<MidHook> midHook;
 
 			bool operator<(const DelayedRemoval& t) const { return when > t.when; }
 		};
 		std::priority_queue<DelayedRemoval> m_removals;
+		std::vector<Callback*> m_hotStubs;
+		size_t m_hotStubLimit = 0;
+		TimePoint m_nextLayout;
+		TimePoint m_nextCacheFlush = TimePoint::max();
+		std::chrono::seconds m_metricsInterval{0};
+		TimePoint m_nextMetrics = TimePoint::max();
+		TimePoint m_lastMetrics;
+		std::unordered_map<uint64_t, size_t> m_metricCalls; ///< keyed by Callback::getId
 		std::mutex m_mutex;
 	};
 }
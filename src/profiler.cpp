@@ -0,0 +1,276 @@
+#include "profiler.hpp"
+#include "arena.hpp"
+#include "modules.hpp"
+#include "symbols.hpp"
+#include <plugify/compat_format.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <regex>
+
+using namespace asmjit;
+
+namespace {
+	constexpr size_t kCountersPerLine = 64 / sizeof(uint64_t);
+
+	constexpr size_t AlignUp(size_t value, size_t alignment) noexcept {
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+PLH::ModuleProfile::ModuleProfile(std::weak_ptr<JitRuntime> rt, std::string_view module, std::string_view filter, uint32_t sampleShift)
+	: m_rt(std::move(rt)), m_module(module), m_sampleShift(std::min(sampleShift, kMaxSampleShift)) {
+	auto loaded = LoadedModule::find(module);
+	if (!loaded) {
+		m_errorCode = "Module is not loaded";
+		return;
+	}
+
+	// the stubs and the exit thunk call into this module, profiling it would recurse
+	if (loaded->contains(reinterpret_cast<uintptr_t>(&ExitHook::getExitThunk))) {
+		m_errorCode = "Cannot profile the module the profiler lives in";
+		return;
+	}
+
+	std::regex pattern;
+	try {
+		pattern.assign(filter.begin(), filter.end(), std::regex::ECMAScript | std::regex::optimize);
+	} catch (const std::regex_error&) {
+		m_errorCode = "Invalid filter";
+		return;
+	}
+
+	auto symbols = loaded->getFunctions();
+	std::erase_if(symbols, [&](const LoadedModule::Symbol& symbol) {
+		return symbol.size < kMinSize || !std::regex_search(symbol.name, pattern);
+	});
+	if (symbols.empty()) {
+		m_errorCode = "No function matches the filter";
+		return;
+	}
+
+	m_count = symbols.size();
+	m_functions = std::make_unique<Function[]>(m_count);
+	for (size_t i = 0; i < m_count; ++i) {
+		m_functions[i].name = std::move(symbols[i].name);
+		m_functions[i].address = symbols[i].address;
+	}
+}
+
+PLH::ModuleProfile::~ModuleProfile() {
+	if (m_hooked) {
+		unHook();
+	}
+
+	// detours go first, their trampolines are what the stubs jump to
+	for (size_t i = 0; i < m_count; ++i) {
+		m_functions[i].detour.reset();
+		if (m_functions[i].stub) {
+			JitSymbols::remove(m_functions[i].stub);
+		}
+	}
+
+	if (auto rt = m_rt.lock()) {
+		for (uint64_t batch : m_batches) {
+			rt->release(batch);
+		}
+	}
+}
+
+bool PLH::ModuleProfile::hook() {
+	if (m_used || !m_count)
+		return false;
+	m_used = true;
+
+	auto rt = m_rt.lock();
+	if (!rt) {
+		m_errorCode = "JitRuntime invalid";
+		return false;
+	}
+
+#ifdef POLYHOOK2_ARCH_X64
+	int32_t tlsOffset = 0;
+	uint64_t exitThunk = 0;
+	if (m_sampleShift) {
+		if (!ShadowStack::getTlsOffset(tlsOffset)) {
+			m_errorCode = "No fixed thread local slot for the shadow stack";
+			return false;
+		}
+		exitThunk = ExitHook::getExitThunk(rt);
+		if (!exitThunk) {
+			m_errorCode = "Failed to allocate exit thunk";
+			return false;
+		}
+	}
+
+	// stripes are only worth their memory when the stub can tell the CPUs apart
+	m_stripes = rt->cpuFeatures().x86().hasRDPID() ? kStripes : 1;
+	m_stride = AlignUp(m_count, kCountersPerLine);
+	m_counters = std::make_unique<uint64_t[]>(m_stripes * m_stride);
+
+	for (size_t first = 0; first < m_count; first += kBatchSize) {
+		if (!emit(*rt, first, std::min(first + kBatchSize, m_count), exitThunk, tlsOffset))
+			return false;
+	}
+
+	for (size_t i = 0; i < m_count; ++i) {
+		Function& function = m_functions[i];
+		function.detour = std::make_unique<NatDetour>(function.address, function.stub, &function.trampoline);
+		if (function.detour->hook()) {
+			++m_installed;
+		} else {
+			function.detour.reset();
+		}
+	}
+
+	if (!m_installed) {
+		m_errorCode = "No function could be detoured";
+		return false;
+	}
+
+	m_hooked = true;
+	return true;
+#else
+	m_errorCode = "Module profiling needs x86-64";
+	return false;
+#endif
+}
+
+bool PLH::ModuleProfile::unHook() {
+	if (!m_hooked)
+		return false;
+
+	// trampolines stay alive with the profile, threads may still be running through them
+	for (size_t i = 0; i < m_count; ++i) {
+		if (m_functions[i].detour) {
+			m_functions[i].detour->unHook();
+		}
+	}
+
+	m_hooked = false;
+	return true;
+}
+
+bool PLH::ModuleProfile::emit(JitRuntime& rt, size_t first, size_t last, uint64_t exitThunk, int32_t tlsOffset) {
+#ifdef POLYHOOK2_ARCH_X64
+	JitArena::NearScope near(m_functions[first].address);
+
+	CodeHolder code;
+	code.init(rt.environment(), rt.cpuFeatures());
+	x86::Assembler a(&code);
+
+	const uint32_t sampleMask = (1u << m_sampleShift) - 1;
+	const auto stripeBytes = static_cast<int32_t>(m_stride * sizeof(uint64_t));
+
+	std::vector<Label> entries;
+	entries.reserve(last - first);
+	for (size_t i = first; i < last; ++i) {
+		Function& function = m_functions[i];
+		Label resume = a.newLabel();
+
+		a.align(AlignMode::kCode, 16);
+		entries.push_back(a.newLabel());
+		a.bind(entries.back());
+
+		// r11 is neither an argument nor callee saved, rax is put back before anything can read it
+		a.push(x86::rax);
+		a.mov(x86::rax, imm(reinterpret_cast<uintptr_t>(&m_counters[i])));
+		if (m_stripes > 1) {
+			a.rdpid(x86::r11);
+			a.and_(x86::r11d, static_cast<uint32_t>(m_stripes - 1));
+			a.imul(x86::r11, x86::r11, imm(stripeBytes));
+			a.add(x86::rax, x86::r11);
+		}
+		if (exitThunk) {
+			a.mov(x86::r11d, 1);
+			a.lock().xadd(x86::qword_ptr(x86::rax), x86::r11);
+			a.pop(x86::rax);
+			a.test(x86::r11d, imm(sampleMask));
+			a.jnz(resume);
+			ExitHook::emitTakeover(a, &function, exitThunk, tlsOffset, resume);
+		} else {
+			a.lock().inc(x86::qword_ptr(x86::rax));
+			a.pop(x86::rax);
+		}
+
+		a.bind(resume);
+		a.mov(x86::r11, imm(reinterpret_cast<uintptr_t>(&function.trampoline)));
+		a.jmp(x86::qword_ptr(x86::r11));
+	}
+
+	void* batch = nullptr;
+	if (rt.add(&batch, &code) != kErrorOk) {
+		m_errorCode = "Failed to allocate JIT stub";
+		return false;
+	}
+	m_batches.push_back(reinterpret_cast<uint64_t>(batch));
+
+	const auto base = reinterpret_cast<uint64_t>(batch);
+	for (size_t i = first; i < last; ++i) {
+		Function& function = m_functions[i];
+		const uint64_t offset = code.labelOffsetFromBase(entries[i - first]);
+		const uint64_t end = i + 1 < last ? code.labelOffsetFromBase(entries[i + 1 - first]) : code.codeSize();
+		function.stub = base + offset;
+		function.stubSize = end - offset;
+		JitSymbols::add(function.stub, function.stubSize, std::format("polyhook::profile {}", function.name));
+	}
+	return true;
+#else
+	(void) rt;
+	(void) first;
+	(void) last;
+	(void) exitThunk;
+	(void) tlsOffset;
+	return false;
+#endif
+}
+
+void PLH::ModuleProfile::Function::onReturn(const ShadowFrame& frame, ExitRegisters*, uint64_t exitTime) {
+	samples.fetch_add(1, std::memory_order_relaxed);
+	cycles.fetch_add(exitTime - frame.timestamp, std::memory_order_relaxed);
+}
+
+uint64_t PLH::ModuleProfile::getCalls(size_t index) const noexcept {
+	if (!m_counters)
+		return 0;
+
+	uint64_t calls = 0;
+	for (size_t stripe = 0; stripe < m_stripes; ++stripe) {
+		calls += std::atomic_ref(m_counters[stripe * m_stride + index]).load(std::memory_order_relaxed);
+	}
+	return calls;
+}
+
+std::vector<PLH::ModuleProfile::Result> PLH::ModuleProfile::getResults() const {
+	std::vector<Result> results;
+	for (size_t i = 0; i < m_count; ++i) {
+		const Function& function = m_functions[i];
+		if (!function.detour)
+			continue;
+		results.push_back({
+			function.name,
+			function.address,
+			getCalls(i),
+			function.samples.load(std::memory_order_relaxed),
+			function.cycles.load(std::memory_order_relaxed)
+		});
+	}
+	return results;
+}
+
+std::string PLH::ModuleProfile::dump() const {
+	auto results = getResults();
+	std::erase_if(results, [](const Result& result) { return result.calls == 0; });
+	std::sort(results.begin(), results.end(), [](const Result& a, const Result& b) { return a.calls > b.calls; });
+
+	std::string text = "calls\tsamples\tavg_cycles\tfunction\n";
+	for (const Result& result : results) {
+		const uint64_t average = result.samples ? result.sampledCycles / result.samples : 0;
+		std::format_to(std::back_inserter(text), "{}\t{}\t{}\t{}\n", result.calls, result.samples, average, result.name);
+	}
+	return text;
+}
+
+std::string_view PLH::ModuleProfile::getError() const noexcept {
+	return m_errorCode ? m_errorCode : "";
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#pragma warning(push, 0)
+#include <asmjit/asmjit.h>
+#pragma warning( pop )
+
+#include "exithook.hpp"
+
+#include "polyhook2/Detour/NatDetour.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace PLH {
+	/**
+	 * Call counts for every function of a loaded module whose symbol matches a regex, to find out what is hot
+	 * before hooking it properly. Each function is detoured to a counting stub which increments a counter in
+	 * the stripe of the CPU it runs on (read with rdpid, one shared stripe on CPUs without it) and jumps to the
+	 * trampoline: no signature, no handlers, nothing spilled. With a sample shift of n, one call in 2^n per
+	 * stripe also has its return taken over the way an ExitHook does, to measure the cycles until it returns.
+	 *
+	 * Stubs are emitted in batches and the whole profile is installed and removed at once. Functions smaller
+	 * than kMinSize or refused by the detour are skipped. Linux x86-64 only, and the module the profiler lives
+	 * in cannot be profiled. Sampled calls can still be in flight after removal, so a profile must outlive them.
+	 */
+	class ModuleProfile {
+	public:
+		static constexpr size_t kStripes = 16;
+		static constexpr size_t kBatchSize = 128;
+		static constexpr uint64_t kMinSize = 16;
+		static constexpr uint32_t kMaxSampleShift = 30;
+
+		struct Result {
+			std::string_view name;
+			uint64_t address;
+			uint64_t calls;
+			uint64_t samples;       ///< calls whose duration was measured
+			uint64_t sampledCycles; ///< rdtsc cycles spent in them, callees included
+		};
+
+		ModuleProfile(std::weak_ptr<asmjit::JitRuntime> rt, std::string_view module, std::string_view filter, uint32_t sampleShift);
+		~ModuleProfile();
+		ModuleProfile(const ModuleProfile&) = delete;
+		ModuleProfile& operator=(const ModuleProfile&) = delete;
+
+		/// installs every stub, a profile can only be installed once
+		bool hook();
+		bool unHook();
+
+		bool isHooked() const noexcept { return m_hooked; }
+		std::string_view getError() const noexcept;
+		const std::string& getModule() const noexcept { return m_module; }
+		size_t getFunctionCount() const noexcept { return m_count; }
+		size_t getInstalledCount() const noexcept { return m_installed; }
+
+		std::vector<Result> getResults() const;
+		/// one tab separated line per called function, most called first: calls, samples, average cycles, name
+		std::string dump() const;
+
+	private:
+		struct Function final : ShadowOwner {
+			std::string name;
+			uint64_t address = 0;
+			uint64_t stub = 0;
+			uint64_t stubSize = 0;
+			uint64_t trampoline = 0;
+			std::unique_ptr<NatDetour> detour;
+			std::atomic<uint64_t> samples{0};
+			std::atomic<uint64_t> cycles{0};
+
+			void onReturn(const ShadowFrame& frame, ExitRegisters* registers, uint64_t exitTime) override;
+		};
+
+		bool emit(asmjit::JitRuntime& rt, size_t first, size_t last, uint64_t exitThunk, int32_t tlsOffset);
+		uint64_t getCalls(size_t index) const noexcept;
+
+		std::weak_ptr<asmjit::JitRuntime> m_rt;
+		std::string m_module;
+		uint32_t m_sampleShift;
+		std::unique_ptr<Function[]> m_functions;
+		size_t m_count = 0;
+		size_t m_installed = 0;
+		size_t m_stripes = 1;
+		size_t m_stride = 0; ///< counters per stripe, a whole number of cache lines
+		std::unique_ptr<uint64_t[]> m_counters;
+		std::vector<uint64_t> m_batches;
+		const char* m_errorCode = nullptr;
+		bool m_hooked = false;
+		bool m_used = false;
+	};
+}
@@ -0,0 +1,388 @@
+#include "replay.hpp"
+#include "signature.hpp"
+#include "symbols.hpp"
+#include <plugify/compat_format.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <latch>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+using namespace asmjit;
+
+namespace {
+	constexpr char kMagic[8] = {'P', 'L', 'H', 'C', 'A', 'L', 'L', 'S'};
+
+	template<typename T>
+	void Append(std::string& buffer, const T& value) {
+		buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template<typename T>
+	bool Read(std::istream& stream, T& value) {
+		return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(T)));
+	}
+
+	double GetQuantile(const std::vector<uint64_t>& sorted, double quantile, double ticksPerNs) {
+		if (sorted.empty())
+			return 0;
+		const auto index = static_cast<size_t>(quantile * static_cast<double>(sorted.size() - 1));
+		return static_cast<double>(sorted[index]) / ticksPerNs;
+	}
+}
+
+PLH::CallRecorder::CallRecorder(const Signature* signature) : m_signature(signature) {
+}
+
+PLH::CallRecorder::~CallRecorder() {
+	close();
+}
+
+bool PLH::CallRecorder::open(const std::filesystem::path& path, uint64_t maxBytes) {
+	std::lock_guard lock(m_mutex);
+
+	if (m_file.is_open()) {
+		flush();
+		m_file.close();
+	}
+
+	m_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!m_file) {
+		m_open.store(false, std::memory_order_relaxed);
+		return false;
+	}
+
+	m_buffer.clear();
+	m_buffer.append(kMagic, sizeof(kMagic));
+	Append(m_buffer, kVersion);
+	Append(m_buffer, static_cast<uint32_t>(m_signature->text.size()));
+	m_buffer.append(m_signature->text);
+
+	m_written = m_buffer.size();
+	m_maxBytes = maxBytes;
+	m_records = 0;
+	m_skipped = 0;
+	m_open.store(true, std::memory_order_relaxed);
+	return true;
+}
+
+bool PLH::CallRecorder::close() {
+	std::lock_guard lock(m_mutex);
+
+	if (!m_file.is_open())
+		return false;
+
+	m_open.store(false, std::memory_order_relaxed);
+	flush();
+	m_file.close();
+	return true;
+}
+
+void PLH::CallRecorder::record(const Callback::Parameters* params, size_t count, const Callback::Return* ret) {
+	std::lock_guard lock(m_mutex);
+
+	// closed between the check in the post entry and here
+	if (!m_file.is_open())
+		return;
+
+	const auto& arguments = m_signature->arguments;
+	const size_t begin = m_buffer.size();
+
+	for (size_t i = 0; i < arguments.size(); ++i) {
+		Append(m_buffer, i < count ? params->getArg<uint64_t>(i) : uint64_t{});
+	}
+	Append(m_buffer, ret->getRet<uint64_t>());
+
+	for (size_t i = 0; i < arguments.size() && i < count; ++i) {
+		if (arguments[i] != DataType::String)
+			continue;
+		const char* str = params->getArg<const char*>(i);
+		if (!str) {
+			Append(m_buffer, kNullString);
+			continue;
+		}
+		const size_t length = strnlen(str, kMaxString);
+		Append(m_buffer, static_cast<uint32_t>(length));
+		m_buffer.append(str, length);
+	}
+
+	const size_t size = m_buffer.size() - begin;
+	if (m_maxBytes && m_written + size > m_maxBytes) {
+		m_buffer.resize(begin);
+		++m_skipped;
+		return;
+	}
+
+	m_written += size;
+	++m_records;
+	if (m_buffer.size() >= kBufferSize) {
+		flush();
+	}
+}
+
+void PLH::CallRecorder::flush() {
+	m_file.write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+	m_buffer.clear();
+}
+
+uint64_t PLH::CallRecorder::getRecordCount() const {
+	std::lock_guard lock(m_mutex);
+	return m_records;
+}
+
+uint64_t PLH::CallRecorder::getSkippedCount() const {
+	std::lock_guard lock(m_mutex);
+	return m_skipped;
+}
+
+PLH::CallReplayer::CallReplayer(std::weak_ptr<JitRuntime> rt) : m_rt(std::move(rt)) {
+}
+
+PLH::CallReplayer::~CallReplayer() {
+	if (auto rt = m_rt.lock()) {
+		if (m_invoker) {
+			JitSymbols::remove(reinterpret_cast<uint64_t>(m_invoker));
+			rt->release(m_invoker);
+		}
+	}
+}
+
+bool PLH::CallReplayer::load(const std::filesystem::path& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		m_errorCode = "Cannot open recording";
+		return false;
+	}
+
+	char magic[sizeof(kMagic)];
+	uint32_t version = 0, length = 0;
+	if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 || !Read(file, version) || !Read(file, length)) {
+		m_errorCode = "Not a call recording";
+		return false;
+	}
+	if (version != CallRecorder::kVersion) {
+		m_errorCode = "Unsupported recording version";
+		return false;
+	}
+
+	std::string text(length, '\0');
+	if (!file.read(text.data(), length) || !(m_signature = SignatureTable::instance().parse(text))) {
+		m_errorCode = "Invalid signature in recording";
+		return false;
+	}
+	if (m_signature->vaIndex != 0xFF) {
+		m_errorCode = "Variadic signatures cannot be replayed";
+		return false;
+	}
+
+	const auto& arguments = m_signature->arguments;
+	std::vector<uint64_t> slots(arguments.size() + 1);
+	while (file.read(reinterpret_cast<char*>(slots.data()), static_cast<std::streamsize>(slots.size() * sizeof(uint64_t)))) {
+		// strings get fresh storage which lives as long as the replayer, the recorded pointers are meaningless
+		for (size_t i = 0; i < arguments.size(); ++i) {
+			if (arguments[i] != DataType::String)
+				continue;
+			if (!Read(file, length))
+				break;
+			if (length == CallRecorder::kNullString) {
+				slots[i] = 0;
+				continue;
+			}
+			std::string& str = m_strings.emplace_back(length, '\0');
+			file.read(str.data(), length);
+			slots[i] = reinterpret_cast<uint64_t>(str.c_str());
+		}
+		if (!file)
+			break;
+		m_slots.insert(m_slots.end(), slots.begin(), slots.end());
+	}
+
+	// a recording cut short by a crash still replays up to its last complete call
+	return true;
+}
+
+size_t PLH::CallReplayer::getCallCount() const noexcept {
+	return m_signature ? m_slots.size() / (m_signature->arguments.size() + 1) : 0;
+}
+
+bool PLH::CallReplayer::compile() {
+	auto rt = m_rt.lock();
+	if (!rt) {
+		m_errorCode = "JitRuntime invalid";
+		return false;
+	}
+
+	CodeHolder code;
+	code.init(rt->environment(), rt->cpuFeatures());
+	x86::Compiler cc(&code);
+
+	FuncNode* func = cc.addFunc(FuncSignature::build<void, uintptr_t, const uint64_t*, uint64_t*>());
+	x86::Gp function = cc.newUIntPtr("function");
+	x86::Gp args = cc.newUIntPtr("args");
+	x86::Gp ret = cc.newUIntPtr("ret");
+	func->setArg(0, function);
+	func->setArg(1, args);
+	func->setArg(2, ret);
+
+	// load every slot the way the stub stored it, wide integers take two registers on x86
+	const FuncSignature& sig = m_signature->funcSignature;
+	std::vector<std::pair<x86::Reg, x86::Reg>> values;
+	for (uint32_t i = 0; i < sig.argCount(); ++i) {
+		const TypeId type = sig.args()[i];
+		x86::Mem slot = x86::ptr(args, static_cast<int32_t>(i * sizeof(uint64_t)));
+		if (TypeUtils::isInt(type)) {
+			x86::Gp low = cc.newUIntPtr();
+			slot.setSize(low.size());
+			cc.mov(low, slot);
+			x86::Gp high;
+			if (TypeUtils::sizeOf(type) > low.size()) {
+				high = cc.newUIntPtr();
+				slot.addOffset(low.size());
+				cc.mov(high, slot);
+			}
+			values.emplace_back(low, high);
+		} else if (TypeUtils::isFloat(type)) {
+			x86::Xmm value = cc.newXmm();
+			slot.setSize(sizeof(uint64_t));
+			cc.movq(value, slot);
+			values.emplace_back(value, x86::Reg());
+		} else {
+			m_errorCode = "Parameters wider than 64bits not supported";
+			return false;
+		}
+	}
+
+	InvokeNode* invoke;
+	cc.invoke(&invoke, function, sig);
+	for (uint32_t i = 0; i < values.size(); ++i) {
+		invoke->setArg(i, 0, values[i].first);
+		if (values[i].second.isValid()) {
+			invoke->setArg(i, 1, values[i].second);
+		}
+	}
+
+	if (sig.hasRet()) {
+		x86::Mem slot = x86::ptr(ret);
+		if (TypeUtils::isInt(sig.ret())) {
+			x86::Gp low = cc.newUIntPtr();
+			invoke->setRet(0, low);
+			x86::Gp high;
+			if (TypeUtils::sizeOf(sig.ret()) > low.size()) {
+				high = cc.newUIntPtr();
+				invoke->setRet(1, high);
+			}
+			slot.setSize(low.size());
+			cc.mov(slot, low);
+			if (high.isValid()) {
+				slot.addOffset(low.size());
+				cc.mov(slot, high);
+			}
+		} else {
+			x86::Xmm value = cc.newXmm();
+			invoke->setRet(0, value);
+			slot.setSize(sizeof(uint64_t));
+			cc.movq(slot, value);
+		}
+	}
+
+	cc.endFunc();
+
+	if (cc.finalize() != kErrorOk || rt->add(&m_invoker, &code) != kErrorOk) {
+		m_invoker = nullptr;
+		m_errorCode = "Failed to compile replay invoker";
+		return false;
+	}
+
+	JitSymbols::add(reinterpret_cast<uint64_t>(m_invoker), code.codeSize(), std::format("polyhook::replay {}", m_signature->text));
+	return true;
+}
+
+bool PLH::CallReplayer::run(uint64_t function, size_t threads, size_t passes, Statistics& statistics) {
+	if (!m_signature) {
+		m_errorCode = "No recording loaded";
+		return false;
+	}
+	if (!m_invoker && !compile())
+		return false;
+
+	const size_t calls = getCallCount();
+	if (!calls || !function) {
+		m_errorCode = calls ? "No function to replay against" : "Recording holds no calls";
+		return false;
+	}
+
+	threads = std::max<size_t>(threads, 1);
+	passes = std::max<size_t>(passes, 1);
+	const size_t stride = m_signature->arguments.size() + 1;
+	const size_t keepEvery = (calls * passes + kMaxSamples - 1) / kMaxSamples;
+
+	std::vector<std::vector<uint64_t>> samples(threads);
+	std::latch ready(static_cast<ptrdiff_t>(threads + 1));
+
+	auto replay = [&](std::vector<uint64_t>& latencies) {
+		latencies.reserve(calls * passes / keepEvery + 1);
+		ready.arrive_and_wait();
+
+		uint64_t ret = 0;
+		size_t n = 0;
+		for (size_t pass = 0; pass < passes; ++pass) {
+			for (size_t call = 0; call < calls; ++call) {
+				const uint64_t begin = __rdtsc();
+				m_invoker(static_cast<uintptr_t>(function), &m_slots[call * stride], &ret);
+				const uint64_t end = __rdtsc();
+				if (n++ % keepEvery == 0) {
+					latencies.push_back(end - begin);
+				}
+			}
+		}
+	};
+
+	std::chrono::steady_clock::time_point wallBegin;
+	uint64_t tscBegin = 0;
+	{
+		std::vector<std::jthread> workers;
+		workers.reserve(threads);
+		for (size_t t = 0; t < threads; ++t) {
+			workers.emplace_back(replay, std::ref(samples[t]));
+		}
+		ready.arrive_and_wait();
+		wallBegin = std::chrono::steady_clock::now();
+		tscBegin = __rdtsc();
+	}
+	const uint64_t tscEnd = __rdtsc();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallBegin).count();
+
+	std::vector<uint64_t> latencies;
+	for (auto& thread : samples) {
+		latencies.insert(latencies.end(), thread.begin(), thread.end());
+	}
+	std::sort(latencies.begin(), latencies.end());
+
+	const double ticksPerNs = seconds > 0 ? static_cast<double>(tscEnd - tscBegin) / (seconds * 1e9) : 1.0;
+	statistics.calls = static_cast<uint64_t>(calls * passes * threads);
+	statistics.seconds = seconds;
+	statistics.callsPerSecond = seconds > 0 ? static_cast<double>(statistics.calls) / seconds : 0;
+	statistics.p50 = GetQuantile(latencies, 0.5, ticksPerNs);
+	statistics.p90 = GetQuantile(latencies, 0.9, ticksPerNs);
+	statistics.p99 = GetQuantile(latencies, 0.99, ticksPerNs);
+	statistics.p999 = GetQuantile(latencies, 0.999, ticksPerNs);
+	statistics.max = GetQuantile(latencies, 1.0, ticksPerNs);
+	return true;
+}
+
+std::string_view PLH::CallReplayer::getError() const noexcept {
+	return m_errorCode ? m_errorCode : "";
+}
+
+std::string PLH::CallReplayer::format(const Statistics& statistics) {
+	return std::format("{} calls in {:.3f} s, {:.0f} calls/s, latency ns p50 {:.1f} p90 {:.1f} p99 {:.1f} p99.9 {:.1f} max {:.1f}",
+					   statistics.calls, statistics.seconds, statistics.callsPerSecond,
+					   statistics.p50, statistics.p90, statistics.p99, statistics.p999, statistics.max);
+}
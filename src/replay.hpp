@@ -0,0 +1,117 @@
+#pragma once
+
+#pragma warning(push, 0)
+#include <asmjit/asmjit.h>
+#pragma warning( pop )
+
+#include "callback.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace PLH {
+	struct Signature;
+
+	/**
+	 * Captures the calls of one hook into a compact binary file for offline replay. The plugin's post entry
+	 * hands every call to the recorder while it is open, so the arguments are the ones the original received.
+	 *
+	 * The file starts with "PLHCALLS", a version and the signature text. Each call follows as its raw argument
+	 * slots and return slot in the Parameters/Return layout, then one length prefixed payload per String
+	 * argument (0xFFFFFFFF for null, cut at kMaxString bytes). Pointer arguments are stored as they are and
+	 * only mean something to a replay in the same process.
+	 */
+	class CallRecorder {
+	public:
+		static constexpr uint32_t kVersion = 1;
+		static constexpr uint32_t kNullString = 0xFFFFFFFF;
+		static constexpr size_t kMaxString = 4096;
+		static constexpr size_t kBufferSize = 64 * 1024;
+
+		explicit CallRecorder(const Signature* signature);
+		~CallRecorder();
+		CallRecorder(const CallRecorder&) = delete;
+		CallRecorder& operator=(const CallRecorder&) = delete;
+
+		/// starts a new file, maxBytes 0 for no limit, calls past the limit are counted but not written
+		bool open(const std::filesystem::path& path, uint64_t maxBytes);
+		bool close();
+		bool isOpen() const noexcept { return m_open.load(std::memory_order_relaxed); }
+
+		void record(const Callback::Parameters* params, size_t count, const Callback::Return* ret);
+
+		uint64_t getRecordCount() const;
+		uint64_t getSkippedCount() const;
+
+	private:
+		void flush();
+
+		const Signature* m_signature;
+		std::atomic<bool> m_open = false;
+		mutable std::mutex m_mutex;
+		std::ofstream m_file;
+		std::string m_buffer;
+		uint64_t m_written = 0;
+		uint64_t m_maxBytes = 0;
+		uint64_t m_records = 0;
+		uint64_t m_skipped = 0;
+	};
+
+	/**
+	 * Replays a CallRecorder file against a function with the recorded signature, usually the original
+	 * reached through a hook's trampoline or a candidate replacement, from several threads at once. Each
+	 * thread runs the whole stream the given number of passes. The call goes through a JIT compiled invoker
+	 * which loads the slots into the argument registers, latencies are rdtsc ticks around it, converted to
+	 * nanoseconds with the rate measured over the run. Variadic signatures are not supported.
+	 */
+	class CallReplayer {
+	public:
+		static constexpr size_t kMaxSamples = 1 << 20; ///< latency samples kept per thread
+
+		struct Statistics {
+			uint64_t calls = 0;
+			double seconds = 0;
+			double callsPerSecond = 0;
+			double p50 = 0; ///< latencies in nanoseconds
+			double p90 = 0;
+			double p99 = 0;
+			double p999 = 0;
+			double max = 0;
+		};
+
+		explicit CallReplayer(std::weak_ptr<asmjit::JitRuntime> rt);
+		~CallReplayer();
+		CallReplayer(const CallReplayer&) = delete;
+		CallReplayer& operator=(const CallReplayer&) = delete;
+
+		bool load(const std::filesystem::path& path);
+		bool run(uint64_t function, size_t threads, size_t passes, Statistics& statistics);
+
+		const Signature* getSignature() const noexcept { return m_signature; }
+		size_t getCallCount() const noexcept;
+		std::string_view getError() const noexcept;
+
+		static std::string format(const Statistics& statistics);
+
+	private:
+		typedef void (*Invoker)(uintptr_t function, const uint64_t* args, uint64_t* ret);
+
+		bool compile();
+
+		std::weak_ptr<asmjit::JitRuntime> m_rt;
+		const Signature* m_signature = nullptr;
+		std::vector<uint64_t> m_slots; ///< argument slots of every call back to back
+		std::deque<std::string> m_strings;
+		Invoker m_invoker = nullptr;
+		const char* m_errorCode = nullptr;
+	};
+}
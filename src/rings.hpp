@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace PLH {
+	/**
+	 * Per-thread single producer, single consumer rings, the buffers behind TraceBuffer and Timeline.
+	 *
+	 * A thread gets its ring on its first push, which is the only time a producer takes the mutex. Pushing is
+	 * one release store, a full ring drops the item and counts it. Consumers hold the mutex while reading, and
+	 * a ring is freed once its thread has exited and everything it pushed was read. The calling thread's ring
+	 * is found through a thread_local of the instantiation, so there is one set per item type.
+	 */
+	template<typename T, size_t Capacity>
+	class ThreadRings {
+		static_assert((Capacity & (Capacity - 1)) == 0, "ring indices are masked");
+
+	public:
+		using ThreadId = uint64_t (*)();
+
+		/// threadId names the producing thread, it is called once per ring
+		constexpr explicit ThreadRings(ThreadId threadId) noexcept : m_threadId(threadId) {}
+		ThreadRings(const ThreadRings&) = delete;
+		ThreadRings& operator=(const ThreadRings&) = delete;
+
+		/// fill(T& item, uint64_t thread) writes the item in place, it is not called when the ring is full
+		template<typename Fill>
+		void push(Fill&& fill) {
+			Ring* ring = getLocal();
+
+			const uint64_t head = ring->head.load(std::memory_order_relaxed);
+			if (head - ring->tail.load(std::memory_order_acquire) >= Capacity) {
+				ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				return;
+			}
+
+			fill(ring->items[head & (Capacity - 1)], ring->thread);
+			ring->head.store(head + 1, std::memory_order_release);
+		}
+
+		/// guards the rings, the members below expect it held
+		std::mutex& getMutex() noexcept { return m_mutex; }
+
+		size_t getRingCount() const noexcept { return m_rings.size(); }
+
+		/// consume(std::span<const T> items, uint64_t thread) gets up to max of the oldest items of a ring in at most two chunks, returns how many
+		template<typename Consume>
+		size_t read(size_t index, size_t max, Consume&& consume) {
+			Ring& ring = *m_rings[index];
+			const uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+			const uint64_t head = ring.head.load(std::memory_order_acquire);
+			const auto available = static_cast<size_t>(std::min<uint64_t>(head - tail, max));
+
+			for (size_t i = 0; i < available;) {
+				const auto slot = static_cast<size_t>((tail + i) & (Capacity - 1));
+				const size_t chunk = std::min(available - i, Capacity - slot);
+				consume(std::span<const T>(&ring.items[slot], chunk), ring.thread);
+				i += chunk;
+			}
+
+			ring.tail.store(tail + available, std::memory_order_release);
+			return available;
+		}
+
+		/// drops everything pushed so far without reading it
+		void discard() noexcept {
+			for (const auto& ring : m_rings) {
+				ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+			}
+		}
+
+		/// frees the rings of exited threads once they were read empty
+		void release() {
+			std::erase_if(m_rings, [this](const std::unique_ptr<Ring>& ring) {
+				if (!ring->closed.load(std::memory_order_acquire))
+					return false;
+				if (ring->head.load(std::memory_order_acquire) != ring->tail.load(std::memory_order_relaxed))
+					return false;
+				m_droppedReleased += ring->dropped.load(std::memory_order_relaxed);
+				return true;
+			});
+		}
+
+		/// items lost to full rings since start
+		uint64_t getDropped() const noexcept {
+			uint64_t dropped = m_droppedReleased;
+			for (const auto& ring : m_rings) {
+				dropped += ring->dropped.load(std::memory_order_relaxed);
+			}
+			return dropped;
+		}
+
+	private:
+		struct Ring {
+			alignas(64) std::atomic<uint64_t> head = 0; ///< written by the producing thread only
+			std::atomic<uint64_t> dropped = 0;
+			alignas(64) std::atomic<uint64_t> tail = 0; ///< written by the consumer only
+			std::atomic<bool> closed = false;
+			uint64_t thread = 0;
+			T items[Capacity];
+		};
+
+		// the ring stays with the consumer until it was read, the exiting thread only marks it
+		struct Owner {
+			Ring* ring = nullptr;
+
+			~Owner() {
+				if (ring) {
+					ring->closed.store(true, std::memory_order_release);
+				}
+			}
+		};
+		static inline thread_local Owner t_owner;
+
+		Ring* getLocal() {
+			if (t_owner.ring)
+				return t_owner.ring;
+
+			auto ring = std::make_unique<Ring>();
+			ring->thread = m_threadId();
+
+			std::lock_guard lock(m_mutex);
+			t_owner.ring = m_rings.emplace_back(std::move(ring)).get();
+			return t_owner.ring;
+		}
+
+		const ThreadId m_threadId;
+		std::mutex m_mutex;
+		std::vector<std::unique_ptr<Ring>> m_rings;
+		uint64_t m_droppedReleased = 0;
+	};
+}
@@ -0,0 +1,113 @@
+#include "shadowstack.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <exception>
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+static_assert(offsetof(PLH::ShadowStack, top) == 0 && offsetof(PLH::ShadowStack, limit) == 8, "stubs address the stack by these offsets");
+static_assert(sizeof(PLH::ShadowFrame) == 32, "stubs advance the top by 32 bytes");
+
+namespace {
+#if defined(_WIN32)
+	// TEB::TlsSlots, the first 64 indices live inline in the TEB
+	constexpr int32_t kTlsSlots = 0x1480;
+	constexpr DWORD kTlsInlineSlots = 64;
+
+	DWORD GetTlsIndex() noexcept {
+		static const DWORD index = TlsAlloc();
+		return index;
+	}
+
+	thread_local bool t_attaching = false;
+#else
+	// initial-exec keeps the pointer at a fixed offset from the thread pointer, the stubs load it with one mov
+	__attribute__((tls_model("initial-exec"))) thread_local PLH::ShadowStack* t_shadow = nullptr;
+	__attribute__((tls_model("initial-exec"))) thread_local bool t_attaching = false;
+#endif
+
+	void SetCurrent(PLH::ShadowStack* stack) noexcept {
+#if defined(_WIN32)
+		TlsSetValue(GetTlsIndex(), stack);
+#else
+		t_shadow = stack;
+#endif
+	}
+
+	// frees the stack when the thread exits, one attached by a stub running later in thread teardown is leaked
+	struct Owner {
+		PLH::ShadowStack* stack = nullptr;
+
+		~Owner() {
+			if (stack) {
+				SetCurrent(nullptr);
+				delete stack;
+			}
+		}
+	};
+	thread_local Owner t_owner;
+}
+
+PLH::ShadowStack* PLH::ShadowStack::attach() {
+	if (ShadowStack* stack = current())
+		return stack;
+
+	// allocating can run a function which is itself taken over, that call just goes untracked
+	if (t_attaching)
+		return nullptr;
+	t_attaching = true;
+
+	auto* stack = new ShadowStack;
+	stack->top = stack->frames;
+	stack->limit = stack->frames + kCapacity;
+	if (!t_owner.stack) {
+		t_owner.stack = stack;
+	}
+	SetCurrent(stack);
+	t_attaching = false;
+	return stack;
+}
+
+PLH::ShadowStack* PLH::ShadowStack::current() noexcept {
+#if defined(_WIN32)
+	return static_cast<ShadowStack*>(TlsGetValue(GetTlsIndex()));
+#else
+	return t_shadow;
+#endif
+}
+
+bool PLH::ShadowStack::getTlsOffset(int32_t& offset) noexcept {
+#if defined(_WIN32) && defined(_M_X64)
+	const DWORD index = GetTlsIndex();
+	if (index == TLS_OUT_OF_INDEXES || index >= kTlsInlineSlots)
+		return false;
+	offset = kTlsSlots + static_cast<int32_t>(index * sizeof(void*));
+	return true;
+#elif defined(__linux__) && defined(__x86_64__)
+	uintptr_t threadPointer;
+	asm volatile("mov %%fs:0, %0" : "=r"(threadPointer));
+	const auto distance = static_cast<intptr_t>(reinterpret_cast<uintptr_t>(&t_shadow) - threadPointer);
+	if (distance < INT32_MIN || distance > INT32_MAX)
+		return false;
+	offset = static_cast<int32_t>(distance);
+	return true;
+#else
+	(void) offset;
+	return false;
+#endif
+}
+
+PLH::ShadowFrame PLH::ShadowStack::pop(uint64_t slot) noexcept {
+	// the stack grows down, frames of calls nested deeper than this one have lower slots
+	while (top != frames && top[-1].slot <= slot) {
+		const ShadowFrame& frame = *--top;
+		if (frame.slot == slot)
+			return frame;
+	}
+
+	std::puts("PolyHook: return through a stub without a shadow frame");
+	std::terminate();
+}
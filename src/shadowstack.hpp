@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace PLH {
+	/** A call whose return address was taken over by a stub. */
+	struct ShadowFrame {
+		uint64_t returnAddress; ///< where the function would have returned to
+		void* owner;            ///< hook which pushed the frame
+		uint64_t timestamp;     ///< rdtsc at entry
+		uint64_t slot;          ///< stack address the return address was taken from
+	};
+
+	/**
+	 * Per-thread stack of return addresses taken over by exit hooks. Stubs reach it through the thread pointer
+	 * without calling out (see getTlsOffset) and push frames inline, the first stub a thread runs calls
+	 * attach() to create it. A full stack is not an error, the stub then simply does not take the return over.
+	 */
+	struct ShadowStack {
+		static constexpr size_t kCapacity = 4096;
+
+		ShadowFrame* top;   ///< next free frame, the stubs depend on this being the first field
+		ShadowFrame* limit; ///< one past the last frame, second field
+		ShadowFrame frames[kCapacity];
+
+		/// nullptr when reentered while the thread's stack is being created
+		static ShadowStack* attach();
+		static ShadowStack* current() noexcept;
+
+		/**
+		 * Offset of the current thread's stack pointer from the fs (Linux) or gs (Windows) segment base,
+		 * false when the platform has no slot at a fixed offset.
+		 */
+		static bool getTlsOffset(int32_t& offset) noexcept;
+
+		/// pops the frame of the return through slot, frames left behind by longjmp or unwinding are dropped
+		ShadowFrame pop(uint64_t slot) noexcept;
+	};
+}
@@ -0,0 +1,184 @@
+#include "signature.hpp"
+
+#include <mutex>
+
+using namespace PLH;
+using namespace asmjit;
+
+namespace {
+	template<typename T>
+	constexpr TypeId getTypeIdx() noexcept {
+		return static_cast<TypeId>(TypeUtils::TypeIdOfT<T>::kTypeId);
+	}
+
+	std::string MakeText(DataType returnType, std::span<const DataType> arguments, uint8_t vaIndex) {
+		std::string text;
+		text.reserve(arguments.size() + 4);
+		text += Signature::toChar(returnType);
+		text += '(';
+		for (size_t i = 0; i < arguments.size(); ++i) {
+			if (i == vaIndex)
+				text += '.';
+			text += Signature::toChar(arguments[i]);
+		}
+		text += ')';
+		return text;
+	}
+}
+
+char Signature::toChar(DataType type) noexcept {
+	switch (type) {
+		case DataType::Void: return 'v';
+		case DataType::Bool: return 'b';
+		case DataType::Int8: return 'a';
+		case DataType::UInt8: return 'h';
+		case DataType::Int16: return 's';
+		case DataType::UInt16: return 't';
+		case DataType::Int32: return 'i';
+		case DataType::UInt32: return 'j';
+		case DataType::Int64: return 'x';
+		case DataType::UInt64: return 'y';
+		case DataType::Float: return 'f';
+		case DataType::Double: return 'd';
+		case DataType::Pointer: return 'p';
+		case DataType::String: return 'z';
+	}
+	return '?';
+}
+
+bool Signature::fromChar(char c, DataType& type) noexcept {
+	switch (c) {
+		case 'v': type = DataType::Void; return true;
+		case 'b': type = DataType::Bool; return true;
+		case 'a': type = DataType::Int8; return true;
+		case 'h': type = DataType::UInt8; return true;
+		case 's': type = DataType::Int16; return true;
+		case 't': type = DataType::UInt16; return true;
+		case 'i': type = DataType::Int32; return true;
+		case 'j': type = DataType::UInt32; return true;
+		case 'x': type = DataType::Int64; return true;
+		case 'y': type = DataType::UInt64; return true;
+		case 'f': type = DataType::Float; return true;
+		case 'd': type = DataType::Double; return true;
+		case 'p': type = DataType::Pointer; return true;
+		case 'z': type = DataType::String; return true;
+		default: return false;
+	}
+}
+
+TypeId Signature::getTypeId(DataType type) noexcept {
+	switch (type) {
+		case DataType::Void:
+			return getTypeIdx<void>();
+		case DataType::Bool:
+			return getTypeIdx<bool>();
+		case DataType::Int8:
+			return getTypeIdx<int8_t>();
+		case DataType::Int16:
+			return getTypeIdx<int16_t>();
+		case DataType::Int32:
+			return getTypeIdx<int32_t>();
+		case DataType::Int64:
+			return getTypeIdx<int64_t>();
+		case DataType::UInt8:
+			return getTypeIdx<uint8_t>();
+		case DataType::UInt16:
+			return getTypeIdx<uint16_t>();
+		case DataType::UInt32:
+			return getTypeIdx<uint32_t>();
+		case DataType::UInt64:
+			return getTypeIdx<uint64_t>();
+		case DataType::Float:
+			return getTypeIdx<float>();
+		case DataType::Double:
+			return getTypeIdx<double>();
+		case DataType::Pointer:
+		case DataType::String:
+			return TypeId::kUIntPtr;
+	}
+	return TypeId::kVoid;
+}
+
+SignatureTable& SignatureTable::instance() {
+	// intentionally leaked, stubs may still reference signatures during static destruction
+	static auto* table = new SignatureTable();
+	return *table;
+}
+
+const Signature* SignatureTable::intern(DataType returnType, std::span<const DataType> arguments, uint8_t vaIndex) {
+	if (vaIndex >= arguments.size())
+		vaIndex = 0xFF;
+
+	std::string text = MakeText(returnType, arguments, vaIndex);
+
+	{
+		std::shared_lock lock(m_mutex);
+		auto it = m_signatures.find(text);
+		if (it != m_signatures.end())
+			return it->second.get();
+	}
+
+	return insert(std::move(text), returnType, arguments, vaIndex);
+}
+
+const Signature* SignatureTable::parse(std::string_view text) {
+	// fast path, already interned in canonical form
+	{
+		std::shared_lock lock(m_mutex);
+		auto it = m_signatures.find(text);
+		if (it != m_signatures.end())
+			return it->second.get();
+	}
+
+	DataType returnType;
+	if (text.size() < 3 || !Signature::fromChar(text[0], returnType) || text[1] != '(' || text.back() != ')')
+		return nullptr;
+
+	std::vector<DataType> arguments;
+	arguments.reserve(text.size() - 3);
+	uint8_t vaIndex = 0xFF;
+
+	for (char c : text.substr(2, text.size() - 3)) {
+		if (c == '.') {
+			if (vaIndex != 0xFF)
+				return nullptr;
+			vaIndex = static_cast<uint8_t>(arguments.size());
+			continue;
+		}
+
+		DataType type;
+		if (!Signature::fromChar(c, type) || type == DataType::Void)
+			return nullptr;
+		arguments.push_back(type);
+	}
+
+	if (arguments.size() >= 0xFF)
+		return nullptr;
+
+	return intern(returnType, arguments, vaIndex);
+}
+
+const Signature* SignatureTable::insert(std::string text, DataType returnType, std::span<const DataType> arguments, uint8_t vaIndex) {
+	std::unique_lock lock(m_mutex);
+
+	auto it = m_signatures.find(text);
+	if (it != m_signatures.end())
+		return it->second.get();
+
+	auto signature = std::make_unique<Signature>();
+	signature->returnType = returnType;
+	signature->vaIndex = vaIndex;
+	signature->arguments.assign(arguments.begin(), arguments.end());
+	signature->funcSignature = FuncSignature(CallConvId::kCDecl, vaIndex, Signature::getTypeId(returnType));
+	for (DataType type : arguments) {
+		signature->funcSignature.addArg(Signature::getTypeId(type));
+	}
+	signature->text = text;
+
+	return m_signatures.emplace(std::move(text), std::move(signature)).first->second.get();
+}
+
+size_t SignatureTable::size() const {
+	std::shared_lock lock(m_mutex);
+	return m_signatures.size();
+}
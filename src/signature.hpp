@@ -0,0 +1,57 @@
+#pragma once
+
+#include "callback.hpp"
+
+#include <memory>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace PLH {
+	/**
+	 * Interned hook signature. Owned by SignatureTable and never freed, so the pointer doubles as a
+	 * handle which callers can keep for later hooks and which stubs can reference directly.
+	 *
+	 * Text form is "<ret>(<args>)" with one letter per type and '.' before the first variadic argument:
+	 *   v void, b bool, a int8, h uint8, s int16, t uint16, i int32, j uint32,
+	 *   x int64, y uint64, f float, d double, p pointer, z string
+	 * e.g. "i(pif)" or "v(p.ii)".
+	 */
+	struct Signature {
+		DataType returnType = DataType::Void;
+		uint8_t vaIndex = 0xFF;               ///< index of the first variadic argument, 0xFF if none
+		std::vector<DataType> arguments;
+		asmjit::FuncSignature funcSignature;  ///< prebuilt for the JIT compiler
+		std::string text;                     ///< canonical text form
+
+		static char toChar(DataType type) noexcept;
+		static bool fromChar(char c, DataType& type) noexcept;
+		static asmjit::TypeId getTypeId(DataType type) noexcept;
+	};
+
+	class SignatureTable {
+	public:
+		static SignatureTable& instance();
+
+		const Signature* intern(DataType returnType, std::span<const DataType> arguments, uint8_t vaIndex);
+		const Signature* parse(std::string_view text);
+
+		size_t size() const;
+
+	private:
+		SignatureTable() = default;
+
+		const Signature* insert(std::string text, DataType returnType, std::span<const DataType> arguments, uint8_t vaIndex);
+
+		struct StringHash {
+			using is_transparent = void;
+			size_t operator()(std::string_view str) const noexcept { return std::hash<std::string_view>{}(str); }
+		};
+
+		mutable std::shared_mutex m_mutex;
+		std::unordered_map<std::string, std::unique_ptr<Signature>, StringHash, std::equal_to<>> m_signatures;
+	};
+}
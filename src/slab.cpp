@@ -0,0 +1,62 @@
+#include "slab.hpp"
+
+#include <algorithm>
+#include <new>
+
+namespace {
+	constexpr size_t AlignUp(size_t value, size_t alignment) noexcept {
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+PLH::Slab::Slab(size_t slotSize, size_t alignment) : m_slotSize(AlignUp(std::max(slotSize, sizeof(FreeSlot)), alignment)) {
+}
+
+PLH::Slab::~Slab() {
+	for (void* page : m_pages) {
+		::operator delete(page, std::align_val_t{kPageAlignment});
+	}
+}
+
+void* PLH::Slab::allocate() {
+	std::lock_guard lock(m_mutex);
+
+	if (FreeSlot* slot = m_free) {
+		m_free = slot->next;
+		++m_used;
+		return slot;
+	}
+
+	if (m_end - m_cursor < static_cast<ptrdiff_t>(m_slotSize)) {
+		auto* page = static_cast<uint8_t*>(::operator new(kPageSize, std::align_val_t{kPageAlignment}));
+		m_pages.push_back(page);
+		m_cursor = page;
+		m_end = page + kPageSize;
+	}
+
+	void* slot = m_cursor;
+	m_cursor += m_slotSize;
+	++m_used;
+	return slot;
+}
+
+void PLH::Slab::deallocate(void* p) noexcept {
+	if (!p)
+		return;
+
+	std::lock_guard lock(m_mutex);
+	auto* slot = static_cast<FreeSlot*>(p);
+	slot->next = m_free;
+	m_free = slot;
+	--m_used;
+}
+
+size_t PLH::Slab::getUsedSlots() const {
+	std::lock_guard lock(m_mutex);
+	return m_used;
+}
+
+size_t PLH::Slab::getReservedBytes() const {
+	std::lock_guard lock(m_mutex);
+	return m_pages.size() * kPageSize;
+}
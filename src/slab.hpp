@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace PLH {
+	/**
+	 * Hands out fixed size slots carved from 64 KiB pages, so objects used together sit next to each other
+	 * instead of wherever the heap puts them. Freed slots are reused most recently freed first, pages are
+	 * only returned when the slab is destroyed.
+	 */
+	class Slab {
+	public:
+		static constexpr size_t kPageSize = 64 * 1024;
+		static constexpr size_t kPageAlignment = 4096;
+
+		Slab(size_t slotSize, size_t alignment);
+		~Slab();
+		Slab(const Slab&) = delete;
+		Slab& operator=(const Slab&) = delete;
+
+		void* allocate();
+		void deallocate(void* p) noexcept;
+
+		size_t getSlotSize() const noexcept { return m_slotSize; }
+		size_t getUsedSlots() const;
+		size_t getReservedBytes() const;
+
+	private:
+		struct FreeSlot {
+			FreeSlot* next;
+		};
+
+		const size_t m_slotSize;
+		mutable std::mutex m_mutex;
+		std::vector<void*> m_pages;
+		FreeSlot* m_free = nullptr;
+		uint8_t* m_cursor = nullptr;
+		uint8_t* m_end = nullptr;
+		size_t m_used = 0;
+	};
+}
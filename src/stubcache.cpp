@@ -0,0 +1,311 @@
+#include "stubcache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace asmjit;
+
+namespace {
+	constexpr uint32_t kMagic = 0x43534850; // 'PHSC'
+	constexpr uint32_t kFormat = 2; // bump whenever the generated stub or the pre/post contract changes
+
+#if PLUGIFY_IS_RELEASE
+	constexpr uint8_t kRelease = 1;
+#else
+	constexpr uint8_t kRelease = 0;
+#endif
+
+	struct FileHeader {
+		uint32_t magic;
+		uint32_t format;
+		uint64_t key;
+		uint32_t count;
+		uint32_t reserved;
+	};
+
+	struct RecordHeader {
+		uint32_t textSize;
+		uint32_t codeSize;
+		uint32_t offsets[PLH::StubTemplate::kSlotCount];
+		PLH::FrameLayout layout;
+		uint64_t hash; ///< over the signature text, code and offsets, catches a torn or corrupted record, not a forged one
+	};
+
+	// records start 8 byte aligned, so the file can be mapped and read in place
+	constexpr size_t AlignUp(size_t value) noexcept {
+		return (value + 7) & ~size_t{7};
+	}
+
+	uint64_t Fnv1a(uint64_t hash, const void* data, size_t size) noexcept {
+		const auto* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; ++i) {
+			hash ^= bytes[i];
+			hash *= 0x100000001B3ull;
+		}
+		return hash;
+	}
+
+	uint64_t GetEnvironmentKey(const JitRuntime& rt, std::string_view version) noexcept {
+		uint64_t key = 0xCBF29CE484222325ull;
+		key = Fnv1a(key, &kFormat, sizeof(kFormat));
+		key = Fnv1a(key, &kRelease, sizeof(kRelease));
+
+		const uint32_t library = ASMJIT_LIBRARY_VERSION;
+		key = Fnv1a(key, &library, sizeof(library));
+
+		const auto arch = static_cast<uint32_t>(rt.environment().arch());
+		key = Fnv1a(key, &arch, sizeof(arch));
+
+		const CpuFeatures& features = rt.cpuFeatures();
+		key = Fnv1a(key, &features, sizeof(features));
+
+		return Fnv1a(key, version.data(), version.size());
+	}
+
+	// the templates are executed as they are read, so only a file no other user could have written is trusted
+	bool ReadTrusted(const std::filesystem::path& path, std::vector<uint8_t>& data) {
+#if defined(__linux__)
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+		if (fd < 0)
+			return false;
+
+		struct stat info{};
+		bool trusted = fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_uid == geteuid() && !(info.st_mode & (S_IWGRP | S_IWOTH));
+		if (trusted) {
+			data.resize(static_cast<size_t>(info.st_size));
+			size_t offset = 0;
+			while (offset < data.size()) {
+				const ssize_t count = read(fd, data.data() + offset, data.size() - offset);
+				if (count <= 0)
+					break;
+				offset += static_cast<size_t>(count);
+			}
+			trusted = offset == data.size();
+		}
+		close(fd);
+		return trusted;
+#else
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+		data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return true;
+#endif
+	}
+
+	uint64_t GetRecordHash(std::string_view text, std::span<const uint8_t> code, const uint32_t* offsets) noexcept {
+		uint64_t hash = 0xCBF29CE484222325ull;
+		hash = Fnv1a(hash, text.data(), text.size());
+		hash = Fnv1a(hash, code.data(), code.size());
+		return Fnv1a(hash, offsets, sizeof(uint32_t) * PLH::StubTemplate::kSlotCount);
+	}
+}
+
+uintptr_t PLH::StubTemplate::placeholder(Slot slot) noexcept {
+	// not a valid address and too wide for a sign extended imm32, so every value patched in later has the same encoding
+	return static_cast<uintptr_t>(0xC0DE00007EA5005Aull | (static_cast<uint64_t>(slot) << 8));
+}
+
+bool PLH::StubTemplate::locate() {
+	for (uint8_t slot = 0; slot < kSlotCount; ++slot) {
+		const uintptr_t value = placeholder(static_cast<Slot>(slot));
+
+		size_t found = 0;
+		for (size_t i = 0; i + sizeof(value) <= code.size(); ++i) {
+			if (std::memcmp(code.data() + i, &value, sizeof(value)) == 0) {
+				offsets[slot] = static_cast<uint32_t>(i);
+				++found;
+			}
+		}
+
+		// a constant folded into another instruction or a stray match, the template cannot be patched safely
+		if (found != 1)
+			return false;
+	}
+	return true;
+}
+
+bool PLH::StubTemplate::validate() const noexcept {
+	for (uint8_t slot = 0; slot < kSlotCount; ++slot) {
+		const uintptr_t value = placeholder(static_cast<Slot>(slot));
+		if (offsets[slot] + sizeof(value) > code.size())
+			return false;
+		if (std::memcmp(code.data() + offsets[slot], &value, sizeof(value)) != 0)
+			return false;
+	}
+	return true;
+}
+
+std::vector<uint8_t> PLH::StubTemplate::instantiate(const Values& values) const {
+	std::vector<uint8_t> bytes = code;
+	for (uint8_t slot = 0; slot < kSlotCount; ++slot) {
+		std::memcpy(bytes.data() + offsets[slot], &values[slot], sizeof(uintptr_t));
+	}
+	return bytes;
+}
+
+PLH::StubCache& PLH::StubCache::instance() {
+	// leaked, hooks may still be installed from static destructors
+	static auto* cache = new StubCache();
+	return *cache;
+}
+
+bool PLH::StubCache::open(const std::filesystem::path& path, const JitRuntime& rt, std::string_view version) {
+	std::lock_guard lock(m_mutex);
+
+	m_path = path;
+	m_key = GetEnvironmentKey(rt, version);
+
+	std::error_code ec;
+	if (!std::filesystem::exists(path, ec))
+		return false;
+
+	std::vector<uint8_t> data;
+	if (!ReadTrusted(path, data) || !load(data)) {
+		// stale, foreign or writable by others, rewrite it with what this process compiles
+		m_dirty = true;
+		return false;
+	}
+	return true;
+}
+
+bool PLH::StubCache::load(std::span<const uint8_t> data) {
+	FileHeader header;
+	if (data.size() < sizeof(header))
+		return false;
+	std::memcpy(&header, data.data(), sizeof(header));
+
+	if (header.magic != kMagic || header.format != kFormat || header.key != m_key)
+		return false;
+
+	std::vector<std::pair<std::string, std::shared_ptr<StubTemplate>>> loaded;
+
+	size_t offset = sizeof(header);
+	for (uint32_t i = 0; i < header.count; ++i) {
+		RecordHeader record;
+		if (data.size() - offset < sizeof(record))
+			return false;
+		std::memcpy(&record, data.data() + offset, sizeof(record));
+		offset += sizeof(record);
+
+		if (data.size() - offset < size_t{record.textSize} + record.codeSize)
+			return false;
+
+		std::string text(reinterpret_cast<const char*>(data.data() + offset), record.textSize);
+		offset += record.textSize;
+
+		// the code is executed as is, any record that does not match what was written rejects the whole file
+		if (record.hash != GetRecordHash(text, data.subspan(offset, record.codeSize), record.offsets))
+			return false;
+
+		auto stub = std::make_shared<StubTemplate>();
+		stub->code.assign(data.data() + offset, data.data() + offset + record.codeSize);
+		std::memcpy(stub->offsets.data(), record.offsets, sizeof(record.offsets));
+		stub->layout = record.layout;
+		offset = std::min(AlignUp(offset + record.codeSize), data.size());
+
+		if (stub->validate()) {
+			loaded.emplace_back(std::move(text), std::move(stub));
+		}
+	}
+
+	for (auto& [text, stub] : loaded) {
+		m_templates.try_emplace(std::move(text), std::move(stub));
+	}
+	return true;
+}
+
+bool PLH::StubCache::save() {
+	std::lock_guard lock(m_mutex);
+
+	if (m_path.empty() || !m_dirty)
+		return false;
+
+	std::error_code ec;
+	std::filesystem::create_directories(m_path.parent_path(), ec);
+
+	// write next to the target and swap, a crash mid-write must not leave a truncated cache behind
+	auto temp = m_path;
+	temp += ".tmp";
+	{
+		std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+
+		FileHeader header{kMagic, kFormat, m_key, static_cast<uint32_t>(m_templates.size()), 0};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		size_t offset = sizeof(header);
+		for (const auto& [text, stub] : m_templates) {
+			RecordHeader record{};
+			record.textSize = static_cast<uint32_t>(text.size());
+			record.codeSize = static_cast<uint32_t>(stub->code.size());
+			std::memcpy(record.offsets, stub->offsets.data(), sizeof(record.offsets));
+			record.layout = stub->layout;
+			record.hash = GetRecordHash(text, stub->code, record.offsets);
+
+			file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+			file.write(text.data(), static_cast<std::streamsize>(text.size()));
+			file.write(reinterpret_cast<const char*>(stub->code.data()), static_cast<std::streamsize>(stub->code.size()));
+
+			offset += sizeof(record) + text.size() + stub->code.size();
+			const size_t padding = AlignUp(offset) - offset;
+			static constexpr char kZero[8] = {};
+			file.write(kZero, static_cast<std::streamsize>(padding));
+			offset += padding;
+		}
+
+		if (!file)
+			return false;
+	}
+
+	// whatever the umask, the next load only accepts a file nobody else can write
+	std::filesystem::permissions(temp, std::filesystem::perms::owner_read | std::filesystem::perms::owner_write, ec);
+	if (ec)
+		return false;
+
+	std::filesystem::rename(temp, m_path, ec);
+	if (ec)
+		return false;
+
+	m_dirty = false;
+	return true;
+}
+
+void PLH::StubCache::close() {
+	std::lock_guard lock(m_mutex);
+	m_path.clear();
+	m_key = 0;
+	m_dirty = false;
+}
+
+std::shared_ptr<const PLH::StubTemplate> PLH::StubCache::find(std::string_view signature) const {
+	std::lock_guard lock(m_mutex);
+	auto it = m_templates.find(std::string(signature));
+	return it != m_templates.end() ? it->second : nullptr;
+}
+
+void PLH::StubCache::store(std::string_view signature, std::shared_ptr<const StubTemplate> stub) {
+	std::lock_guard lock(m_mutex);
+	if (m_templates.try_emplace(std::string(signature), std::move(stub)).second) {
+		m_dirty = true;
+	}
+}
+
+bool PLH::StubCache::isDirty() const {
+	std::lock_guard lock(m_mutex);
+	return m_dirty;
+}
+
+size_t PLH::StubCache::size() const {
+	std::lock_guard lock(m_mutex);
+	return m_templates.size();
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#pragma warning(push, 0)
+#include <asmjit/asmjit.h>
+#pragma warning( pop )
+
+#include "unwind.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace PLH {
+	/**
+	 * Position independent stub code with the per-hook constants left as placeholders.
+	 *
+	 * Every constant is loaded with a 64 bit immediate (a 32 bit one on x86), so installing a hook
+	 * is a copy of the template with the immediates at offsets[] replaced.
+	 */
+	struct StubTemplate {
+		enum Slot : uint8_t {
+			kCallback,
+			kCalls,
+			kTrampoline,
+			kPre,
+			kPost,
+			kSlotCount
+		};
+
+		using Values = std::array<uintptr_t, kSlotCount>;
+
+		static uintptr_t placeholder(Slot slot) noexcept;
+
+		bool locate();
+		bool validate() const noexcept;
+		std::vector<uint8_t> instantiate(const Values& values) const;
+
+		std::vector<uint8_t> code;
+		std::array<uint32_t, kSlotCount> offsets{};
+		FrameLayout layout;
+	};
+
+	/**
+	 * Stub templates keyed by signature text.
+	 *
+	 * Lookups are served from memory, so hooks sharing a signature are only compiled once per process.
+	 * Once opened with a file the templates survive restarts. The file starts with a key over the CPU
+	 * features, asmjit and plugin version and the build type, a file written for any other combination
+	 * is ignored and replaced on the next save.
+	 */
+	class StubCache {
+	public:
+		static StubCache& instance();
+
+		bool open(const std::filesystem::path& path, const asmjit::JitRuntime& rt, std::string_view version);
+		bool save();
+		void close();
+
+		std::shared_ptr<const StubTemplate> find(std::string_view signature) const;
+		void store(std::string_view signature, std::shared_ptr<const StubTemplate> stub);
+
+		bool isDirty() const;
+		size_t size() const;
+
+	private:
+		StubCache() = default;
+
+		bool load(std::span<const uint8_t> data);
+
+		mutable std::mutex m_mutex;
+		std::unordered_map<std::string, std::shared_ptr<const StubTemplate>> m_templates;
+		std::filesystem::path m_path;
+		uint64_t m_key = 0;
+		bool m_dirty = false;
+	};
+}
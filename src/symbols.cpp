@@ -0,0 +1,241 @@
+#include "symbols.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#include <elf.h>
+#include <unistd.h>
+#endif
+
+// GDB JIT compilation interface, see https://sourceware.org/gdb/current/onlinedocs/gdb.html/JIT-Interface.html
+// GDB looks these two symbols up by name, so they must keep C linkage and stay exported.
+extern "C" {
+	enum jit_actions_t : uint32_t {
+		JIT_NOACTION = 0,
+		JIT_REGISTER_FN,
+		JIT_UNREGISTER_FN
+	};
+
+	struct jit_code_entry {
+		jit_code_entry* next_entry;
+		jit_code_entry* prev_entry;
+		const char* symfile_addr;
+		uint64_t symfile_size;
+	};
+
+	struct jit_descriptor {
+		uint32_t version;
+		uint32_t action_flag;
+		jit_code_entry* relevant_entry;
+		jit_code_entry* first_entry;
+	};
+
+#if defined(_MSC_VER)
+	__declspec(noinline) void __jit_debug_register_code() {}
+	jit_descriptor __jit_debug_descriptor = { 1, JIT_NOACTION, nullptr, nullptr };
+#else
+	__attribute__((visibility("default"), noinline, used)) void __jit_debug_register_code() { __asm__ __volatile__("" ::: "memory"); }
+	__attribute__((visibility("default"), used)) jit_descriptor __jit_debug_descriptor = { 1, JIT_NOACTION, nullptr, nullptr };
+#endif
+}
+
+using namespace std::string_view_literals;
+
+namespace {
+	struct GdbEntry {
+		jit_code_entry entry{};
+		std::vector<uint8_t> image;
+	};
+
+	struct State {
+		std::mutex mutex;
+		std::unordered_map<uint64_t, std::unique_ptr<GdbEntry>> gdbEntries;
+		std::FILE* perfMap{};
+		bool perfEnabled{};
+		bool gdbEnabled{};
+
+		State() {
+			perfEnabled = std::getenv("POLYHOOK_PERF_MAP") != nullptr;
+			gdbEnabled = std::getenv("POLYHOOK_GDB_JIT") != nullptr;
+		}
+
+		~State() {
+			if (perfMap) {
+				std::fclose(perfMap);
+			}
+		}
+	};
+
+	State& GetState() {
+		static State state;
+		return state;
+	}
+
+#if defined(__linux__)
+	// Builds a minimal relocatable ELF image with a single NOBITS .text section placed at the stub address
+	// and one function symbol covering it, this is all GDB needs to symbolize the frame.
+	std::vector<uint8_t> BuildElfImage(uint64_t address, size_t size, std::string_view name) {
+		enum Section : uint16_t { Null, Text, ShStrTab, StrTab, SymTab, Count };
+
+		constexpr std::string_view shstrtab = "\0.text\0.shstrtab\0.strtab\0.symtab\0"sv;
+		constexpr uint32_t kTextName = 1, kShStrTabName = 7, kStrTabName = 17, kSymTabName = 25;
+
+		std::string strtab("\0polyhook-jit\0", 14);
+		const auto nameOffset = static_cast<uint32_t>(strtab.size());
+		strtab.append(name);
+		strtab.push_back('\0');
+
+		const size_t shdrOffset = sizeof(Elf64_Ehdr);
+		const size_t symOffset = shdrOffset + sizeof(Elf64_Shdr) * Count;
+		const size_t symCount = 3;
+		const size_t shstrOffset = symOffset + sizeof(Elf64_Sym) * symCount;
+		const size_t strOffset = shstrOffset + shstrtab.size();
+
+		std::vector<uint8_t> image(strOffset + strtab.size());
+
+		auto& ehdr = *reinterpret_cast<Elf64_Ehdr*>(image.data());
+		std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+		ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+		ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+		ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+		ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+		ehdr.e_type = ET_REL;
+		ehdr.e_machine = EM_X86_64;
+		ehdr.e_version = EV_CURRENT;
+		ehdr.e_shoff = shdrOffset;
+		ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+		ehdr.e_shentsize = sizeof(Elf64_Shdr);
+		ehdr.e_shnum = Count;
+		ehdr.e_shstrndx = ShStrTab;
+
+		auto* shdr = reinterpret_cast<Elf64_Shdr*>(image.data() + shdrOffset);
+		shdr[Text].sh_name = kTextName;
+		shdr[Text].sh_type = SHT_NOBITS;
+		shdr[Text].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+		shdr[Text].sh_addr = address;
+		shdr[Text].sh_size = size;
+		shdr[Text].sh_addralign = 16;
+
+		shdr[ShStrTab].sh_name = kShStrTabName;
+		shdr[ShStrTab].sh_type = SHT_STRTAB;
+		shdr[ShStrTab].sh_offset = shstrOffset;
+		shdr[ShStrTab].sh_size = shstrtab.size();
+		shdr[ShStrTab].sh_addralign = 1;
+
+		shdr[StrTab].sh_name = kStrTabName;
+		shdr[StrTab].sh_type = SHT_STRTAB;
+		shdr[StrTab].sh_offset = strOffset;
+		shdr[StrTab].sh_size = strtab.size();
+		shdr[StrTab].sh_addralign = 1;
+
+		shdr[SymTab].sh_name = kSymTabName;
+		shdr[SymTab].sh_type = SHT_SYMTAB;
+		shdr[SymTab].sh_offset = symOffset;
+		shdr[SymTab].sh_size = sizeof(Elf64_Sym) * symCount;
+		shdr[SymTab].sh_link = StrTab;
+		shdr[SymTab].sh_info = 2; // index of the first non-local symbol
+		shdr[SymTab].sh_addralign = alignof(Elf64_Sym);
+		shdr[SymTab].sh_entsize = sizeof(Elf64_Sym);
+
+		auto* sym = reinterpret_cast<Elf64_Sym*>(image.data() + symOffset);
+		sym[1].st_name = 1;
+		sym[1].st_info = ELF64_ST_INFO(STB_LOCAL, STT_FILE);
+		sym[1].st_shndx = SHN_ABS;
+		sym[2].st_name = nameOffset;
+		sym[2].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+		sym[2].st_shndx = Text;
+		sym[2].st_value = 0;
+		sym[2].st_size = size;
+
+		std::memcpy(image.data() + shstrOffset, shstrtab.data(), shstrtab.size());
+		std::memcpy(image.data() + strOffset, strtab.data(), strtab.size());
+
+		return image;
+	}
+#endif
+}
+
+bool PLH::JitSymbols::isEnabled() noexcept {
+	const State& state = GetState();
+	return state.perfEnabled || state.gdbEnabled;
+}
+
+void PLH::JitSymbols::add(uint64_t address, size_t size, std::string_view name) {
+	State& state = GetState();
+	if (!address || !(state.perfEnabled || state.gdbEnabled))
+		return;
+
+	std::lock_guard lock(state.mutex);
+
+#if defined(__linux__)
+	if (state.perfEnabled) {
+		if (!state.perfMap) {
+			char path[64];
+			std::snprintf(path, sizeof(path), "/tmp/perf-%d.map", static_cast<int>(getpid()));
+			state.perfMap = std::fopen(path, "a");
+		}
+		// perf maps are append-only, a range reused by a newer stub is shadowed by the later line
+		if (state.perfMap) {
+			std::fprintf(state.perfMap, "%llx %zx %.*s\n", static_cast<unsigned long long>(address), size, static_cast<int>(name.size()), name.data());
+			std::fflush(state.perfMap);
+		}
+	}
+
+#if defined(__x86_64__)
+	if (state.gdbEnabled) {
+		auto entry = std::make_unique<GdbEntry>();
+		entry->image = BuildElfImage(address, size, name);
+		entry->entry.symfile_addr = reinterpret_cast<const char*>(entry->image.data());
+		entry->entry.symfile_size = entry->image.size();
+
+		entry->entry.next_entry = __jit_debug_descriptor.first_entry;
+		if (entry->entry.next_entry) {
+			entry->entry.next_entry->prev_entry = &entry->entry;
+		}
+		__jit_debug_descriptor.first_entry = &entry->entry;
+		__jit_debug_descriptor.relevant_entry = &entry->entry;
+		__jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+		__jit_debug_register_code();
+
+		state.gdbEntries.insert_or_assign(address, std::move(entry));
+	}
+#endif
+#else
+	(void) size;
+	(void) name;
+#endif
+}
+
+void PLH::JitSymbols::remove(uint64_t address) {
+	State& state = GetState();
+	if (!state.gdbEnabled)
+		return;
+
+	std::lock_guard lock(state.mutex);
+
+	auto it = state.gdbEntries.find(address);
+	if (it == state.gdbEntries.end())
+		return;
+
+	jit_code_entry* entry = &it->second->entry;
+	if (entry->prev_entry) {
+		entry->prev_entry->next_entry = entry->next_entry;
+	} else {
+		__jit_debug_descriptor.first_entry = entry->next_entry;
+	}
+	if (entry->next_entry) {
+		entry->next_entry->prev_entry = entry->prev_entry;
+	}
+	__jit_debug_descriptor.relevant_entry = entry;
+	__jit_debug_descriptor.action_flag = JIT_UNREGISTER_FN;
+	__jit_debug_register_code();
+
+	state.gdbEntries.erase(it);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+namespace PLH {
+	/**
+	 * Publishes names of JIT generated stubs to external profilers and debuggers.
+	 *
+	 * Every stub is appended to /tmp/perf-<pid>.map when POLYHOOK_PERF_MAP is set in the
+	 * environment and registered through the GDB JIT interface when POLYHOOK_GDB_JIT is set.
+	 */
+	class JitSymbols {
+	public:
+		static void add(uint64_t address, size_t size, std::string_view name);
+		static void remove(uint64_t address);
+
+		static bool isEnabled() noexcept;
+	};
+}
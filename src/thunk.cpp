@@ -0,0 +1,140 @@
+#include "thunk.hpp"
+#include "arena.hpp"
+
+#include "polyhook2/MemProtector.hpp"
+
+#include <cstring>
+
+using namespace asmjit;
+
+namespace {
+	constexpr uint8_t kInt3 = 0xCC;
+}
+
+PLH::ThunkPool::ThunkPool(std::weak_ptr<JitRuntime> rt) : m_rt(std::move(rt)) {
+}
+
+PLH::ThunkPool::~ThunkPool() {
+	if (auto rt = m_rt.lock()) {
+		for (const auto& block : m_blocks) {
+			rt->release(block.base);
+		}
+	}
+}
+
+uint64_t PLH::ThunkPool::acquire(const void* context) {
+	std::lock_guard lock(m_mutex);
+
+	const uint64_t hint = JitArena::getNearHint();
+
+	Block* target = nullptr;
+	for (auto& block : m_blocks) {
+		if (!block.free.empty() && JitArena::isNear(block.base, hint, kBlockSize)) {
+			target = &block;
+			break;
+		}
+	}
+	if (!target) {
+		target = grow();
+		if (!target)
+			return 0;
+	}
+
+	uint64_t slot = target->free.back();
+	target->free.pop_back();
+
+	uint8_t bytes[kSlotSize];
+	std::memset(bytes, kInt3, sizeof(bytes));
+
+	// mov r11, imm64
+	bytes[0] = 0x49;
+	bytes[1] = 0xBB;
+	const auto address = reinterpret_cast<uint64_t>(context);
+	std::memcpy(bytes + 2, &address, sizeof(address));
+
+	// jmp qword ptr [r11]
+	bytes[10] = 0x41;
+	bytes[11] = 0xFF;
+	bytes[12] = 0x23;
+
+	write(slot, bytes);
+	++m_used;
+	return slot;
+}
+
+void PLH::ThunkPool::release(uint64_t thunk) {
+	if (!thunk)
+		return;
+
+	std::lock_guard lock(m_mutex);
+
+	// trap instead of jumping into a freed context if something still calls it
+	uint8_t bytes[kSlotSize];
+	std::memset(bytes, kInt3, sizeof(bytes));
+	write(thunk, bytes);
+
+	for (auto& block : m_blocks) {
+		if (thunk >= block.base && thunk < block.base + kBlockSize) {
+			block.free.push_back(thunk);
+			break;
+		}
+	}
+	--m_used;
+}
+
+size_t PLH::ThunkPool::getUsedSlots() const {
+	std::lock_guard lock(m_mutex);
+	return m_used;
+}
+
+size_t PLH::ThunkPool::getReservedBytes() const {
+	std::lock_guard lock(m_mutex);
+	return m_blocks.size() * kBlockSize;
+}
+
+PLH::ThunkPool::Block* PLH::ThunkPool::grow() {
+	auto rt = m_rt.lock();
+	if (!rt)
+		return nullptr;
+
+	CodeHolder code;
+	code.init(rt->environment(), rt->cpuFeatures());
+	x86::Assembler a(&code);
+
+	uint8_t fill[kSlotSize];
+	std::memset(fill, kInt3, sizeof(fill));
+	for (size_t i = 0; i < kBlockSize / kSlotSize; ++i) {
+		a.embed(fill, sizeof(fill));
+	}
+
+	// placed by the JitArena near the current hint
+	uint64_t base = 0;
+	if (rt->add(&base, &code) != kErrorOk)
+		return nullptr;
+
+	auto& block = m_blocks.emplace_back(Block{base, {}});
+
+	// hand out low addresses first
+	block.free.reserve(kBlockSize / kSlotSize);
+	for (size_t i = kBlockSize / kSlotSize; i-- > 0;) {
+		block.free.push_back(base + i * kSlotSize);
+	}
+	return &block;
+}
+
+void PLH::ThunkPool::write(uint64_t slot, const uint8_t* bytes) {
+	// arena code has a writable view, patching it never touches page protection
+	if (auto rt = m_rt.lock()) {
+		if (auto* arena = dynamic_cast<JitArena*>(rt.get())) {
+			if (void* writable = arena->getWritable(slot)) {
+				std::memcpy(writable, bytes, kSlotSize);
+				VirtMem::flushInstructionCache(reinterpret_cast<void*>(slot), kSlotSize);
+				return;
+			}
+		}
+	}
+
+	// JIT memory is mapped read/execute, other thunks in the page stay executable while it is writable
+	MemoryProtector protector(slot, kSlotSize, RWX, *this);
+	std::memcpy(reinterpret_cast<void*>(slot), bytes, kSlotSize);
+}
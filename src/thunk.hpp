@@ -0,0 +1,52 @@
+#pragma once
+
+#pragma warning(push, 0)
+#include <asmjit/asmjit.h>
+#pragma warning( pop )
+
+#include "polyhook2/MemAccessor.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace PLH {
+	/**
+	 * Packs per-hook entry thunks into shared executable blocks instead of one JitRuntime allocation each.
+	 *
+	 * A thunk is 'mov r11, imm64; jmp [r11]', 13 bytes padded to a 16 byte slot, so the entry target has to
+	 * be the first member of the context it points to. A thunk is taken from a block within rel32 range of
+	 * the current JitArena::NearScope when there is one. Blocks are only released with the pool.
+	 */
+	class ThunkPool : public MemAccessor {
+	public:
+		static constexpr size_t kSlotSize = 16;
+		static constexpr size_t kBlockSize = 4096;
+
+		explicit ThunkPool(std::weak_ptr<asmjit::JitRuntime> rt);
+		~ThunkPool();
+		ThunkPool(const ThunkPool&) = delete;
+		ThunkPool& operator=(const ThunkPool&) = delete;
+
+		uint64_t acquire(const void* context);
+		void release(uint64_t thunk);
+
+		size_t getUsedSlots() const;
+		size_t getReservedBytes() const;
+
+	private:
+		struct Block {
+			uint64_t base;
+			std::vector<uint64_t> free;
+		};
+
+		Block* grow();
+		void write(uint64_t slot, const uint8_t* bytes);
+
+		std::weak_ptr<asmjit::JitRuntime> m_rt;
+		mutable std::mutex m_mutex;
+		std::vector<Block> m_blocks;
+		size_t m_used = 0;
+	};
+}
@@ -0,0 +1,249 @@
+#include "tier.hpp"
+#include "signature.hpp"
+#include "symbols.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string_view>
+
+using namespace asmjit;
+
+namespace {
+	constexpr uint32_t kDefaultThreshold = 100;
+
+#if defined(_WIN32)
+	constexpr int32_t kShadowSpace = 32;
+	constexpr int32_t kStackArgs = 16 + 32; // saved rbp, return address, home space
+#else
+	constexpr int32_t kShadowSpace = 0;
+	constexpr int32_t kStackArgs = 16;      // saved rbp, return address
+#endif
+
+	constexpr int32_t kFrameSize = static_cast<int32_t>((sizeof(PLH::GenericFrame) + kShadowSpace + 15) & ~size_t{15});
+	constexpr int32_t kFrameDisp = -kFrameSize + kShadowSpace;
+
+	bool IsDisabled() {
+		const char* value = std::getenv("POLYHOOK_TIERING");
+		return value && value[0] == '0';
+	}
+
+	uint32_t GetThreshold() {
+		if (const char* mode = std::getenv("POLYHOOK_TIERING"); mode && std::string_view(mode) == "universal")
+			return PLH::TieredCompiler::kNeverPromote;
+
+		const char* value = std::getenv("POLYHOOK_TIER_THRESHOLD");
+		if (!value || !*value)
+			return kDefaultThreshold;
+		return static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+	}
+}
+
+std::shared_ptr<PLH::TieredCompiler> PLH::TieredCompiler::create(std::shared_ptr<JitRuntime> rt) {
+#ifdef POLYHOOK2_ARCH_X64
+	if (!rt || IsDisabled())
+		return nullptr;
+
+	auto tier = std::make_shared<TieredCompiler>(std::move(rt), GetThreshold());
+	if (!tier->getGenericStub())
+		return nullptr;
+	return tier;
+#else
+	(void) rt;
+	return nullptr;
+#endif
+}
+
+bool PLH::TieredCompiler::isSupported(const Signature* signature) noexcept {
+#ifdef POLYHOOK2_ARCH_X64
+	return signature && signature->arguments.size() <= GenericFrame::kMaxArgs;
+#else
+	(void) signature;
+	return false;
+#endif
+}
+
+PLH::TieredCompiler::TieredCompiler(std::shared_ptr<JitRuntime> rt, uint32_t threshold) : m_rt(rt), m_threshold(threshold), m_thunks(rt) {
+	m_genericStub = emitGenericStub();
+	if (m_genericStub && m_threshold != kNeverPromote) {
+		m_thread = std::jthread([this](std::stop_token token) { run(std::move(token)); });
+	}
+}
+
+PLH::TieredCompiler::~TieredCompiler() {
+	if (m_thread.joinable()) {
+		m_thread.request_stop();
+		m_thread.join();
+	}
+
+	if (auto rt = m_rt.lock()) {
+		if (m_genericStub) {
+			JitSymbols::remove(m_genericStub);
+			m_unwind.deregisterFrame();
+			rt->release(m_genericStub);
+		}
+	}
+}
+
+uint64_t PLH::TieredCompiler::emitGenericStub() {
+#ifdef POLYHOOK2_ARCH_X64
+	auto rt = m_rt.lock();
+	if (!rt)
+		return 0;
+
+	using namespace x86;
+
+#if defined(_WIN32)
+	const Gp gpArgs[GenericFrame::kGpArgs] = { rcx, rdx, r8, r9 };
+	const Gp firstArg = rcx;
+#else
+	const Gp gpArgs[GenericFrame::kGpArgs] = { rdi, rsi, rdx, rcx, r8, r9 };
+	const Gp firstArg = rdi;
+#endif
+
+	auto frame = [](size_t offset) {
+		return qword_ptr(rbp, kFrameDisp + static_cast<int32_t>(offset));
+	};
+
+	CodeHolder code;
+	code.init(rt->environment(), rt->cpuFeatures());
+	Assembler a(&code);
+
+	Label supercede = a.newLabel();
+	Label noStack = a.newLabel();
+	Label copy = a.newLabel();
+
+	a.push(rbp);
+	a.mov(rbp, rsp);
+	a.sub(rsp, kFrameSize);
+
+	// spill everything an argument could live in, the signature sorts it out later
+	for (size_t i = 0; i < GenericFrame::kGpArgs; ++i) {
+		a.mov(frame(offsetof(GenericFrame, gp) + i * sizeof(uint64_t)), gpArgs[i]);
+	}
+	for (size_t i = 0; i < GenericFrame::kXmmArgs; ++i) {
+		a.movq(frame(offsetof(GenericFrame, xmm) + i * sizeof(uint64_t)), xmm(static_cast<uint32_t>(i)));
+	}
+	a.mov(frame(offsetof(GenericFrame, callback)), r11);
+	a.mov(frame(offsetof(GenericFrame, rax)), rax);
+	a.lea(rax, ptr(rbp, kStackArgs));
+	a.mov(frame(offsetof(GenericFrame, stack)), rax);
+
+	a.lea(firstArg, ptr(rbp, kFrameDisp));
+	a.mov(rax, reinterpret_cast<uint64_t>(&Callback::genericEnter));
+	a.call(rax);
+	a.test(al, al);
+	a.jnz(supercede);
+
+	// forward stack arguments below a fresh (home space +) argument area
+	a.mov(rcx, frame(offsetof(GenericFrame, stackSlots)));
+	a.test(rcx, rcx);
+	a.jz(noStack);
+	a.mov(rax, rcx);
+	a.shl(rax, 3);
+	a.add(rax, 15 + kShadowSpace);
+	a.and_(rax, -16);
+	a.sub(rsp, rax);
+	a.mov(r10, frame(offsetof(GenericFrame, stack)));
+	a.lea(rdx, ptr(rsp, kShadowSpace));
+	a.bind(copy);
+	a.mov(rax, ptr(r10));
+	a.mov(ptr(rdx), rax);
+	a.add(r10, sizeof(uint64_t));
+	a.add(rdx, sizeof(uint64_t));
+	a.dec(rcx);
+	a.jnz(copy);
+	a.bind(noStack);
+
+	// reload the (possibly modified) arguments and call the original
+	for (size_t i = 0; i < GenericFrame::kGpArgs; ++i) {
+		a.mov(gpArgs[i], frame(offsetof(GenericFrame, gp) + i * sizeof(uint64_t)));
+	}
+	for (size_t i = 0; i < GenericFrame::kXmmArgs; ++i) {
+		a.movq(xmm(static_cast<uint32_t>(i)), frame(offsetof(GenericFrame, xmm) + i * sizeof(uint64_t)));
+	}
+	a.mov(rax, frame(offsetof(GenericFrame, rax)));
+	a.mov(r11, frame(offsetof(GenericFrame, original)));
+	a.call(r11);
+	a.lea(rsp, ptr(rbp, -kFrameSize));
+	a.mov(frame(offsetof(GenericFrame, ret)), rax);
+	a.movq(frame(offsetof(GenericFrame, retXmm)), xmm0);
+
+	a.bind(supercede);
+	a.lea(firstArg, ptr(rbp, kFrameDisp));
+	a.mov(rax, reinterpret_cast<uint64_t>(&Callback::genericLeave));
+	a.call(rax);
+
+	// return value goes out in both register classes, the caller only reads the one it expects
+	a.mov(rax, frame(offsetof(GenericFrame, ret)));
+	a.movq(xmm0, frame(offsetof(GenericFrame, ret)));
+	a.mov(rsp, rbp);
+	a.pop(rbp);
+	a.ret();
+
+	uint64_t stub = 0;
+	if (rt->add(&stub, &code) != kErrorOk)
+		return 0;
+
+	m_genericSize = code.codeSize();
+	JitSymbols::add(stub, m_genericSize, "polyhook::generic");
+
+	FrameLayout layout;
+	layout.preservedFP = true;
+	layout.stackAdjustment = static_cast<uint32_t>(kFrameSize);
+	m_unwind.registerFrame(layout, stub, m_genericSize);
+
+	return stub;
+#else
+	return 0;
+#endif
+}
+
+uint64_t PLH::TieredCompiler::createThunk(Callback* callback) {
+#ifdef POLYHOOK2_ARCH_X64
+	// r11 is volatile and never carries an argument in either x64 convention
+	return m_thunks.acquire(callback);
+#else
+	(void) callback;
+	return 0;
+#endif
+}
+
+void PLH::TieredCompiler::releaseThunk(uint64_t thunk) {
+	m_thunks.release(thunk);
+}
+
+void PLH::TieredCompiler::enqueue(Callback* callback) {
+	{
+		std::lock_guard lock(m_mutex);
+		m_queue.push_back(callback);
+	}
+	m_pending.notify_one();
+}
+
+void PLH::TieredCompiler::cancel(Callback* callback) {
+	std::unique_lock lock(m_mutex);
+	std::erase(m_queue, callback);
+	m_idle.wait(lock, [&] { return m_current != callback; });
+}
+
+void PLH::TieredCompiler::run(std::stop_token token) {
+	while (true) {
+		Callback* callback;
+		{
+			std::unique_lock lock(m_mutex);
+			if (!m_pending.wait(lock, token, [&] { return !m_queue.empty(); }))
+				return;
+			callback = m_queue.front();
+			m_queue.pop_front();
+			m_current = callback;
+		}
+
+		callback->promote();
+
+		{
+			std::lock_guard lock(m_mutex);
+			m_current = nullptr;
+		}
+		m_idle.notify_all();
+	}
+}
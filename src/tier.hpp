@@ -0,0 +1,97 @@
+#pragma once
+
+#include "callback.hpp"
+#include "thunk.hpp"
+#include "unwind.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace PLH {
+	/**
+	 * Register and stack state captured by the generic stub. The layout is shared with the emitted code,
+	 * Callback::genericEnter/genericLeave read the arguments out of it using the hook signature.
+	 */
+	struct GenericFrame {
+		static constexpr size_t kMaxArgs = 16;
+#if defined(_WIN32)
+		static constexpr size_t kGpArgs = 4;
+		static constexpr size_t kXmmArgs = 4;
+#else
+		static constexpr size_t kGpArgs = 6;
+		static constexpr size_t kXmmArgs = 8;
+#endif
+
+		uint64_t gp[kGpArgs];
+		uint64_t xmm[kXmmArgs];   ///< low 64 bits of the vector argument registers
+		uint64_t* stack;          ///< first stack argument in the caller frame
+		Callback* callback;
+		uint64_t rax;             ///< al holds the vector register count for SysV variadic calls
+		uint64_t original;        ///< trampoline to call, set by genericEnter
+		uint64_t stackSlots;      ///< stack arguments to forward to the original, set by genericEnter
+		uint64_t ret;             ///< Callback::Return storage
+		uint64_t retXmm;
+		uint64_t args[kMaxArgs];  ///< Callback::Parameters storage
+		ReturnFlag flag;
+	};
+
+	/**
+	 * Arms hooks without compiling them and specializes them on a background thread.
+	 *
+	 * A tiered hook jumps through a small per-hook entry thunk that loads its Callback into r11 and
+	 * jumps through Callback::m_entryTarget. Thunks are packed into a ThunkPool, so a cold hook costs
+	 * 16 bytes of code. The target starts at a single generic stub shared by all
+	 * hooks, which spills the argument registers and lets the signature decide where every argument lives.
+	 * Once a hook has been called getThreshold() times it is queued, its specialized stub is compiled by
+	 * the worker thread and the entry target is swapped atomically.
+	 *
+	 * Tiering is x86-64 only. It is disabled by setting POLYHOOK_TIERING=0 and the promotion threshold
+	 * can be changed with POLYHOOK_TIER_THRESHOLD (0 compiles every hook in the background right away).
+	 * POLYHOOK_TIERING=universal never promotes, every hook stays on the generic stub.
+	 */
+	class TieredCompiler {
+	public:
+		static constexpr uint32_t kNeverPromote = UINT32_MAX;
+
+		explicit TieredCompiler(std::shared_ptr<asmjit::JitRuntime> rt, uint32_t threshold);
+		~TieredCompiler();
+		TieredCompiler(const TieredCompiler&) = delete;
+		TieredCompiler& operator=(const TieredCompiler&) = delete;
+
+		static std::shared_ptr<TieredCompiler> create(std::shared_ptr<asmjit::JitRuntime> rt);
+		static bool isSupported(const Signature* signature) noexcept;
+
+		uint64_t getGenericStub() const noexcept { return m_genericStub; }
+		uint32_t getThreshold() const noexcept { return m_threshold; }
+
+		uint64_t createThunk(Callback* callback);
+		void releaseThunk(uint64_t thunk);
+		const ThunkPool& getThunkPool() const noexcept { return m_thunks; }
+
+		void enqueue(Callback* callback);
+		void cancel(Callback* callback);
+
+	private:
+		uint64_t emitGenericStub();
+		void run(std::stop_token token);
+
+		std::weak_ptr<asmjit::JitRuntime> m_rt;
+		uint64_t m_genericStub = 0;
+		size_t m_genericSize = 0;
+		uint32_t m_threshold;
+		UnwindInfo m_unwind;
+		ThunkPool m_thunks;
+
+		std::mutex m_mutex;
+		std::condition_variable_any m_pending;
+		std::condition_variable m_idle;
+		std::deque<Callback*> m_queue;
+		Callback* m_current = nullptr;
+		std::jthread m_thread;
+	};
+}
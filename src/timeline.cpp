@@ -0,0 +1,262 @@
+#include "timeline.hpp"
+#include "rings.hpp"
+#include <plugify/compat_format.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+namespace {
+	enum class Phase : uint8_t {
+		Begin,
+		End,
+		Handler
+	};
+
+	struct Event {
+		uint64_t time;
+		uint64_t duration;
+		const void* id; ///< hook for Begin, handler for Handler
+		Phase phase;
+	};
+
+	struct Operation {
+		uint64_t start;
+		uint64_t duration;
+		uint64_t thread;
+		std::string name;
+	};
+
+	std::atomic<bool> g_enabled = false;
+
+	uint64_t GetThreadId() {
+#if defined(_WIN32)
+		return GetCurrentThreadId();
+#elif defined(__linux__)
+		return static_cast<uint64_t>(syscall(SYS_gettid));
+#else
+		return std::hash<std::thread::id>{}(std::this_thread::get_id());
+#endif
+	}
+
+	// the rings' mutex guards everything below as well, the writer holds it while flushing
+	PLH::ThreadRings<Event, PLH::Timeline::kCapacity> g_rings(&GetThreadId);
+	std::mutex& g_mutex = g_rings.getMutex();
+	std::vector<Operation> g_operations;
+	std::unordered_map<const void*, std::string> g_names;
+	std::ofstream g_file;
+	bool g_firstEvent = true;
+
+	uint64_t GetProcessId() {
+#if defined(_WIN32)
+		static const uint64_t pid = GetCurrentProcessId();
+#else
+		static const uint64_t pid = static_cast<uint64_t>(getpid());
+#endif
+		return pid;
+	}
+
+	std::string GetSymbolName(const void* address) {
+#if defined(__linux__)
+		Dl_info info{};
+		if (address && dladdr(address, &info) && info.dli_sname && info.dli_saddr == address)
+			return info.dli_sname;
+#endif
+		return std::format("0x{:x}", reinterpret_cast<uintptr_t>(address));
+	}
+
+	// g_mutex held, handlers are named on first sight
+	const std::string& GetName(const void* id) {
+		auto it = g_names.find(id);
+		if (it == g_names.end()) {
+			it = g_names.emplace(id, GetSymbolName(id)).first;
+		}
+		return it->second;
+	}
+
+	void Push(uint64_t time, uint64_t duration, const void* id, Phase phase) {
+		g_rings.push([&](Event& event, uint64_t) {
+			event = {time, duration, id, phase};
+		});
+	}
+
+	void AppendEscaped(std::string& out, std::string_view text) {
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				out += '\\';
+				out += c;
+			} else if (static_cast<unsigned char>(c) < 0x20) {
+				std::format_to(std::back_inserter(out), "\\u{:04x}", static_cast<unsigned>(c));
+			} else {
+				out += c;
+			}
+		}
+	}
+
+	// the trace format counts in microseconds, fractions keep the nanoseconds
+	void AppendEvent(std::string& out, std::string_view phase, std::string_view category, std::string_view name, uint64_t time, uint64_t duration, uint64_t thread) {
+		out += g_firstEvent ? "{" : ",\n{";
+		g_firstEvent = false;
+		if (!name.empty()) {
+			out += "\"name\":\"";
+			AppendEscaped(out, name);
+			std::format_to(std::back_inserter(out), "\",\"cat\":\"{}\",", category);
+		}
+		std::format_to(std::back_inserter(out), "\"ph\":\"{}\",\"ts\":{}.{:03}", phase, time / 1000, time % 1000);
+		if (phase == "X") {
+			std::format_to(std::back_inserter(out), ",\"dur\":{}.{:03}", duration / 1000, duration % 1000);
+		}
+		std::format_to(std::back_inserter(out), ",\"pid\":{},\"tid\":{}}}", GetProcessId(), thread);
+	}
+
+	// g_mutex held
+	size_t FlushLocked() {
+		if (!g_file.is_open())
+			return 0;
+
+		std::string out;
+		size_t count = 0;
+		for (size_t i = 0; i < g_rings.getRingCount(); ++i) {
+			count += g_rings.read(i, PLH::Timeline::kCapacity, [&](std::span<const Event> events, uint64_t thread) {
+				for (const Event& event : events) {
+					switch (event.phase) {
+						case Phase::Begin:
+							AppendEvent(out, "B", "hook", GetName(event.id), event.time, 0, thread);
+							break;
+						case Phase::End:
+							AppendEvent(out, "E", {}, {}, event.time, 0, thread);
+							break;
+						case Phase::Handler:
+							AppendEvent(out, "X", "handler", GetName(event.id), event.time, event.duration, thread);
+							break;
+					}
+				}
+			});
+		}
+		g_rings.release();
+
+		for (const Operation& operation : g_operations) {
+			AppendEvent(out, "X", "install", operation.name, operation.start, operation.duration, operation.thread);
+		}
+		count += g_operations.size();
+		g_operations.clear();
+
+		g_file.write(out.data(), static_cast<std::streamsize>(out.size()));
+		g_file.flush();
+		return count;
+	}
+}
+
+PLH::Timeline::Span::Span(std::string_view operation, const void* target) {
+	if (!isEnabled())
+		return;
+	m_name = std::format("{} {}", operation, GetSymbolName(target));
+	m_start = now();
+}
+
+PLH::Timeline::Span::Span(std::string_view operation, std::string_view target) {
+	if (!isEnabled())
+		return;
+	m_name = target.empty() ? std::string(operation) : std::format("{} {}", operation, target);
+	m_start = now();
+}
+
+PLH::Timeline::Span::~Span() {
+	if (m_name.empty())
+		return;
+
+	const uint64_t duration = now() - m_start;
+	std::lock_guard lock(g_mutex);
+	g_operations.push_back({m_start, duration, GetThreadId(), std::move(m_name)});
+}
+
+bool PLH::Timeline::open(const std::filesystem::path& path) {
+	std::lock_guard lock(g_mutex);
+
+	if (g_file.is_open()) {
+		FlushLocked();
+		g_file << "\n]\n";
+		g_file.close();
+	}
+
+	g_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!g_file) {
+		g_enabled.store(false, std::memory_order_relaxed);
+		return false;
+	}
+
+	// leftovers of an earlier file are not written to this one
+	g_rings.discard();
+	g_operations.clear();
+
+	// viewers accept an unterminated array, a file cut short by a crash still loads
+	g_file << "[\n";
+	g_firstEvent = true;
+	g_enabled.store(true, std::memory_order_relaxed);
+	return true;
+}
+
+bool PLH::Timeline::close() {
+	std::lock_guard lock(g_mutex);
+
+	if (!g_file.is_open())
+		return false;
+
+	g_enabled.store(false, std::memory_order_relaxed);
+	FlushLocked();
+	g_file << "\n]\n";
+	g_file.close();
+	return true;
+}
+
+bool PLH::Timeline::isEnabled() noexcept {
+	return g_enabled.load(std::memory_order_relaxed);
+}
+
+void PLH::Timeline::setName(const void* hook, std::string_view name) {
+	std::lock_guard lock(g_mutex);
+	g_names[hook] = name;
+}
+
+uint64_t PLH::Timeline::now() noexcept {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void PLH::Timeline::begin(const Callback* hook) {
+	Push(now(), 0, hook, Phase::Begin);
+}
+
+void PLH::Timeline::end() {
+	Push(now(), 0, nullptr, Phase::End);
+}
+
+void PLH::Timeline::handler(const void* handler, uint64_t start) {
+	Push(start, now() - start, handler, Phase::Handler);
+}
+
+size_t PLH::Timeline::flush() {
+	std::lock_guard lock(g_mutex);
+	return FlushLocked();
+}
+
+uint64_t PLH::Timeline::getDropped() {
+	std::lock_guard lock(g_mutex);
+	return g_rings.getDropped();
+}
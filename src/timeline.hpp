@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace PLH {
+	class Callback;
+
+	/**
+	 * Hook activity as a Chrome JSON trace, which chrome://tracing and the Perfetto UI open next to the rest of a
+	 * frame timeline. While a file is open, the plugin's entries write a begin event when a hooked call enters the
+	 * pre entry, a span per handler and an end event when the post entry is done. Installs and removals become
+	 * spans of their own, on the thread which made them.
+	 *
+	 * Events go to per-thread single producer, single consumer rings without locks, a full ring drops them and
+	 * counts them. flush moves them into the file, from OnPluginUpdate or on demand. Timestamps are steady_clock,
+	 * which is CLOCK_MONOTONIC on Linux like Perfetto's own, and thread ids are the OS ones.
+	 */
+	class Timeline {
+	public:
+		static constexpr size_t kCapacity = 65536; ///< events per thread, a power of two, 2 MiB
+
+		/** Records the enclosing scope as an install or removal span, its name is only built while a file is open. */
+		class Span {
+		public:
+			Span(std::string_view operation, const void* target);
+			Span(std::string_view operation, std::string_view target);
+			~Span();
+			Span(const Span&) = delete;
+			Span& operator=(const Span&) = delete;
+
+		private:
+			std::string m_name;
+			uint64_t m_start = 0;
+		};
+
+		static bool open(const std::filesystem::path& path);
+		static bool close();
+		static bool isEnabled() noexcept;
+
+		/// names events of the given hook, kept after the hook is gone since its events may still be buffered
+		static void setName(const void* hook, std::string_view name);
+
+		static uint64_t now() noexcept;
+		static void begin(const Callback* hook);
+		static void end();
+		static void handler(const void* handler, uint64_t start);
+
+		/// writes the buffered events, returns how many
+		static size_t flush();
+		/// events lost to full rings since start
+		static uint64_t getDropped();
+	};
+}
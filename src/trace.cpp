@@ -0,0 +1,132 @@
+#include "trace.hpp"
+#include "rings.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(PLH::TraceRecord) == 128, "records are two cache lines");
+
+namespace {
+	constexpr uint32_t kFileVersion = 1;
+
+	std::atomic<uint32_t> g_threads = 0;
+
+	// small thread numbers in order of the first traced call keep the record at 128 bytes
+	uint64_t GetThreadNumber() {
+		return g_threads.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	PLH::ThreadRings<PLH::TraceRecord, PLH::TraceBuffer::kCapacity> g_rings(&GetThreadNumber);
+	size_t g_cursor = 0; ///< guarded by the rings' mutex
+}
+
+void PLH::TraceBuffer::record(const Callback* hook, const Callback::Parameters* params, size_t count, const Callback::Return* ret) {
+	g_rings.push([&](TraceRecord& record, uint64_t thread) {
+		record.timestamp = __rdtsc();
+		record.hook = reinterpret_cast<uint64_t>(hook);
+		record.thread = static_cast<uint32_t>(thread);
+		record.count = static_cast<uint32_t>(std::min(count, TraceRecord::kArgs));
+		record.ret = ret->getRet<uint64_t>();
+		for (uint32_t i = 0; i < record.count; ++i) {
+			record.args[i] = params->getArg<uint64_t>(i);
+		}
+	});
+}
+
+size_t PLH::TraceBuffer::drain(std::span<TraceRecord> out) {
+	std::lock_guard lock(g_rings.getMutex());
+
+	size_t copied = 0;
+	const size_t rings = g_rings.getRingCount();
+	// start one ring further every drain, a small buffer must not keep serving the same threads
+	for (size_t n = 0; n < rings && copied < out.size(); ++n) {
+		g_rings.read((g_cursor + n) % rings, out.size() - copied, [&](std::span<const TraceRecord> records, uint64_t) {
+			std::memcpy(&out[copied], records.data(), records.size_bytes());
+			copied += records.size();
+		});
+	}
+	g_cursor = rings ? (g_cursor + 1) % rings : 0;
+
+	g_rings.release();
+	return copied;
+}
+
+uint64_t PLH::TraceBuffer::getDropped() {
+	std::lock_guard lock(g_rings.getMutex());
+	return g_rings.getDropped();
+}
+
+PLH::TraceWriter::TraceWriter(const std::filesystem::path& path, size_t maxBytes) {
+#if !defined(_WIN32)
+	m_capacity = (std::max(maxBytes, sizeof(Header)) - sizeof(Header)) / sizeof(TraceRecord);
+	if (!m_capacity)
+		return;
+	m_size = sizeof(Header) + m_capacity * sizeof(TraceRecord);
+
+	m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (m_fd < 0)
+		return;
+	if (ftruncate(m_fd, static_cast<off_t>(m_size)) != 0)
+		return;
+
+	void* p = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (p == MAP_FAILED)
+		return;
+
+	m_header = static_cast<Header*>(p);
+	std::memcpy(m_header->magic, "PLHTRACE", sizeof(m_header->magic));
+	m_header->version = kFileVersion;
+	m_header->recordSize = sizeof(TraceRecord);
+	m_header->count = 0;
+	m_header->dropped = 0;
+#else
+	(void) path;
+	(void) maxBytes;
+#endif
+}
+
+PLH::TraceWriter::~TraceWriter() {
+#if !defined(_WIN32)
+	if (m_header) {
+		flush();
+		const uint64_t count = m_header->count;
+		munmap(m_header, m_size);
+		// a short session should not leave a file of the full size behind
+		if (ftruncate(m_fd, static_cast<off_t>(sizeof(Header) + count * sizeof(TraceRecord))) != 0) {
+			std::puts("PolyHook: failed to trim trace file");
+		}
+	}
+	if (m_fd >= 0) {
+		close(m_fd);
+	}
+#endif
+}
+
+size_t PLH::TraceWriter::flush() {
+	if (!m_header)
+		return 0;
+
+	auto* records = reinterpret_cast<TraceRecord*>(m_header + 1);
+	const uint64_t count = m_header->count;
+	const size_t written = TraceBuffer::drain({records + count, m_capacity - static_cast<size_t>(count)});
+
+	// a reader tailing the file may rely on the count covering complete records only
+	std::atomic_ref(m_header->count).store(count + written, std::memory_order_release);
+	m_header->dropped = TraceBuffer::getDropped();
+	return written;
+}
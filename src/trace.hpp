@@ -0,0 +1,70 @@
+#pragma once
+
+#include "callback.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+namespace PLH {
+	/** One traced call, 128 bytes, as DrainTrace copies it out and the trace file stores it. */
+	struct TraceRecord {
+		static constexpr size_t kArgs = 12;
+
+		uint64_t timestamp; ///< rdtsc when the call returned
+		uint64_t hook;      ///< Callback address
+		uint32_t thread;    ///< small per-process thread number, in order of the threads' first traced call
+		uint32_t count;     ///< argument slots recorded, at most kArgs
+		uint64_t ret;       ///< raw return slot
+		uint64_t args[kArgs];
+	};
+
+	/**
+	 * Per-thread single producer, single consumer rings of TraceRecords for callbacks with the trace flag set.
+	 * The plugin's post entry appends to the calling thread's ring with one release store and no lock, a full
+	 * ring drops the record and counts it. Rings are created on a thread's first traced call and released once
+	 * the thread is gone and everything it recorded was drained. Memory is bounded by kCapacity per thread.
+	 */
+	class TraceBuffer {
+	public:
+		static constexpr size_t kCapacity = 32768; ///< records per thread, a power of two, 4 MiB
+
+		static void record(const Callback* hook, const Callback::Parameters* params, size_t count, const Callback::Return* ret);
+
+		/// moves up to out.size() records out of the rings, oldest first within each thread
+		static size_t drain(std::span<TraceRecord> out);
+		/// records lost to full rings since start
+		static uint64_t getDropped();
+	};
+
+	/**
+	 * Streams drained records into a memory-mapped file of fixed size: a header with the record count
+	 * followed by the records. Once the file is full, flush stops draining and the rings fill up and drop.
+	 * The file is cut to the records written when the writer closes. POSIX only.
+	 */
+	class TraceWriter {
+	public:
+		struct Header {
+			char magic[8];      ///< "PLHTRACE"
+			uint32_t version;
+			uint32_t recordSize;
+			uint64_t count;     ///< records written, updated after the records themselves
+			uint64_t dropped;
+		};
+
+		TraceWriter(const std::filesystem::path& path, size_t maxBytes);
+		~TraceWriter();
+		TraceWriter(const TraceWriter&) = delete;
+		TraceWriter& operator=(const TraceWriter&) = delete;
+
+		bool isOpen() const noexcept { return m_header != nullptr; }
+		size_t flush();
+
+	private:
+		int m_fd = -1;
+		Header* m_header = nullptr;
+		size_t m_size = 0;
+		size_t m_capacity = 0;
+	};
+}
@@ -0,0 +1,431 @@
+#include "unwind.hpp"
+
+#include <cstring>
+#include <optional>
+#include <utility>
+
+#if defined(__linux__)
+#include <dlfcn.h>
+
+extern "C" void __register_frame(const void* begin);
+extern "C" void __deregister_frame(const void* begin);
+#endif
+
+using namespace asmjit;
+using PLH::FrameLayout;
+
+namespace {
+	enum : uint8_t {
+		DW_CFA_nop = 0x00,
+		DW_CFA_advance_loc1 = 0x02,
+		DW_CFA_advance_loc2 = 0x03,
+		DW_CFA_def_cfa = 0x0c,
+		DW_CFA_def_cfa_register = 0x0d,
+		DW_CFA_def_cfa_offset = 0x0e,
+		DW_CFA_advance_loc = 0x40,
+		DW_CFA_offset = 0x80,
+	};
+
+	constexpr uint8_t kDwarfRsp = 7;
+	constexpr uint8_t kDwarfRbp = 6;
+	constexpr uint8_t kDwarfRip = 16;
+	constexpr uint8_t kIdSp = 4;
+	constexpr uint8_t kIdBp = 5;
+
+	// asmjit x86 register id -> DWARF x86-64 register number
+	constexpr uint8_t kDwarfRegs[16] = { 0, 2, 1, 3, 7, 6, 4, 5, 8, 9, 10, 11, 12, 13, 14, 15 };
+
+	void WriteULEB(std::vector<uint8_t>& out, uint64_t value) {
+		do {
+			uint8_t byte = value & 0x7F;
+			value >>= 7;
+			if (value != 0)
+				byte |= 0x80;
+			out.push_back(byte);
+		} while (value != 0);
+	}
+
+	void WriteSLEB(std::vector<uint8_t>& out, int64_t value) {
+		bool more = true;
+		while (more) {
+			uint8_t byte = value & 0x7F;
+			value >>= 7;
+			if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40)))
+				more = false;
+			else
+				byte |= 0x80;
+			out.push_back(byte);
+		}
+	}
+
+	template<typename T>
+	void Write(std::vector<uint8_t>& out, T value) {
+		uint8_t bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		out.insert(out.end(), bytes, bytes + sizeof(T));
+	}
+
+	template<typename T>
+	void Patch(std::vector<uint8_t>& out, size_t offset, T value) {
+		std::memcpy(out.data() + offset, &value, sizeof(T));
+	}
+
+	void AlignRecord(std::vector<uint8_t>& out, size_t recordStart) {
+		while ((out.size() - recordStart) % sizeof(uint64_t) != 0) {
+			out.push_back(DW_CFA_nop);
+		}
+	}
+
+	/**
+	 * Emits CFA rules while walking the prologue/epilogue asmjit generated for the given frame.
+	 * The stub body never pushes, so the rule in effect after the prologue holds until the epilogue.
+	 */
+	class CfiWriter {
+	public:
+		CfiWriter(const uint8_t* code, size_t size) : m_code(code), m_size(size) {}
+
+		bool prologue(const FrameLayout& layout) {
+			uint32_t gpSaved = layout.savedGp;
+
+			if (layout.preservedFP) {
+				gpSaved &= ~(1u << kIdBp);
+
+				if (!match({0x55}))
+					return false;
+				push(kIdBp);
+
+				if (!match({0x48, 0x89, 0xE5}) && !match({0x48, 0x8B, 0xEC}))
+					return false;
+				advance();
+				defCfaRegister(kDwarfRbp);
+			}
+
+			for (uint8_t id = 0; id < 16; ++id) {
+				if (!(gpSaved & (1u << id)))
+					continue;
+
+				bool ok = id < 8 ? match({static_cast<uint8_t>(0x50 + id)}) : match({0x41, static_cast<uint8_t>(0x50 + id - 8)});
+				if (!ok)
+					return false;
+				push(id);
+			}
+
+			if (layout.saRegId < 16 && layout.saRegId != kIdSp && !(layout.preservedFP && layout.saRegId == kIdBp)) {
+				const uint8_t sa = layout.saRegId;
+				const uint8_t rexB = sa >= 8 ? 0x49 : 0x48;
+				const uint8_t rexR = sa >= 8 ? 0x4C : 0x48;
+				if (!match({rexB, 0x89, static_cast<uint8_t>(0xE0 | (sa & 7))}) && !match({rexR, 0x8B, static_cast<uint8_t>(0xC4 | ((sa & 7) << 3))}))
+					return false;
+				if (!m_fpBased) {
+					advance();
+					defCfaRegister(kDwarfRegs[sa]);
+				}
+			}
+
+			// dynamic alignment, 'and rsp, -N' does not change a register based CFA
+			if (m_fpBased && !matchImm({0x48, 0x83, 0xE4}, 1)) {
+				matchImm({0x48, 0x81, 0xE4}, 4);
+			}
+
+			if (layout.stackAdjustment) {
+				if (!matchImm({0x48, 0x83, 0xEC}, 1) && !matchImm({0x48, 0x81, 0xEC}, 4))
+					return false;
+				if (!m_fpBased) {
+					advance();
+					m_cfaOffset += layout.stackAdjustment;
+					defCfaOffset();
+				}
+			}
+
+			return true;
+		}
+
+		void epilogue(const FrameLayout& layout) {
+			std::vector<uint8_t> pattern;
+
+			uint32_t gpSaved = layout.savedGp;
+			uint32_t pushes = 0;
+			if (layout.preservedFP)
+				gpSaved &= ~(1u << kIdBp);
+			for (uint8_t id = 0; id < 16; ++id) {
+				if (gpSaved & (1u << id))
+					++pushes;
+			}
+
+			size_t adjustLength = 0;
+			if (layout.preservedFP) {
+				const int32_t count = static_cast<int32_t>(pushes * sizeof(uint64_t));
+				if (count == 0) {
+					pattern = {0x48, 0x89, 0xEC};
+				} else if (count <= 128) {
+					pattern = {0x48, 0x8D, 0x65, static_cast<uint8_t>(-count)};
+				} else {
+					pattern = {0x48, 0x8D, 0xA5};
+					int32_t disp = -count;
+					pattern.insert(pattern.end(), reinterpret_cast<uint8_t*>(&disp), reinterpret_cast<uint8_t*>(&disp) + sizeof(disp));
+				}
+				adjustLength = pattern.size();
+			} else if (layout.saRegId < 16 && layout.saRegId != kIdSp && layout.saRegId != kIdBp) {
+				// stack pointer restored from a register, not worth describing
+				return;
+			} else if (layout.stackAdjustment) {
+				if (layout.stackAdjustment <= 127) {
+					pattern = {0x48, 0x83, 0xC4, static_cast<uint8_t>(layout.stackAdjustment)};
+				} else {
+					pattern = {0x48, 0x81, 0xC4};
+					uint32_t imm = layout.stackAdjustment;
+					pattern.insert(pattern.end(), reinterpret_cast<uint8_t*>(&imm), reinterpret_cast<uint8_t*>(&imm) + sizeof(imm));
+				}
+				adjustLength = pattern.size();
+			}
+
+			std::vector<uint8_t> popLengths;
+			for (int id = 15; id >= 0; --id) {
+				if (!(gpSaved & (1u << id)))
+					continue;
+				if (id < 8) {
+					pattern.push_back(static_cast<uint8_t>(0x58 + id));
+					popLengths.push_back(1);
+				} else {
+					pattern.push_back(0x41);
+					pattern.push_back(static_cast<uint8_t>(0x58 + id - 8));
+					popLengths.push_back(2);
+				}
+			}
+			if (layout.preservedFP) {
+				pattern.push_back(0x5D);
+			}
+			if (layout.calleeCleanup) {
+				pattern.push_back(0xC2);
+				pattern.push_back(static_cast<uint8_t>(layout.calleeCleanup & 0xFF));
+				pattern.push_back(static_cast<uint8_t>(layout.calleeCleanup >> 8));
+			} else {
+				pattern.push_back(0xC3);
+			}
+
+			// asmjit places the single function epilogue at the end of the body, search backwards for it
+			std::optional<size_t> start;
+			for (size_t i = m_size >= pattern.size() ? m_size - pattern.size() + 1 : 0; i-- > m_offset;) {
+				if (std::memcmp(m_code + i, pattern.data(), pattern.size()) == 0) {
+					start = i;
+					break;
+				}
+			}
+			if (!start)
+				return;
+
+			m_offset = *start + adjustLength;
+			if (!m_fpBased && adjustLength) {
+				advance();
+				m_cfaOffset -= layout.stackAdjustment;
+				defCfaOffset();
+			}
+
+			for (uint8_t length : popLengths) {
+				m_offset += length;
+				if (!m_fpBased) {
+					advance();
+					m_cfaOffset -= sizeof(uint64_t);
+					defCfaOffset();
+				}
+			}
+
+			if (layout.preservedFP) {
+				m_offset += 1;
+				advance();
+				m_cfi.push_back(DW_CFA_def_cfa);
+				WriteULEB(m_cfi, kDwarfRsp);
+				WriteULEB(m_cfi, sizeof(uint64_t));
+			}
+		}
+
+		const std::vector<uint8_t>& cfi() const noexcept { return m_cfi; }
+
+	private:
+		bool match(std::initializer_list<uint8_t> bytes) {
+			if (m_offset + bytes.size() > m_size)
+				return false;
+			if (std::memcmp(m_code + m_offset, bytes.begin(), bytes.size()) != 0)
+				return false;
+			m_offset += bytes.size();
+			return true;
+		}
+
+		bool matchImm(std::initializer_list<uint8_t> opcode, size_t immSize) {
+			if (m_offset + opcode.size() + immSize > m_size)
+				return false;
+			if (std::memcmp(m_code + m_offset, opcode.begin(), opcode.size()) != 0)
+				return false;
+			m_offset += opcode.size() + immSize;
+			return true;
+		}
+
+		void push(uint8_t id) {
+			advance();
+			m_pushed += sizeof(uint64_t);
+			if (!m_fpBased) {
+				m_cfaOffset += sizeof(uint64_t);
+				defCfaOffset();
+			}
+			// saved at CFA - (return address + pushed bytes), factored by the CIE data alignment of -8
+			m_cfi.push_back(DW_CFA_offset | kDwarfRegs[id]);
+			WriteULEB(m_cfi, (sizeof(uint64_t) + m_pushed) / sizeof(uint64_t));
+		}
+
+		void advance() {
+			const size_t delta = m_offset - m_lastOffset;
+			if (delta == 0)
+				return;
+			if (delta < 0x40) {
+				m_cfi.push_back(static_cast<uint8_t>(DW_CFA_advance_loc | delta));
+			} else if (delta <= 0xFF) {
+				m_cfi.push_back(DW_CFA_advance_loc1);
+				Write<uint8_t>(m_cfi, static_cast<uint8_t>(delta));
+			} else {
+				m_cfi.push_back(DW_CFA_advance_loc2);
+				Write<uint16_t>(m_cfi, static_cast<uint16_t>(delta));
+			}
+			m_lastOffset = m_offset;
+		}
+
+		void defCfaOffset() {
+			m_cfi.push_back(DW_CFA_def_cfa_offset);
+			WriteULEB(m_cfi, m_cfaOffset);
+		}
+
+		void defCfaRegister(uint8_t dwarfReg) {
+			m_cfi.push_back(DW_CFA_def_cfa_register);
+			WriteULEB(m_cfi, dwarfReg);
+			m_fpBased = true;
+		}
+
+		const uint8_t* m_code;
+		size_t m_size;
+		size_t m_offset = 0;
+		size_t m_lastOffset = 0;
+		uint32_t m_cfaOffset = sizeof(uint64_t);
+		uint32_t m_pushed = 0;
+		bool m_fpBased = false;
+		std::vector<uint8_t> m_cfi;
+	};
+
+	std::vector<uint8_t> BuildEhFrame(const FrameLayout& layout, uint64_t address, size_t size) {
+		CfiWriter writer(reinterpret_cast<const uint8_t*>(address), size);
+		if (!writer.prologue(layout))
+			return {};
+		writer.epilogue(layout);
+
+		std::vector<uint8_t> out;
+
+		// CIE
+		const size_t cieStart = out.size();
+		Write<uint32_t>(out, 0); // length
+		Write<uint32_t>(out, 0); // CIE id
+		out.push_back(1);        // version
+		out.insert(out.end(), {'z', 'R', '\0'});
+		WriteULEB(out, 1);  // code alignment
+		WriteSLEB(out, -8); // data alignment
+		out.push_back(kDwarfRip);
+		WriteULEB(out, 1);  // augmentation data length
+		out.push_back(0x00); // DW_EH_PE_absptr
+		out.push_back(DW_CFA_def_cfa);
+		WriteULEB(out, kDwarfRsp);
+		WriteULEB(out, sizeof(uint64_t));
+		out.push_back(DW_CFA_offset | kDwarfRip);
+		WriteULEB(out, 1);
+		AlignRecord(out, cieStart);
+		Patch<uint32_t>(out, cieStart, static_cast<uint32_t>(out.size() - cieStart - sizeof(uint32_t)));
+
+		// FDE
+		const size_t fdeStart = out.size();
+		Write<uint32_t>(out, 0); // length
+		Write<uint32_t>(out, static_cast<uint32_t>(out.size() - cieStart));
+		Write<uint64_t>(out, address);
+		Write<uint64_t>(out, size);
+		WriteULEB(out, 0); // augmentation data length
+		out.insert(out.end(), writer.cfi().begin(), writer.cfi().end());
+		AlignRecord(out, fdeStart);
+		Patch<uint32_t>(out, fdeStart, static_cast<uint32_t>(out.size() - fdeStart - sizeof(uint32_t)));
+
+		// terminator
+		Write<uint32_t>(out, 0);
+
+		return out;
+	}
+
+#if defined(__linux__)
+	using RegisterFrameFn = void (*)(const void*);
+
+	// The plugin links libgcc statically, so besides our own copy the frames have to reach
+	// the unwinder of the host process which is used by other modules and by backtrace().
+	std::pair<RegisterFrameFn, RegisterFrameFn> GetGlobalUnwinder() {
+		static auto fns = [] {
+			auto reg = reinterpret_cast<RegisterFrameFn>(dlsym(RTLD_DEFAULT, "__register_frame"));
+			auto dereg = reinterpret_cast<RegisterFrameFn>(dlsym(RTLD_DEFAULT, "__deregister_frame"));
+			if (!reg || !dereg || reg == &__register_frame)
+				return std::pair<RegisterFrameFn, RegisterFrameFn>{};
+			return std::pair{reg, dereg};
+		}();
+		return fns;
+	}
+#endif
+}
+
+PLH::FrameLayout PLH::FrameLayout::from(const FuncFrame& frame) noexcept {
+	FrameLayout layout;
+	layout.savedGp = frame.savedRegs(RegGroup::kGp);
+	layout.stackAdjustment = frame.stackAdjustment();
+	layout.calleeCleanup = static_cast<uint16_t>(frame.calleeStackCleanup());
+	layout.saRegId = static_cast<uint8_t>(frame.saRegId());
+	layout.preservedFP = frame.hasPreservedFP();
+	return layout;
+}
+
+bool PLH::UnwindInfo::registerFrame(const FrameLayout& layout, uint64_t address, size_t size) {
+#if defined(__linux__) && defined(__x86_64__)
+	deregisterFrame();
+
+	m_ehFrame = BuildEhFrame(layout, address, size);
+	if (m_ehFrame.empty())
+		return false;
+
+	__register_frame(m_ehFrame.data());
+	m_registered = true;
+
+	if (auto [reg, _] = GetGlobalUnwinder(); reg) {
+		reg(m_ehFrame.data());
+		m_registeredGlobal = true;
+	}
+
+	return true;
+#else
+	(void) layout;
+	(void) address;
+	(void) size;
+	return false;
+#endif
+}
+
+void PLH::UnwindInfo::deregisterFrame() {
+#if defined(__linux__) && defined(__x86_64__)
+	if (m_registeredGlobal) {
+		GetGlobalUnwinder().second(m_ehFrame.data());
+		m_registeredGlobal = false;
+	}
+	if (m_registered) {
+		__deregister_frame(m_ehFrame.data());
+		m_registered = false;
+	}
+#endif
+	m_ehFrame.clear();
+}
+
+void PLH::UnwindInfo::swap(UnwindInfo& other) noexcept {
+	m_ehFrame.swap(other.m_ehFrame);
+	std::swap(m_registered, other.m_registered);
+	std::swap(m_registeredGlobal, other.m_registeredGlobal);
+}
+
+PLH::UnwindInfo::~UnwindInfo() {
+	deregisterFrame();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#pragma warning(push, 0)
+#include <asmjit/asmjit.h>
+#pragma warning( pop )
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace PLH {
+	/**
+	 * Subset of asmjit::FuncFrame which describes how a stub prologue/epilogue moves the stack.
+	 * Kept trivially copyable so it can be stored next to the stub code.
+	 */
+	struct FrameLayout {
+		uint32_t savedGp = 0;         ///< mask of pushed general purpose registers (asmjit ids)
+		uint32_t stackAdjustment = 0; ///< bytes subtracted from the stack pointer after pushes
+		uint16_t calleeCleanup = 0;   ///< bytes popped by 'ret imm16'
+		uint8_t saRegId = 0xFF;       ///< register holding the stack pointer before alignment
+		bool preservedFP = false;     ///< prologue starts with 'push rbp; mov rbp, rsp'
+
+		static FrameLayout from(const asmjit::FuncFrame& frame) noexcept;
+	};
+
+	/**
+	 * Generates .eh_frame CFI for a JIT stub and registers it with the unwinder,
+	 * so C++ exceptions, backtrace() and DWARF based profilers can walk through the stub.
+	 */
+	class UnwindInfo {
+	public:
+		UnwindInfo() = default;
+		~UnwindInfo();
+		UnwindInfo(const UnwindInfo&) = delete;
+		UnwindInfo& operator=(const UnwindInfo&) = delete;
+
+		bool registerFrame(const FrameLayout& layout, uint64_t address, size_t size);
+		void deregisterFrame();
+
+		/** Hands a registration over without re-registering, the CFI buffer keeps its address. */
+		void swap(UnwindInfo& other) noexcept;
+
+	private:
+		std::vector<uint8_t> m_ehFrame;
+		bool m_registered = false;
+		bool m_registeredGlobal = false;
+	};
+}
@@ -0,0 +1,92 @@
+#include "warmup.hpp"
+#include "callback.hpp"
+#include "signature.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <string_view>
+
+namespace {
+	// pointer/int shapes which cover most engine callbacks and member functions
+	constexpr std::string_view kDefaultSignatures[] = {
+		"v()", "v(p)", "v(pp)", "v(pi)", "v(ppp)",
+		"b(p)", "b(pp)", "i(p)", "i(pp)", "p(p)", "p(pp)", "p(ppp)",
+	};
+
+	std::string_view Trim(std::string_view text) noexcept {
+		const auto first = text.find_first_not_of(" \t\r");
+		if (first == std::string_view::npos)
+			return {};
+		const auto last = text.find_last_not_of(" \t\r");
+		return text.substr(first, last - first + 1);
+	}
+}
+
+PLH::WarmupConfig PLH::WarmupConfig::getDefault() {
+	WarmupConfig config;
+	config.reserveBytes = JitArena::kRegionSize;
+	for (std::string_view text : kDefaultSignatures) {
+		config.signatures.push_back(SignatureTable::instance().parse(text));
+	}
+	return config;
+}
+
+PLH::WarmupConfig PLH::WarmupConfig::load(const std::filesystem::path& path) {
+	std::ifstream file(path);
+	if (!file)
+		return getDefault();
+
+	WarmupConfig config;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		std::string_view entry = Trim(line);
+		if (entry.empty() || entry.front() == '#')
+			continue;
+
+		if (entry.starts_with("reserve ")) {
+			config.reserveBytes = static_cast<size_t>(std::strtoull(std::string(entry.substr(8)).c_str(), nullptr, 10));
+			continue;
+		}
+
+		// unknown shapes are skipped, a typo should not keep the plugin from starting
+		if (const Signature* signature = SignatureTable::instance().parse(entry)) {
+			config.signatures.push_back(signature);
+		}
+	}
+	return config;
+}
+
+PLH::Warmup::Warmup(std::shared_ptr<JitArena> rt, WarmupConfig config) : m_rt(rt), m_config(std::move(config)) {
+	m_thread = std::jthread([this](std::stop_token token) { run(std::move(token)); });
+}
+
+PLH::Warmup::~Warmup() {
+	if (m_thread.joinable()) {
+		m_thread.request_stop();
+		m_thread.join();
+	}
+}
+
+bool PLH::Warmup::isEnabled() noexcept {
+	const char* value = std::getenv("POLYHOOK_WARMUP");
+	return !value || value[0] != '0';
+}
+
+void PLH::Warmup::run(std::stop_token token) {
+	if (auto rt = m_rt.lock()) {
+		if (m_config.reserveBytes) {
+			m_reserved.store(rt->reserve(m_config.reserveBytes), std::memory_order_relaxed);
+		}
+
+		for (const Signature* signature : m_config.signatures) {
+			if (token.stop_requested())
+				break;
+			if (Callback::precompile(rt, signature)) {
+				m_compiled.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	m_done.store(true, std::memory_order_release);
+}
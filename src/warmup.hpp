@@ -0,0 +1,60 @@
+#pragma once
+
+#include "arena.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace PLH {
+	struct Signature;
+
+	/**
+	 * What to prepare at plugin start. Read from warmup.cfg in the plugin configs directory, one entry per line:
+	 *
+	 *   # comment
+	 *   reserve 4194304   bytes of JIT arena to reserve and prefault
+	 *   i(pi)             signature to precompile, same format as RegisterSignature
+	 *
+	 * Without a file a single region is reserved and a handful of common pointer/int shapes are precompiled.
+	 */
+	struct WarmupConfig {
+		size_t reserveBytes = 0;
+		std::vector<const Signature*> signatures;
+
+		static WarmupConfig getDefault();
+		static WarmupConfig load(const std::filesystem::path& path);
+	};
+
+	/**
+	 * Runs the warm-up on a background thread, so hooks requested while dependent plugins load find
+	 * reserved arena memory and cached stub templates. Nothing waits for it, a hook racing the warm-up
+	 * compiles its own template. Disabled with POLYHOOK_WARMUP=0.
+	 */
+	class Warmup {
+	public:
+		Warmup(std::shared_ptr<JitArena> rt, WarmupConfig config);
+		~Warmup();
+		Warmup(const Warmup&) = delete;
+		Warmup& operator=(const Warmup&) = delete;
+
+		static bool isEnabled() noexcept;
+
+		bool isDone() const noexcept { return m_done.load(std::memory_order_acquire); }
+		size_t getReservedBytes() const noexcept { return m_reserved.load(std::memory_order_relaxed); }
+		size_t getCompiledCount() const noexcept { return m_compiled.load(std::memory_order_relaxed); }
+
+	private:
+		void run(std::stop_token token);
+
+		std::weak_ptr<JitArena> m_rt;
+		WarmupConfig m_config;
+		std::atomic<size_t> m_reserved = 0;
+		std::atomic<size_t> m_compiled = 0;
+		std::atomic<bool> m_done = false;
+		std::jthread m_thread;
+	};
+}